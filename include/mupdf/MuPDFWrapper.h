@@ -20,7 +20,11 @@ enum
 	ERR_CANNOT_CREATE_WRITER = 142,
 	ERR_CANNOT_CLOSE_DOCUMENT = 143,
 	ERR_CANNOT_CREATE_PAGE = 144,
-	ERR_CANNOT_POPULATE_PAGE = 145
+	ERR_CANNOT_POPULATE_PAGE = 145,
+	ERR_OPEN_ABORTED = 146,
+	ERR_CANNOT_CREATE_ATLAS = 147,
+	ERR_CANNOT_COMPACT_DISPLAY_LIST = 148,
+	ERR_CANNOT_MEASURE_DISPLAY_LIST = 149
 };
 
 //Output raster image formats.
@@ -53,6 +57,53 @@ enum
 	COLOR_BGRA = 3
 };
 
+//Layout version of the buffers produced by GetStructuredTextPageBuffer.
+enum
+{
+	STEXT_BUFFER_VERSION = 1
+};
+
+//Header at the start of a flat structured text buffer. All the offsets are in bytes from the start of the buffer and all the arrays are 4-byte aligned.
+struct stext_buffer_header
+{
+	int32_t version;
+	int32_t header_size;
+	int32_t block_count;
+	int32_t line_count;
+	int32_t char_count;
+
+	//block_count ints (see MuPDFStructuredTextBlock.Types), block_count * 4 floats (x0, y0, x1, y1), block_count + 1 ints (index of the first line of each block).
+	int32_t block_types;
+	int32_t block_bboxes;
+	int32_t block_lines;
+
+	//line_count ints, line_count * 4 floats (x0, y0, x1, y1), line_count * 2 floats (x, y), line_count + 1 ints (index of the first character of each line).
+	int32_t line_wmodes;
+	int32_t line_bboxes;
+	int32_t line_dirs;
+	int32_t line_chars;
+
+	//char_count ints, char_count ints, char_count * 2 floats (x, y), char_count floats, char_count * 8 floats (ul, ur, ll, lr).
+	int32_t char_codepoints;
+	int32_t char_colors;
+	int32_t char_origins;
+	int32_t char_sizes;
+	int32_t char_quads;
+};
+
+
+//Progress of a document being opened by OpenDocumentAsync. The native side writes the progress fields from a worker thread; the caller sets abort to a non-zero value to cancel.
+struct document_open_progress
+{
+	volatile int32_t abort;
+	volatile int32_t done;
+	volatile int64_t bytes_read;
+	volatile int64_t total_bytes;
+	volatile int32_t object_count;
+};
+
+struct open_document_task;
+
 
 //Macros to define the exported functions.
 #define BUILDING_DLL 1
@@ -83,13 +134,10 @@ enum
 #endif
 #endif
 
-//A structure to hold the mutexes used by the locking mechanism. An array might have been a better choice, but this is more easily manageable.
+//A structure to hold the mutexes used by the locking mechanism, one for each fz_lock index.
 struct mutex_holder
 {
-	std::mutex mutex0;
-	std::mutex mutex1;
-	std::mutex mutex2;
-	std::mutex mutex3;
+	std::mutex mutex[FZ_LOCK_MAX];
 };
 
 //Copied here from store.c
@@ -252,6 +300,17 @@ extern "C"
 	/// <returns>An integer equivalent to <see cref="ExitCodes"/> detailing whether any errors occurred.</returns>
 	DLL_PUBLIC int GetStructuredTextBlocks(fz_stext_page* page, fz_stext_block** out_blocks);
 
+	/// <summary>
+	/// Serialise a whole structured text page into a single flat buffer, so that it can be read without walking the blocks, lines and characters one at a time.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="page">The structured text page to serialise.</param>
+	/// <param name="out_buffer">The address of the buffer on which the data has been written (only useful for disposing the buffer later with <see cref="DisposeBuffer"/>).</param>
+	/// <param name="out_data">The address of the byte array where the data has been actually written. It starts with a <c>stext_buffer_header</c> describing where each array lives.</param>
+	/// <param name="out_length">The length in bytes of the data.</param>
+	/// <returns>An integer equivalent to <see cref="ExitCodes"/> detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int GetStructuredTextPageBuffer(fz_context* ctx, fz_stext_page* page, const fz_buffer** out_buffer, const unsigned char** out_data, uint64_t* out_length);
+
 	/// <summary>
 	/// Get a structured text representation of a display list, using the Tesseract OCR engine.
 	/// </summary>
@@ -388,7 +447,177 @@ extern "C"
 	DLL_PUBLIC int RenderSubDisplayList(fz_context* ctx, fz_display_list* list, float x0, float y0, float x1, float y1, float zoom, int colorFormat, unsigned char* pixel_storage, fz_cookie* cookie);
 
 	/// <summary>
-	/// Create a display list from a page.
+	/// A callback invoked when the preview pass of a progressive render has completed.
+	/// </summary>
+	/// <param name="width">The width in pixels of the preview image.</param>
+	/// <param name="height">The height in pixels of the preview image.</param>
+	/// <returns>0 to continue with the full quality pass, or 1 to skip it.</returns>
+	typedef int (*previewCallback)(int width, int height);
+
+	/// <summary>
+	/// Render (part of) a display list in two passes: a quick, low quality preview at reduced resolution, followed by the full quality image.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="list">The display list to render.</param>
+	/// <param name="x0">The left coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="y0">The top coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="x1">The right coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="y1">The bottom coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="zoom">How much the specified region should be scaled when rendering the full quality image.</param>
+	/// <param name="colorFormat">The pixel data format.</param>
+	/// <param name="preview_scale">The scale of the preview image relative to the full quality image (e.g. 0.25). The preview is sized as if it had been rendered with a zoom of <paramref name="zoom"/> * <paramref name="preview_scale"/>.</param>
+	/// <param name="preview_aa_level">The number of bits of antialiasing to use for the preview pass (0 to 8).</param>
+	/// <param name="preview_storage">A pointer indicating where the pixel bytes of the preview will be written. There must be enough space available!</param>
+	/// <param name="pixel_storage">A pointer indicating where the pixel bytes of the full quality image will be written. There must be enough space available!</param>
+	/// <param name="callback">A callback invoked once the preview is ready, before the full quality pass starts. Can be null.</param>
+	/// <param name="cookie">A pointer to a cookie object that can be used to track progress and/or abort rendering; the abort flag is also checked between the two passes. Can be null.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int RenderSubDisplayListProgressive(fz_context* ctx, fz_display_list* list, float x0, float y0, float x1, float y1, float zoom, int colorFormat, float preview_scale, int preview_aa_level, unsigned char* preview_storage, unsigned char* pixel_storage, previewCallback callback, fz_cookie* cookie);
+
+	/// <summary>
+	/// Render a set of tiles of a display list, each to its own array of bytes. Only the display list nodes that intersect a tile are run for that tile.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="list">The display list to render.</param>
+	/// <param name="zoom">How much the tiles should be scaled when rendering. This determines the size in pixels of each rendered tile.</param>
+	/// <param name="colorFormat">The pixel data format.</param>
+	/// <param name="tile_count">The number of tiles to render.</param>
+	/// <param name="tile_rects">The tiles to render, in page units, as <paramref name="tile_count"/> groups of four values (left, top, right, bottom).</param>
+	/// <param name="pixel_storage">An array of <paramref name="tile_count"/> pointers indicating where the pixel bytes of each tile will be written. There must be enough space available!</param>
+	/// <param name="cookie">A pointer to a cookie object that can be used to track progress and/or abort rendering. Can be null.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int RenderDisplayListTiles(fz_context* ctx, fz_display_list* list, float zoom, int colorFormat, int tile_count, const float* tile_rects, unsigned char** pixel_storage, fz_cookie* cookie);
+
+	/// <summary>
+	/// A callback invoked when a tile has been rendered.
+	/// </summary>
+	/// <param name="tile_index">The index of the tile that has been rendered.</param>
+	/// <param name="result">An integer detailing whether any errors occurred while rendering the tile.</param>
+	typedef void (*tileCallback)(int tile_index, int result);
+
+	/// <summary>
+	/// Render a set of tiles of a display list, each to its own array of bytes, spreading the tiles over a pool of threads with contexts cloned from <paramref name="ctx"/>. The method returns once every tile has been rendered.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources. It must have been created with locking support (see <see cref="CreateContext"/>).</param>
+	/// <param name="list">The display list to render.</param>
+	/// <param name="zoom">How much the tiles should be scaled when rendering. This determines the size in pixels of each rendered tile.</param>
+	/// <param name="colorFormat">The pixel data format.</param>
+	/// <param name="tile_count">The number of tiles to render.</param>
+	/// <param name="tile_rects">The tiles to render, in page units, as <paramref name="tile_count"/> groups of four values (left, top, right, bottom).</param>
+	/// <param name="pixel_storage">An array of <paramref name="tile_count"/> pointers indicating where the pixel bytes of each tile will be written. There must be enough space available!</param>
+	/// <param name="thread_count">The number of rendering threads to use. If this is 0 or less, one thread per processor is used. The calling thread waits for them, passing on an abort; if no thread can be started, it renders the tiles itself.</param>
+	/// <param name="callback">A callback invoked, from the rendering threads but never concurrently, as soon as each tile is complete. Can be null.</param>
+	/// <param name="cookie">A pointer to a cookie object whose abort flag stops the tiles being rendered and those not yet started. Can be null.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int RenderDisplayListTilesParallel(fz_context* ctx, fz_display_list* list, float zoom, int colorFormat, int tile_count, const float* tile_rects, unsigned char** pixel_storage, int thread_count, tileCallback callback, fz_cookie* cookie);
+
+	/// <summary>
+	/// Render (part of) a display list to an array of bytes starting at the specified pointer, splitting it into horizontal bands that are drawn in parallel, each straight into its own rows of the output. The method returns once the whole region has been rendered.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources. It must have been created with locking support (see <see cref="CreateContext"/>); otherwise the bands are drawn one after another.</param>
+	/// <param name="list">The display list to render.</param>
+	/// <param name="x0">The left coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="y0">The top coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="x1">The right coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="y1">The bottom coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="zoom">How much the specified region should be scaled when rendering. This determines the size in pixels of the rendered image.</param>
+	/// <param name="colorFormat">The pixel data format.</param>
+	/// <param name="pixel_storage">A pointer indicating where the pixel bytes will be written. There must be enough space available!</param>
+	/// <param name="thread_count">The number of threads to use (including the calling thread). If this is 0 or less, one thread per processor is used.</param>
+	/// <param name="cookie">A pointer to a cookie object whose abort flag is checked before each band is started. Can be null.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int RenderSubDisplayListBanded(fz_context* ctx, fz_display_list* list, float x0, float y0, float x1, float y1, float zoom, int colorFormat, unsigned char* pixel_storage, int thread_count, fz_cookie* cookie);
+
+	/// <summary>
+	/// Render (part of) a display list to an array of bytes starting at the specified pointer, drawing it one square tile at a time so that the intermediate buffers used for transparency groups and soft masks stay small. Use this for very large renderings. The method returns once the whole region has been rendered.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="list">The display list to render.</param>
+	/// <param name="x0">The left coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="y0">The top coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="x1">The right coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="y1">The bottom coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="zoom">How much the specified region should be scaled when rendering. This determines the size in pixels of the rendered image.</param>
+	/// <param name="colorFormat">The pixel data format.</param>
+	/// <param name="pixel_storage">A pointer indicating where the pixel bytes will be written. There must be enough space available!</param>
+	/// <param name="tile_size">The width and height of each tile in pixels. If this is 0 or less, 256 is used.</param>
+	/// <param name="cookie">A pointer to a cookie object that can be used to track progress and/or abort rendering. Can be null.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int RenderSubDisplayListTiled(fz_context* ctx, fz_display_list* list, float x0, float y0, float x1, float y1, float zoom, int colorFormat, unsigned char* pixel_storage, int tile_size, fz_cookie* cookie);
+
+	/// <summary>
+	/// Create a glyph atlas, which collects the glyphs of rendered text into alpha-only textures so that text can be drawn as quads on the GPU.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="page_size">The width and height in pixels of each atlas page.</param>
+	/// <param name="aa_level">The number of bits of antialiasing (0 to 8) to render glyphs with.</param>
+	/// <param name="out_atlas">The newly created atlas. It must be freed with <see cref="DisposeGlyphAtlas"/>.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int CreateGlyphAtlas(fz_context* ctx, int page_size, int aa_level, const fz_glyph_atlas** out_atlas);
+
+	/// <summary>
+	/// Free a glyph atlas.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="atlas">The atlas to free.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int DisposeGlyphAtlas(fz_context* ctx, fz_glyph_atlas* atlas);
+
+	/// <summary>
+	/// Render (part of) a display list with its filled text turned into glyph instances that refer to a glyph atlas, adding any new glyphs to the atlas. Everything else (including text that is clipped, in a transparency group, stroked or that cannot go in the atlas) is rendered into <paramref name="pixel_storage"/>, over which the instances should be drawn.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="list">The display list to render.</param>
+	/// <param name="x0">The left coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="y0">The top coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="x1">The right coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="y1">The bottom coordinate in page units of the region of the display list that should be rendererd.</param>
+	/// <param name="zoom">How much the specified region should be scaled when rendering. Glyphs are rasterised at this scale.</param>
+	/// <param name="colorFormat">The pixel data format.</param>
+	/// <param name="atlas">The glyph atlas to use.</param>
+	/// <param name="pixel_storage">A pointer indicating where the pixel bytes will be written. There must be enough space available! Can be null, in which case only the glyph instances are produced.</param>
+	/// <param name="out_instances">The glyph instances, with positions in pixels relative to the top left of the rendered region. They must be freed with <see cref="DisposeGlyphInstances"/>.</param>
+	/// <param name="out_instance_count">The number of glyph instances.</param>
+	/// <param name="cookie">A pointer to a cookie object that can be used to track progress and/or abort rendering. Can be null.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int RenderSubDisplayListWithGlyphAtlas(fz_context* ctx, fz_display_list* list, float x0, float y0, float x1, float y1, float zoom, int colorFormat, fz_glyph_atlas* atlas, unsigned char* pixel_storage, const fz_glyph_instance** out_instances, int* out_instance_count, fz_cookie* cookie);
+
+	/// <summary>
+	/// Free the glyph instances returned by <see cref="RenderSubDisplayListWithGlyphAtlas"/>.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="instances">The instances to free.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int DisposeGlyphInstances(fz_context* ctx, fz_glyph_instance* instances);
+
+	/// <summary>
+	/// Get the pixels of a glyph atlas page (one byte of coverage per pixel), and the area that has changed since the last call for that page, which is then marked as clean.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="atlas">The glyph atlas.</param>
+	/// <param name="page">The atlas page, from 0 to the page count returned by <see cref="GetGlyphAtlasSlots"/>.</param>
+	/// <param name="out_data">The pixel bytes of the page. They remain valid for the lifetime of the atlas.</param>
+	/// <param name="out_size">The width and height of the page in pixels.</param>
+	/// <param name="out_dirty_x0">The left coordinate of the changed area.</param>
+	/// <param name="out_dirty_y0">The top coordinate of the changed area.</param>
+	/// <param name="out_dirty_x1">The right coordinate of the changed area. This is not greater than <paramref name="out_dirty_x0"/> if nothing has changed.</param>
+	/// <param name="out_dirty_y1">The bottom coordinate of the changed area. This is not greater than <paramref name="out_dirty_y0"/> if nothing has changed.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int GetGlyphAtlasPage(fz_context* ctx, fz_glyph_atlas* atlas, int page, const unsigned char** out_data, int* out_size, int* out_dirty_x0, int* out_dirty_y0, int* out_dirty_x1, int* out_dirty_y1);
+
+	/// <summary>
+	/// Get the slot table of a glyph atlas, which glyph instances index into.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="atlas">The glyph atlas.</param>
+	/// <param name="out_slots">The slots (page, x, y, w, h, ox, oy as 32-bit integers). The pointer is only valid until the atlas is next rendered with.</param>
+	/// <param name="out_slot_count">The number of slots.</param>
+	/// <param name="out_page_count">The number of atlas pages.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int GetGlyphAtlasSlots(fz_context* ctx, fz_glyph_atlas* atlas, const fz_glyph_atlas_slot** out_slots, int* out_slot_count, int* out_page_count);
+
+	/// <summary>
+	/// Get the display list of a page. Lists are kept in the context's resource store and shared between callers asking for the same page, so they must not be modified (for instance by <c>CompactDisplayList</c>); they are compacted already.
 	/// </summary>
 	/// <param name="ctx">A pointer to the context used to create the document.</param>
 	/// <param name="page">A pointer to the page that should be used to create the display list.</param>
@@ -409,6 +638,60 @@ extern "C"
 	/// <returns>An integer detailing whether any errors occurred.</returns>
 	DLL_PUBLIC int DisposeDisplayList(fz_context* ctx, fz_display_list* list);
 
+	/// <summary>
+	/// Save a display list to a file, so that it can be loaded later (or on another machine) without the document it came from.
+	/// </summary>
+	/// <param name="ctx">The context that was used to create the display list.</param>
+	/// <param name="list">The display list to save.</param>
+	/// <param name="file_name">The path of the file to write.</param>
+	/// <returns>An integer detailing whether any errors occurred (<c>ERR_CANNOT_SAVE</c> if the list could not be written).</returns>
+	DLL_PUBLIC int SaveDisplayList(fz_context* ctx, fz_display_list* list, const char* file_name);
+
+	/// <summary>
+	/// Load a display list from a file written by <c>SaveDisplayList</c>.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="file_name">The path of the file to read.</param>
+	/// <param name="out_display_list">A pointer to the loaded display list.</param>
+	/// <param name="out_x0">The left coordinate of the display list's bounds.</param>
+	/// <param name="out_y0">The top coordinate of the display list's bounds.</param>
+	/// <param name="out_x1">The right coordinate of the display list's bounds.</param>
+	/// <param name="out_y1">The bottom coordinate of the display list's bounds.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int LoadDisplayList(fz_context* ctx, const char* file_name, fz_display_list** out_display_list, float* out_x0, float* out_y0, float* out_x1, float* out_y1);
+
+	/// <summary>
+	/// Load a display list from the contents of a file written by <c>SaveDisplayList</c>, such as a memory-mapped file or a downloaded asset.
+	/// </summary>
+	/// <param name="ctx">A context to hold the exception stack and the cached resources.</param>
+	/// <param name="data">The file contents. The display list does not refer to them once this returns.</param>
+	/// <param name="length">The length of the data in bytes.</param>
+	/// <param name="out_display_list">A pointer to the loaded display list.</param>
+	/// <param name="out_x0">The left coordinate of the display list's bounds.</param>
+	/// <param name="out_y0">The top coordinate of the display list's bounds.</param>
+	/// <param name="out_x1">The right coordinate of the display list's bounds.</param>
+	/// <param name="out_y1">The bottom coordinate of the display list's bounds.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int LoadDisplayListFromMemory(fz_context* ctx, const unsigned char* data, size_t length, fz_display_list** out_display_list, float* out_x0, float* out_y0, float* out_x1, float* out_y1);
+
+	/// <summary>
+	/// Repack a display list to use less memory, sharing the stroke states and text objects that repeat within it and storing a path only once when the next node draws the same path again (as a fill followed by a stroke of one shape does). Other repeated paths are not shared. The list must not be in use on another thread while this runs, so this is for lists from <c>LoadDisplayList</c> and <c>LoadDisplayListFromMemory</c>, not the shared ones from <c>GetDisplayList</c>.
+	/// </summary>
+	/// <param name="ctx">The context that was used to create the display list.</param>
+	/// <param name="list">The display list to compact.</param>
+	/// <param name="out_size">The number of bytes the display list uses afterwards, as returned by <c>GetDisplayListSize</c>.</param>
+	/// <returns>An integer detailing whether any errors occurred (<c>ERR_CANNOT_COMPACT_DISPLAY_LIST</c> if it could not be compacted, in which case the list is left as it was).</returns>
+	DLL_PUBLIC int CompactDisplayList(fz_context* ctx, fz_display_list* list, size_t* out_size);
+
+	/// <summary>
+	/// Get the number of bytes of memory used by a display list, for budgeting and eviction. Images, fonts and shadings shared with the document are not counted.
+	/// </summary>
+	/// <param name="ctx">The context that was used to create the display list.</param>
+	/// <param name="list">The display list.</param>
+	/// <param name="out_size">The number of bytes the display list uses.</param>
+	/// <returns>An integer detailing whether any errors occurred (<c>ERR_CANNOT_MEASURE_DISPLAY_LIST</c> if the size could not be worked out).</returns>
+	DLL_PUBLIC int GetDisplayListSize(fz_context* ctx, fz_display_list* list, size_t* out_size);
+
 	/// <summary>
 	/// Load a page from a document.
 	/// </summary>
@@ -468,6 +751,29 @@ extern "C"
 	/// <returns>An integer detailing whether any errors occurred.</returns>
 	DLL_PUBLIC int DisposeStream(fz_context* ctx, fz_stream* str);
 
+	/// <summary>
+	/// Start opening a document (from a file or from memory) on a background thread. The calling thread is not blocked while the document is parsed or repaired.
+	/// </summary>
+	/// <param name="ctx">The context to which the document will belong. It must have been created with locking support (see <see cref="CreateContext"/>).</param>
+	/// <param name="file_name">The path of the file to open. Ignored if <paramref name="data"/> is not null.</param>
+	/// <param name="data">A pointer to a byte array containing the data that makes up the document, or null to open <paramref name="file_name"/>. It must stay valid for as long as the document is in use.</param>
+	/// <param name="data_length">The length in bytes of the data that makes up the document.</param>
+	/// <param name="file_type">The type (extension) of the document. Can be null when opening a file, in which case the file name is used.</param>
+	/// <param name="progress">A progress object that is updated while the document is opened (bytes read, total size, number of objects once the cross-reference table is loaded) and whose abort flag is honoured on every read. It must stay valid until <see cref="FinishOpenDocumentAsync"/> returns.</param>
+	/// <param name="out_task">The task that is opening the document, to be passed to <see cref="FinishOpenDocumentAsync"/>.</param>
+	/// <returns>An integer detailing whether any errors occurred.</returns>
+	DLL_PUBLIC int OpenDocumentAsync(fz_context* ctx, const char* file_name, const unsigned char* data, const uint64_t data_length, const char* file_type, document_open_progress* progress, open_document_task** out_task);
+
+	/// <summary>
+	/// Wait for a document started with <see cref="OpenDocumentAsync"/> to open and free the task. Call this once the <c>done</c> field of the progress object is set to avoid blocking.
+	/// </summary>
+	/// <param name="ctx">The context that was used to start opening the document.</param>
+	/// <param name="task">The task returned by <see cref="OpenDocumentAsync"/>.</param>
+	/// <param name="out_doc">The newly opened document.</param>
+	/// <param name="out_page_count">The number of pages in the document.</param>
+	/// <returns>An integer detailing whether any errors occurred (<c>ERR_OPEN_ABORTED</c> if the open was cancelled).</returns>
+	DLL_PUBLIC int FinishOpenDocumentAsync(fz_context* ctx, open_document_task* task, const fz_document** out_doc, int* out_page_count);
+
 	/// <summary>
 	/// Free a document and its associated resources.
 	/// </summary>
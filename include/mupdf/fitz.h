@@ -57,6 +57,7 @@ extern "C" {
 #include "mupdf/fitz/color.h"
 #include "mupdf/fitz/pixmap.h"
 #include "mupdf/fitz/bitmap.h"
+#include "mupdf/fitz/pixmap-pipeline.h"
 #include "mupdf/fitz/image.h"
 #include "mupdf/fitz/shade.h"
 #include "mupdf/fitz/font.h"
@@ -71,6 +72,7 @@ extern "C" {
 
 #include "mupdf/fitz/transition.h"
 #include "mupdf/fitz/glyph-cache.h"
+#include "mupdf/fitz/glyph-atlas.h"
 
 /* Document */
 #include "mupdf/fitz/link.h"
@@ -30,6 +30,13 @@
 */
 /* #define FZ_ENABLE_SPOT_RENDERING 1 */
 
+/**
+	Enable the following to use SSE4.1 (x86) or NEON (arm64) versions
+	of the hottest painting and scaling loops, when the CPU supports
+	them. Defaults to enabled; define to 0 to force the plain C code.
+*/
+/* #define FZ_ENABLE_SIMD 1 */
+
 /**
 	Choose which plotters we need.
 	By default we build all the plotters in. To avoid building
@@ -133,6 +140,10 @@
 #define FZ_PLOTTERS_N 1
 #endif /* FZ_ENABLE_SPOT_RENDERING */
 
+#ifndef FZ_ENABLE_SIMD
+#define FZ_ENABLE_SIMD 1
+#endif /* FZ_ENABLE_SIMD */
+
 #ifndef FZ_PLOTTERS_G
 #define FZ_PLOTTERS_G 1
 #endif /* FZ_PLOTTERS_G */
@@ -33,6 +33,7 @@ typedef struct fz_style_context fz_style_context;
 typedef struct fz_tuning_context fz_tuning_context;
 typedef struct fz_store fz_store;
 typedef struct fz_glyph_cache fz_glyph_cache;
+typedef struct fz_weights_cache fz_weights_cache;
 typedef struct fz_document_handler_context fz_document_handler_context;
 typedef struct fz_output fz_output;
 typedef struct fz_context fz_context;
@@ -122,10 +123,27 @@ typedef struct
 	void (*unlock)(void *user, int lock);
 } fz_locks_context;
 
+/**
+	The glyph cache is split into this many shards, each with its
+	own lock (FZ_LOCK_GLYPHCACHE to FZ_LOCK_GLYPHCACHE_LAST), so
+	that threads rendering text rarely wait for one another on
+	cache hits. A miss on a FreeType font still renders the glyph
+	under FZ_LOCK_FREETYPE, which is shared by all fonts, so misses
+	are serialised as before; only Type 3 glyphs render unlocked.
+
+	This raised FZ_LOCK_MAX from 3 to 18. That is an ABI change:
+	code built against older headers hands over a fz_locks_context
+	whose lock functions only know about 3 mutexes, and will index
+	past the end of its array. Rebuild anything that supplies its
+	own locks (sizing its array with FZ_LOCK_MAX, never a literal).
+*/
+#define FZ_GLYPH_CACHE_SHARDS 16
+
 enum {
 	FZ_LOCK_ALLOC = 0,
 	FZ_LOCK_FREETYPE,
 	FZ_LOCK_GLYPHCACHE,
+	FZ_LOCK_GLYPHCACHE_LAST = FZ_LOCK_GLYPHCACHE + FZ_GLYPH_CACHE_SHARDS - 1,
 	FZ_LOCK_MAX
 };
 
@@ -650,6 +668,7 @@ struct fz_context
 	fz_colorspace_context *colorspace;
 	fz_store *store;
 	fz_glyph_cache *glyph_cache;
+	fz_weights_cache *weights_cache;
 };
 
 fz_context *fz_new_context_imp(const fz_alloc_context *alloc, const fz_locks_context *locks, size_t max_store, const char *version);
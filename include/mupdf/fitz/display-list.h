@@ -57,6 +57,27 @@ typedef struct fz_display_list fz_display_list;
 */
 fz_display_list *fz_new_display_list(fz_context *ctx, fz_rect mediabox);
 
+/**
+	Create an empty display list that can be played back while it
+	is still being recorded, so that a page can be drawn by one
+	thread as fast as another interprets it.
+
+	The list device recording it publishes the nodes it has
+	appended every so often, and all of them when it is closed (or
+	dropped). Running the list, or continuing a playback of it (see
+	fz_new_display_list_playback), uses only the nodes published so
+	far. The contexts of the recording and playing threads must
+	share their locks (see fz_clone_context).
+
+	Clip rectangles of published nodes are not tightened to fit what
+	is drawn inside them later, so culling is not quite as good as
+	for a list made by fz_new_display_list. Functions that change or
+	walk the whole list (fz_compact_display_list,
+	fz_write_display_list and the like) must not be used until
+	recording has finished.
+*/
+fz_display_list *fz_new_incremental_display_list(fz_context *ctx, fz_rect mediabox);
+
 /**
 	Create a rendering device for a display list.
 
@@ -96,6 +117,201 @@ fz_device *fz_new_list_device(fz_context *ctx, fz_display_list *list);
 */
 void fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix ctm, fz_rect scissor, fz_cookie *cookie);
 
+/**
+	As fz_run_display_list, but first look through the list for
+	opaque rectangles (solid fills of rectangular paths and opaque
+	images, not in a group, mask or non-rectangular clip) and skip
+	the objects, clips, masks and groups that one of them later paints
+	over completely.
+
+	Layered pages that paint a background and then paint over it again
+	are drawn much faster this way. The pixels produced are the same,
+	but the device sees fewer calls, so this is only for devices that
+	draw pixels, such as the draw device; do not use it for text
+	extraction, output to other formats, etc.
+
+	The look ahead is skipped if ctm rotates by other than a multiple
+	of 90 degrees.
+*/
+void fz_run_display_list_culled(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix ctm, fz_rect scissor, fz_cookie *cookie);
+
+/**
+	A playback of a display list through a device that can be
+	continued as the list grows; see
+	fz_new_incremental_display_list.
+*/
+typedef struct fz_display_list_playback fz_display_list_playback;
+
+/**
+	Start a playback of a display list through a device. Nothing is
+	run until fz_continue_display_list_playback is called. The
+	playback takes references to the list and device. ctm and
+	scissor are as for fz_run_display_list.
+*/
+fz_display_list_playback *fz_new_display_list_playback(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix ctm, fz_rect scissor);
+
+/**
+	Run the nodes of the list published since the playback was last
+	continued through its device, carrying on with the graphics state
+	where it left off.
+
+	Returns 1 once the list has finished recording and all of it has
+	been run; close the device then. Returns 0 if more is to come, in
+	which case call again later (after a short wait, or when there is
+	time to draw).
+
+	cookie: As for fz_run_display_list; progress counts nodes from
+	the start of the list, and progress_max is the number published
+	so far. If aborted, the playback stops and may be continued
+	later from where it stopped.
+*/
+int fz_continue_display_list_playback(fz_context *ctx, fz_display_list_playback *playback, fz_cookie *cookie);
+
+/**
+	Drop a playback, and its references to the list and device.
+*/
+void fz_drop_display_list_playback(fz_context *ctx, fz_display_list_playback *playback);
+
+/**
+	Build a spatial index over the nodes of a display list, so that running it with a scissor that covers only part of
+	the page (a tile, a band, a zoomed in view) can jump straight over
+	the runs of nodes outside the scissor instead of testing each one
+	in turn.
+
+	Only objects that fz_run_display_list would cull anyway are
+	skipped, so the result is identical with or without the index.
+
+	The list device indexes lists of more than a few thousand nodes
+	when it is closed, so this need only be called for lists built
+	some other way.
+
+	A list that already has an index keeps it: this does nothing, as
+	other threads may be running the list with it. So it is safe to
+	call while the list is being run, but an index built before the
+	list was complete is not brought up to date; the nodes added
+	after it are simply not indexed.
+*/
+void fz_index_display_list(fz_context *ctx, fz_display_list *list);
+
+/**
+	Compact a complete display list to use less memory.
+
+	The list is repacked with stroke states and text objects of
+	equal contents shared between the nodes that use them, paths
+	that repeat the one before them stored only once, and its node
+	array trimmed to fit.
+
+	This changes the list in place, so it must not be run or
+	otherwise used by another thread at the same time.
+*/
+void fz_compact_display_list(fz_context *ctx, fz_display_list *list);
+
+/**
+	Return the number of bytes of memory used by a display list:
+	its nodes and index, and the paths, text objects and stroke
+	states it holds (each counted once, however many nodes share
+	it).
+
+	Images, shadings, fonts and colorspaces are usually shared with
+	the document and the store, and are not counted.
+*/
+size_t fz_display_list_size(fz_context *ctx, fz_display_list *list);
+
+/**
+	A pool of threads supplied by the caller, for
+	fz_draw_display_list_banded. MuPDF has no threading of its own.
+
+	run: Call fn(arg, i) once for each i from 0 to count-1, spread
+	over as many threads as the pool likes (the calling thread may
+	take part), and return only once every call has returned.
+*/
+typedef struct
+{
+	void *user;
+	void (*run)(void *user, int count, void (*fn)(void *arg, int i), void *arg);
+} fz_band_pool;
+
+/**
+	Draw a display list into a pixmap, split into horizontal bands
+	that are drawn in parallel on a caller supplied thread pool.
+	Each band is drawn by a draw device straight into its own rows
+	of dest, so there is no per-band pixmap or copy.
+
+	ctx: Must have been created with locking functions; a context is
+	cloned from it for each band. If it cannot be cloned, the bands
+	are drawn one after another on the calling thread.
+
+	ctm: Transform from user space in points to the device space of
+	dest, as for fz_run_display_list with a draw device.
+
+	dest: The pixmap to draw into. It is not cleared first.
+
+	band_height: Height of each band in pixels, or 0 to choose one.
+
+	pool: The thread pool, or NULL to draw the bands one after
+	another on the calling thread.
+
+	cookie: May be NULL. Each band runs on a cookie of its own, and
+	an abort set here is forwarded into them, so bands not yet
+	started are skipped and running bands stop at their next node.
+	The errors of all bands are added up into it; progress is not
+	reported.
+
+	Throws if any band fails to draw.
+*/
+void fz_draw_display_list_banded(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_pixmap *dest, int band_height, const fz_band_pool *pool, fz_cookie *cookie);
+
+/**
+	Draw a display list into a pixmap one tile at a time.
+
+	Each tile is drawn by its own draw device into a view of dest,
+	with the tile as the scissor, so any group, mask and knockout
+	buffers the draw device needs are at most tile sized and stay in
+	cache, rather than being the size of the whole of dest. Tiles are
+	drawn in rows, top to bottom.
+
+	ctm: Transform from user space in points to the device space of
+	dest.
+
+	dest: The pixmap to draw into. It is not cleared first.
+
+	tile_w, tile_h: Tile size in pixels, or 0 for 256.
+
+	cookie: May be NULL. It is passed to the run of each tile in
+	turn, so abort is honoured at once, errors add up, and progress
+	describes the tile being drawn.
+*/
+void fz_draw_display_list_tiled(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_pixmap *dest, int tile_w, int tile_h, fz_cookie *cookie);
+
+/**
+	Callback for fz_draw_display_list_to_tiles, called with each
+	finished tile. The tile's x and y give its position in device
+	space. The pixmap is reused for the next tile, so take a copy of
+	anything needed later; do not keep or drop it.
+*/
+typedef void (fz_draw_tile_fn)(fz_context *ctx, void *arg, fz_pixmap *tile);
+
+/**
+	Draw the area of a display list one tile at a time into a single,
+	reused tile sized pixmap, handing each tile to a callback as it
+	is finished. Nothing the size of the whole area is ever
+	allocated, which makes it possible to render pages far too big to
+	hold in memory (e.g. to stream them out in bands of tiles).
+
+	area: The area to draw, in device space pixels.
+
+	colorspace, seps, alpha: The format of the tiles. Each tile is
+	cleared to transparent (if alpha) or white before it is drawn.
+
+	tile_w, tile_h: Tile size in pixels, or 0 for 256. The tiles in
+	the last column and row are cut down to fit the area.
+
+	fn, arg: Called with each tile, in rows from top to bottom.
+
+	cookie: As for fz_draw_display_list_tiled.
+*/
+void fz_draw_display_list_to_tiles(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_irect area, fz_colorspace *colorspace, fz_separations *seps, int alpha, int tile_w, int tile_h, fz_draw_tile_fn *fn, void *arg, fz_cookie *cookie);
+
 /**
 	Increment the reference count for a display list. Returns the
 	same pointer.
@@ -139,4 +355,42 @@ fz_image *fz_new_image_from_display_list(fz_context *ctx, float w, float h, fz_d
 */
 int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list);
 
+/**
+	Write a display list to an output stream in a compact binary
+	format that can be read back by fz_new_display_list_from_data
+	on any machine, without the document it came from.
+
+	Fonts, images, shadings and colorspaces used by the list are
+	written once each, however many times they are used. Images
+	are kept in their original compressed form where possible, and
+	otherwise written as deflated samples.
+
+	Throws if the list uses something that cannot be written, such
+	as a font without an embedded font file.
+*/
+void fz_write_display_list(fz_context *ctx, fz_output *out, fz_display_list *list);
+
+/**
+	Write a display list to a file, as for fz_write_display_list.
+*/
+void fz_save_display_list(fz_context *ctx, fz_display_list *list, const char *filename);
+
+/**
+	Read a display list written by fz_write_display_list.
+
+	data, len: The file contents. Nothing refers to the data once
+	this returns, so it may be a memory mapped file that is
+	unmapped straight after.
+
+	Throws if the data is not a display list file of a version that
+	this library understands, or is truncated or corrupt.
+*/
+fz_display_list *fz_new_display_list_from_data(fz_context *ctx, const unsigned char *data, size_t len);
+
+/**
+	Read a display list from a file written by
+	fz_save_display_list.
+*/
+fz_display_list *fz_load_display_list(fz_context *ctx, const char *filename);
+
 #endif
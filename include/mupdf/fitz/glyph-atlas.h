@@ -0,0 +1,158 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+#ifndef MUPDF_FITZ_GLYPH_ATLAS_H
+#define MUPDF_FITZ_GLYPH_ATLAS_H
+
+#include "mupdf/fitz/context.h"
+#include "mupdf/fitz/geometry.h"
+#include "mupdf/fitz/pixmap.h"
+#include "mupdf/fitz/device.h"
+
+/**
+	A glyph atlas packs rendered glyphs into a set of square, alpha
+	only pixmaps ("atlas pages") so that text can be drawn as
+	textured quads, e.g. on a GPU, rather than blitted into a
+	pixmap.
+
+	Glyphs are rendered once (through the glyph cache) and stay in
+	the atlas for its lifetime. Pages are only ever added to, so a
+	client can upload just the region that has changed since it last
+	looked (see fz_glyph_atlas_take_dirty).
+
+	An atlas is not thread safe; use it from one thread at a time.
+*/
+typedef struct fz_glyph_atlas fz_glyph_atlas;
+
+/**
+	Where a glyph lives in the atlas.
+
+	page: The atlas page.
+
+	x, y, w, h: The glyph's rectangle within that page, in pixels.
+
+	ox, oy: The offset from the glyph's origin pixel to the top left
+	corner of its rectangle.
+*/
+typedef struct
+{
+	int page;
+	int x, y, w, h;
+	int ox, oy;
+} fz_glyph_atlas_slot;
+
+/**
+	One glyph drawn on a page.
+
+	slot: Index of the glyph in the atlas' slot table.
+
+	x, y: Position of the top left corner of the slot's rectangle
+	in device space (i.e. after the device's transform). The quad
+	covers (x, y) to (x + slot.w, y + slot.h); to draw at a
+	different zoom, scale these by the ratio of the zooms.
+
+	color: sRGB color and alpha of the glyph, not premultiplied.
+*/
+typedef struct
+{
+	int slot;
+	float x, y;
+	unsigned char color[4];
+} fz_glyph_instance;
+
+/**
+	A growable list of glyph instances, filled in by a glyph atlas
+	device. Initialise to all zeroes; free the contents with
+	fz_clear_glyph_instance_list.
+*/
+typedef struct
+{
+	int len, cap;
+	fz_glyph_instance *instance;
+} fz_glyph_instance_list;
+
+/**
+	Create a new, empty glyph atlas.
+
+	page_size: Width and height of each atlas page in pixels.
+
+	aa: The number of bits of antialiasing to render glyphs with
+	(0 to 8).
+*/
+fz_glyph_atlas *fz_new_glyph_atlas(fz_context *ctx, int page_size, int aa);
+
+fz_glyph_atlas *fz_keep_glyph_atlas(fz_context *ctx, fz_glyph_atlas *atlas);
+void fz_drop_glyph_atlas(fz_context *ctx, fz_glyph_atlas *atlas);
+
+/**
+	Return the number of pages in the atlas.
+*/
+int fz_glyph_atlas_page_count(fz_context *ctx, fz_glyph_atlas *atlas);
+
+/**
+	Return an atlas page (an alpha only pixmap). The atlas keeps
+	ownership; the pixmap stays valid for the life of the atlas.
+*/
+fz_pixmap *fz_glyph_atlas_page(fz_context *ctx, fz_glyph_atlas *atlas, int page);
+
+/**
+	Return the area of a page that has changed since the last call
+	for that page (empty if none), and mark it as clean.
+*/
+fz_irect fz_glyph_atlas_take_dirty(fz_context *ctx, fz_glyph_atlas *atlas, int page);
+
+/**
+	Return the atlas' slot table. The pointer is only valid until
+	glyphs are next added to the atlas.
+*/
+const fz_glyph_atlas_slot *fz_glyph_atlas_slots(fz_context *ctx, fz_glyph_atlas *atlas, int *count);
+
+/**
+	Free the instances held in a glyph instance list, and reset it
+	to empty.
+*/
+void fz_clear_glyph_instance_list(fz_context *ctx, fz_glyph_instance_list *list);
+
+/**
+	Create a device that adds the glyphs of filled text to an atlas
+	and appends a glyph instance for each one to a list.
+
+	atlas: The atlas to use.
+
+	ctm: Transform applied after the one the device is run with
+	(as for fz_new_draw_device) to give the space that glyphs are
+	rendered and positioned in. The passthrough device sees the
+	untransformed calls.
+
+	out: The list to append glyph instances to.
+
+	passthrough: Optional device that receives everything that is
+	not turned into glyph instances: all other drawing, and any
+	text that is clipped, inside a mask, group or tile, stroked, or
+	cannot go in the atlas (coloured or very large glyphs). Drawing
+	this with a draw device and then overlaying the glyph instances
+	reproduces the page, except that atlas text always ends up on top
+	of other content.
+*/
+fz_device *fz_new_glyph_atlas_device(fz_context *ctx, fz_glyph_atlas *atlas, fz_matrix ctm, fz_glyph_instance_list *out, fz_device *passthrough);
+
+#endif
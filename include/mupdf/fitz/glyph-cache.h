@@ -34,6 +34,39 @@
 */
 void fz_purge_glyph_cache(fz_context *ctx);
 
+/**
+	Set the number of bytes of rendered glyphs the cache may hold
+	(1 megabyte by default). The budget is split evenly between the
+	shards; glyphs beyond the new budget are evicted at once.
+*/
+void fz_set_glyph_cache_budget(fz_context *ctx, size_t budget);
+
+/**
+	Glyph cache statistics, summed over all shards.
+
+	budget, total: the byte budget, and the bytes currently held.
+
+	hits, misses: lookups that found a cached glyph, and those that
+	had to render one.
+
+	evictions, evicted: glyphs dropped to stay within the budget,
+	and their size in bytes.
+*/
+typedef struct
+{
+	size_t budget;
+	size_t total;
+	int64_t hits;
+	int64_t misses;
+	int64_t evictions;
+	size_t evicted;
+} fz_glyph_cache_stats;
+
+/**
+	Read the glyph cache statistics.
+*/
+void fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats);
+
 /**
 	Create a pixmap containing a rendered glyph.
 
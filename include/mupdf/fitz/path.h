@@ -184,6 +184,22 @@ int fz_packed_path_size(const fz_path *path);
 */
 size_t fz_pack_path(fz_context *ctx, uint8_t *pack, size_t max, const fz_path *path);
 
+/**
+	Compare the commands and coordinates of two paths, however
+	they are packed.
+
+	Returns non-zero if they describe the same path.
+*/
+int fz_path_equal(fz_context *ctx, const fz_path *a, const fz_path *b);
+
+/**
+	Return the number of bytes of memory a path has allocated for
+	itself: for an unpacked path its header and data, for an
+	'open' packed path its data. 'Flat' packed paths live entirely
+	in the block they are packed into, and return 0.
+*/
+size_t fz_path_heap_size(fz_context *ctx, const fz_path *path);
+
 /**
 	Clone the data for a path.
 
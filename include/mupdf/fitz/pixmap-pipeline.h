@@ -0,0 +1,131 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+#ifndef MUPDF_FITZ_PIXMAP_PIPELINE_H
+#define MUPDF_FITZ_PIXMAP_PIPELINE_H
+
+#include "mupdf/fitz/context.h"
+#include "mupdf/fitz/color.h"
+#include "mupdf/fitz/pixmap.h"
+#include "mupdf/fitz/bitmap.h"
+
+/**
+	A pixmap pipeline is a list of operations to apply to a rendered
+	pixmap, such as inverting, gamma correction, tinting, colorspace
+	conversion and halftoning.
+
+	Doing these one after another with fz_invert_pixmap,
+	fz_gamma_pixmap, fz_convert_pixmap, etc. reads and writes the
+	whole pixmap once per operation. A pipeline instead runs every
+	operation over one row before moving on to the next, so each row
+	is fetched from memory once and stays in cache throughout.
+
+	Build a pipeline once with fz_new_pixmap_pipeline and the
+	fz_pipeline_* functions (the operations are applied in the order
+	they are added), then run it over as many pixmaps or bands as
+	needed with fz_run_pixmap_pipeline.
+*/
+typedef struct fz_pixmap_pipeline fz_pixmap_pipeline;
+
+/**
+	Create a new, empty, pixmap pipeline.
+*/
+fz_pixmap_pipeline *fz_new_pixmap_pipeline(fz_context *ctx);
+
+/**
+	Free a pixmap pipeline, and the references it holds.
+*/
+void fz_drop_pixmap_pipeline(fz_context *ctx, fz_pixmap_pipeline *pipe);
+
+/**
+	Add an inversion, as fz_invert_pixmap.
+*/
+void fz_pipeline_invert(fz_context *ctx, fz_pixmap_pipeline *pipe);
+
+/**
+	Add gamma correction, as fz_gamma_pixmap.
+*/
+void fz_pipeline_gamma(fz_context *ctx, fz_pixmap_pipeline *pipe, float gamma);
+
+/**
+	Add a tint, as fz_tint_pixmap. The data must be RGB, BGR or
+	Gray at this point.
+*/
+void fz_pipeline_tint(fz_context *ctx, fz_pixmap_pipeline *pipe, int black, int white);
+
+/**
+	Add a swap of the first and third components of each pixel, to
+	turn RGB data into BGR order or vice versa (e.g. for handing to
+	an API that wants the other order). Only the bytes are swapped;
+	the colorspace of the result is unchanged.
+*/
+void fz_pipeline_swap_rb(fz_context *ctx, fz_pixmap_pipeline *pipe);
+
+/**
+	Add premultiplication of the color components by alpha, as
+	fz_premultiply_pixmap. Does nothing for data without alpha.
+*/
+void fz_pipeline_premultiply(fz_context *ctx, fz_pixmap_pipeline *pipe);
+
+/**
+	Add division of the color components by alpha, to turn the
+	(premultiplied) data into straight alpha. Does nothing for data
+	without alpha.
+*/
+void fz_pipeline_unpremultiply(fz_context *ctx, fz_pixmap_pipeline *pipe);
+
+/**
+	Add a colorspace conversion, as fz_convert_pixmap. The result of
+	running the pipeline is then a new pixmap in the colorspace ds.
+*/
+void fz_pipeline_convert(fz_context *ctx, fz_pixmap_pipeline *pipe, fz_colorspace *ds, fz_colorspace *prf, fz_default_colorspaces *default_cs, fz_color_params color_params, int keep_alpha);
+
+/**
+	Add halftoning, as fz_new_bitmap_from_pixmap_band, into a bitmap
+	returned by fz_run_pixmap_pipeline. The data must be Gray or CMYK
+	without alpha at this point. Operations added after this one
+	still apply to the contone pixmap. A pipeline can halftone only
+	once.
+
+	ht: The halftone to use. NULL implies the default halftone.
+*/
+void fz_pipeline_halftone(fz_context *ctx, fz_pixmap_pipeline *pipe, fz_halftone *ht);
+
+/**
+	Run a pipeline over a pixmap (or band of one).
+
+	pix: The pixmap to process. Operations before the first
+	conversion change it in place.
+
+	band_start: The offset of this band within the page, for the
+	phase of any halftone, as for fz_new_bitmap_from_pixmap_band.
+
+	bit: If the pipeline halftones, *bit is set to the new bitmap.
+	May be NULL otherwise.
+
+	Returns a reference to the final pixmap: a new one if the
+	pipeline converts colorspace, otherwise pix itself. Either way,
+	the caller must drop it.
+*/
+fz_pixmap *fz_run_pixmap_pipeline(fz_context *ctx, fz_pixmap_pipeline *pipe, fz_pixmap *pix, int band_start, fz_bitmap **bit);
+
+#endif
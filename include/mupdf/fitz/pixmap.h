@@ -471,4 +471,42 @@ fz_pixmap *fz_new_pixmap_from_alpha_channel(fz_context *ctx, fz_pixmap *src);
  */
 fz_pixmap *fz_new_pixmap_from_color_and_mask(fz_context *ctx, fz_pixmap *color, fz_pixmap *mask);
 
+/**
+	Set the number of bytes of image scaling weights tables the
+	context may keep for reuse (4 megabytes by default). The tables
+	depend only on the source and destination sizes and offsets, so
+	images of the same size drawn at the same size (e.g. thumbnails
+	of repeated images on many pages) share them. Tables beyond the
+	new budget are evicted at once, and a table bigger than the whole
+	budget is never kept; 0 disables the cache.
+*/
+void fz_set_weights_cache_budget(fz_context *ctx, size_t budget);
+
+/**
+	Scaling weights cache statistics.
+
+	budget, total, entries: the byte budget, and the bytes and number
+	of tables currently held.
+
+	hits, misses: lookups that found a table, and those that had to
+	calculate one. (Repeated scales by a single draw device are
+	served before reaching the cache, and are not counted.)
+
+	evictions: tables dropped to stay within the budget.
+*/
+typedef struct
+{
+	size_t budget;
+	size_t total;
+	int entries;
+	int64_t hits;
+	int64_t misses;
+	int64_t evictions;
+} fz_weights_cache_stats;
+
+/**
+	Read the scaling weights cache statistics.
+*/
+void fz_get_weights_cache_stats(fz_context *ctx, fz_weights_cache_stats *stats);
+
 #endif
@@ -374,6 +374,13 @@ int fz_store_scavenge_external(fz_context *ctx, size_t size, int *phase);
 */
 int fz_shrink_store(fz_context *ctx, unsigned int percent);
 
+/**
+	Report the number of bytes currently held in the store, and
+	the maximum the store is allowed to grow to (FZ_STORE_UNLIMITED
+	if there is no limit). Either pointer may be NULL.
+*/
+void fz_store_usage(fz_context *ctx, size_t *size, size_t *max);
+
 /**
 	Callback function called by fz_filter_store on every item within
 	the store.
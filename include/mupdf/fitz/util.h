@@ -49,6 +49,64 @@ fz_display_list *fz_new_display_list_from_page_number(fz_context *ctx, fz_docume
 */
 fz_display_list *fz_new_display_list_from_page_contents(fz_context *ctx, fz_page *page);
 
+/**
+	Get the display list of a page, from the store if it holds one,
+	otherwise by running the page into a new list which is then
+	compacted and put in the store.
+
+	Stored lists are shared with every other caller asking for the
+	same list (including from cloned contexts), and evicted under
+	the store's memory budget like images and fonts, their size
+	being taken as fz_display_list_size.
+
+	annotations: Non-zero for a list of the whole page, as from
+	fz_new_display_list_from_page; zero for the page contents alone,
+	as from fz_new_display_list_from_page_contents.
+
+	layers: Identifies the layer (optional content) configuration
+	the list is drawn with, as part of its key. Callers that change
+	which layers are enabled must either pass a different value for
+	each combination they use, or call
+	fz_purge_stored_display_lists after the change. Pass 0 if the
+	layers are never changed.
+
+	Lists of pages that are still loading progressively are not
+	stored. Stored lists may be in use by other callers, so must not
+	be changed (for instance by fz_compact_display_list).
+
+	Returns a new reference to the list.
+*/
+fz_display_list *fz_get_display_list(fz_context *ctx, fz_page *page, int annotations, int layers);
+
+/**
+	Find a page's display list in the store, as put there by
+	fz_get_display_list or fz_store_display_list.
+
+	Returns a new reference to the list, or NULL if there is none.
+*/
+fz_display_list *fz_find_display_list(fz_context *ctx, fz_page *page, int annotations, int layers);
+
+/**
+	Put the display list of a page in the store, for callers that
+	build their lists themselves (for instance while holding a lock
+	on the document).
+
+	The reference to list is taken over. If an equal list was stored
+	by another thread in the meantime, list is dropped and that one
+	returned instead; if the list cannot be stored, it is returned
+	as is.
+*/
+fz_display_list *fz_store_display_list(fz_context *ctx, fz_display_list *list, fz_page *page, int annotations, int layers);
+
+/**
+	Remove all the stored display lists of a document from the
+	store. This is done when the document is dropped or laid out
+	again, or when the annotations or forms of a PDF page change;
+	callers need only do it when they change something else about
+	how pages are drawn, such as the enabled layers.
+*/
+void fz_purge_stored_display_lists(fz_context *ctx, fz_document *doc);
+
 /**
 	Render the page to a pixmap using the transform and colorspace.
 
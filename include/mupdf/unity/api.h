@@ -1,14 +1,26 @@
 #ifndef _Included_unity_api_header
 #define _Included_unity_api_header
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Page output formats. */
+enum
+{
+	PAGE_FORMAT_PNG = 0, /* PNG encoded data */
+	PAGE_FORMAT_RGBA = 1, /* raw premultiplied RGBA, 4 bytes per pixel */
+	PAGE_FORMAT_BGRA = 2 /* raw premultiplied BGRA, 4 bytes per pixel */
+};
+
 typedef struct {
 	unsigned char* data;
 	int len;
-	int width;
-	int height;
+	int width; /* in pixels */
+	int height; /* in pixels */
+	int stride; /* bytes per row of raw data, 0 for PNG */
+	int format; /* one of PAGE_FORMAT_* */
 } Page;
 
 typedef struct
@@ -19,6 +31,141 @@ typedef struct
 
 int DrawPdfPages(char *filename, int resolution, int num_workers, int band_height, PageList *pagelist);
 
+/*
+	As DrawPdfPages, but render every page straight into a raw
+	PAGE_FORMAT_RGBA or PAGE_FORMAT_BGRA buffer sized from the real
+	page bounds, ready for Texture2D.LoadRawTextureData. No image
+	encoding or extra copies are involved.
+*/
+int DrawPdfPagesRaw(char *filename, int resolution, int page_format, PageList *pagelist);
+
+/*
+	Memory pressure callback, called between pages with the number of
+	bytes held in the resource store and the store's budget. With
+	page_workers it is called from the worker threads, but never by
+	two at once.
+
+	Return the percentage of the current store size to shrink the store
+	down to (0 empties it), or 100 (or more) to leave it untouched.
+*/
+typedef int (StorePressureFn)(void *opaque, size_t store_size, size_t store_max);
+
+typedef struct
+{
+	int resolution; /* in dpi */
+	int num_workers; /* threads for banded rendering, 0 for none */
+	int band_height; /* 0 to render each page in one band */
+	int page_format; /* one of PAGE_FORMAT_* */
+	size_t store_size; /* resource store budget in bytes, 0 for the default */
+	StorePressureFn *store_pressure; /* may be NULL */
+	void *store_pressure_opaque;
+	int page_workers; /* threads rendering whole pages in parallel, 0 for none */
+} DrawOptions;
+
+/*
+	Fill in opts with the defaults: 72dpi, no threads or banding, PNG
+	output, and a 256MB resource store with no pressure callback.
+*/
+void DefaultDrawOptions(DrawOptions *opts);
+
+/*
+	As DrawPdfPages, with every setting taken from opts.
+
+	Fonts, decoded images, colour links and shadings are kept in the
+	resource store for the whole document, so resources shared between
+	pages are only decoded once. Use store_size and store_pressure to
+	bound the memory this takes.
+
+	With page_workers set, that many threads each take the next page
+	in the range, build its display list and rasterise it into its
+	slot in pagelist. Band rendering (num_workers, band_height) is not
+	used in that mode. The store pressure callback may then be called
+	from the worker threads.
+*/
+int DrawPdfPagesWithOptions(char *filename, const DrawOptions *opts, PageList *pagelist);
+
+/*
+	Called as soon as each page has been rendered, with the page index
+	(0 based) and its data, dimensions and stride. The data is released
+	as soon as the callback returns, so copy or upload it before then.
+
+	Calls are never concurrent, but with page workers they are made
+	from the worker threads.
+
+	Return 0 to carry on, non-zero to stop rendering further pages.
+*/
+typedef int (PageReadyFn)(void *opaque, int page_index, const Page *page);
+
+/*
+	Streaming variant of DrawPdfPagesWithOptions. Rather than collecting
+	every page into a PageList, each page is handed to ready as soon as
+	it is finished and then freed, so the first page arrives early and
+	at most one page per worker is held in memory.
+
+	order lists the page indices (0 based) to render, most important
+	first; pass NULL to render every page in document order.
+*/
+int StreamPdfPages(char *filename, const DrawOptions *opts, const int *order, int order_count, PageReadyFn *ready, void *opaque);
+
+/*
+	Re-entrant, handle based rendering.
+
+	A PdfSession owns its own context, locks and document, so any
+	number of sessions may be open at once, and one session may be
+	asked to render different pages from several threads at the
+	same time. Nothing is shared through globals.
+*/
+typedef struct PdfSession PdfSession;
+
+typedef struct
+{
+	float resolution; /* in dpi; 72 renders at 1:1 */
+	float rotation; /* clockwise, in degrees */
+	int alpha; /* non-zero to render with a transparent background */
+	int annotations; /* non-zero to include annotations and widgets */
+	int aa_level; /* bits of antialiasing, 0 to 8 */
+	int format; /* one of PAGE_FORMAT_* */
+} RenderOptions;
+
+/*
+	Fill in opts with the defaults: 72dpi, no rotation, opaque,
+	annotations on, full antialiasing and PNG output.
+*/
+void DefaultRenderOptions(RenderOptions *opts);
+
+/*
+	Open a document for rendering. password may be NULL.
+
+	Returns NULL on failure.
+*/
+PdfSession *OpenPdfSession(const char *filename, const char *password);
+
+int CountPdfSessionPages(PdfSession *session);
+
+/*
+	Render page number pagenum (0 based) into result, in the format
+	given by opts->format. opts may be NULL for the defaults. Safe to
+	call concurrently on the same session.
+
+	For raw formats, the caller may pass its own buffer in result->data
+	and result->len, and the page is rendered straight into it. If it
+	is too small, nothing is rendered, result->len is set to the size
+	needed and -1 is returned; result->data is left as it was.
+	Otherwise (and always for PNG) result->data must be NULL on entry
+	and is allocated with malloc; release it with DropPageData.
+
+	Returns 0 on success, -1 on failure.
+*/
+int RenderPdfSessionPage(PdfSession *session, int pagenum, const RenderOptions *opts, Page *result);
+
+void DropPageData(Page *page);
+
+/*
+	Close the document and release everything the session owns.
+	No renders may be in progress.
+*/
+void ClosePdfSession(PdfSession *session);
+
 #ifdef __cplusplus
 }
 #endif
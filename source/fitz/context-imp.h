@@ -66,6 +66,10 @@ void fz_new_glyph_cache_context(fz_context *ctx);
 fz_glyph_cache *fz_keep_glyph_cache(fz_context *ctx);
 void fz_drop_glyph_cache_context(fz_context *ctx);
 
+void fz_new_weights_cache_context(fz_context *ctx);
+fz_weights_cache *fz_keep_weights_cache(fz_context *ctx);
+void fz_drop_weights_cache_context(fz_context *ctx);
+
 void fz_new_document_handler_context(fz_context *ctx);
 void fz_drop_document_handler_context(fz_context *ctx);
 fz_document_handler_context *fz_keep_document_handler_context(fz_context *ctx);
@@ -357,6 +357,7 @@ fz_drop_document(fz_context *ctx, fz_document *doc)
 	{
 		if (doc->open)
 			fz_warn(ctx, "There are still open pages in the document!");
+		fz_purge_stored_display_lists(ctx, doc);
 		if (doc->drop_document)
 			doc->drop_document(ctx, doc);
 		fz_free(ctx, doc);
@@ -475,6 +476,7 @@ fz_layout_document(fz_context *ctx, fz_document *doc, float w, float h, float em
 	{
 		doc->layout(ctx, doc, w, h, em);
 		doc->did_layout = 1;
+		fz_purge_stored_display_lists(ctx, doc);
 	}
 }
 
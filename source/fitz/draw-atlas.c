@@ -0,0 +1,721 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+#include "mupdf/fitz.h"
+#include "draw-imp.h"
+#include "glyph-imp.h"
+
+#include <string.h>
+#include <math.h>
+
+#define MAX_ATLAS_GLYPH_SIZE 256
+#define ATLAS_HASH_LEN 1021
+
+/* Gap left around each glyph, so that sampling with filtering does
+ * not pick up the neighbours. */
+#define ATLAS_PAD 1
+
+enum
+{
+	ATLAS_GLYPH = 0,
+	ATLAS_EMPTY = -1, /* nothing to draw, e.g. a space */
+	ATLAS_FALLBACK = -2 /* must be drawn some other way */
+};
+
+typedef struct
+{
+	fz_font *font;
+	int a, b;
+	int c, d;
+	unsigned short gid;
+	unsigned char e, f;
+} fz_atlas_key;
+
+typedef struct
+{
+	fz_atlas_key key;
+	int kind;
+	int next;
+} fz_atlas_entry;
+
+typedef struct
+{
+	fz_pixmap *pix;
+	int shelf_y, shelf_h, cursor_x;
+	fz_irect dirty;
+} fz_atlas_page;
+
+/*
+	Slots are allocated in order and never freed; entry[i] holds the
+	key and hash chain for slot[i]. Glyphs that are empty or that
+	cannot go in the atlas get a slot too (with page -1), so we only
+	try to render them once; instances never refer to these.
+*/
+struct fz_glyph_atlas
+{
+	int refs;
+	int page_size;
+	int aa;
+	int page_count, page_cap;
+	fz_atlas_page *page;
+	int slot_count, slot_cap;
+	fz_glyph_atlas_slot *slot;
+	fz_atlas_entry *entry;
+	int bucket[ATLAS_HASH_LEN];
+};
+
+fz_glyph_atlas *
+fz_new_glyph_atlas(fz_context *ctx, int page_size, int aa)
+{
+	fz_glyph_atlas *atlas;
+	int i;
+
+	if (page_size < 2 * ATLAS_PAD + 1)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "glyph atlas page size too small");
+
+	atlas = fz_malloc_struct(ctx, fz_glyph_atlas);
+	atlas->refs = 1;
+	atlas->page_size = page_size;
+	atlas->aa = fz_clampi(aa, 0, 8);
+	for (i = 0; i < ATLAS_HASH_LEN; i++)
+		atlas->bucket[i] = -1;
+
+	return atlas;
+}
+
+fz_glyph_atlas *
+fz_keep_glyph_atlas(fz_context *ctx, fz_glyph_atlas *atlas)
+{
+	return fz_keep_imp(ctx, atlas, &atlas->refs);
+}
+
+void
+fz_drop_glyph_atlas(fz_context *ctx, fz_glyph_atlas *atlas)
+{
+	int i;
+
+	if (!fz_drop_imp(ctx, atlas, &atlas->refs))
+		return;
+
+	for (i = 0; i < atlas->page_count; i++)
+		fz_drop_pixmap(ctx, atlas->page[i].pix);
+	for (i = 0; i < atlas->slot_count; i++)
+		fz_drop_font(ctx, atlas->entry[i].key.font);
+	fz_free(ctx, atlas->page);
+	fz_free(ctx, atlas->slot);
+	fz_free(ctx, atlas->entry);
+	fz_free(ctx, atlas);
+}
+
+int
+fz_glyph_atlas_page_count(fz_context *ctx, fz_glyph_atlas *atlas)
+{
+	return atlas->page_count;
+}
+
+fz_pixmap *
+fz_glyph_atlas_page(fz_context *ctx, fz_glyph_atlas *atlas, int page)
+{
+	if (page < 0 || page >= atlas->page_count)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "glyph atlas page out of range");
+	return atlas->page[page].pix;
+}
+
+fz_irect
+fz_glyph_atlas_take_dirty(fz_context *ctx, fz_glyph_atlas *atlas, int page)
+{
+	fz_irect dirty;
+
+	if (page < 0 || page >= atlas->page_count)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "glyph atlas page out of range");
+	dirty = atlas->page[page].dirty;
+	atlas->page[page].dirty = fz_empty_irect;
+	return dirty;
+}
+
+const fz_glyph_atlas_slot *
+fz_glyph_atlas_slots(fz_context *ctx, fz_glyph_atlas *atlas, int *count)
+{
+	*count = atlas->slot_count;
+	return atlas->slot;
+}
+
+static unsigned
+atlas_hash(const fz_atlas_key *key)
+{
+	const unsigned char *s = (const unsigned char *)key;
+	unsigned val = 0;
+	size_t i;
+	for (i = 0; i < sizeof(*key); i++)
+	{
+		val += s[i];
+		val += (val << 10);
+		val ^= (val >> 6);
+	}
+	val += (val << 3);
+	val ^= (val >> 11);
+	val += (val << 15);
+	return val % ATLAS_HASH_LEN;
+}
+
+/* Find room for a w by h glyph, adding a page if need be. */
+static fz_atlas_page *
+atlas_place(fz_context *ctx, fz_glyph_atlas *atlas, int w, int h, int *x, int *y)
+{
+	int size = atlas->page_size;
+	fz_atlas_page *page = NULL;
+
+	if (atlas->page_count > 0)
+	{
+		page = &atlas->page[atlas->page_count - 1];
+		if (page->cursor_x + w + ATLAS_PAD > size)
+		{
+			/* Start a new shelf. */
+			page->shelf_y += page->shelf_h;
+			page->shelf_h = 0;
+			page->cursor_x = ATLAS_PAD;
+		}
+		if (page->shelf_y + h + ATLAS_PAD > size)
+			page = NULL;
+	}
+
+	if (page == NULL)
+	{
+		fz_pixmap *pix;
+
+		if (atlas->page_count == atlas->page_cap)
+		{
+			int new_cap = atlas->page_cap ? atlas->page_cap * 2 : 4;
+			atlas->page = fz_realloc_array(ctx, atlas->page, new_cap, fz_atlas_page);
+			atlas->page_cap = new_cap;
+		}
+		pix = fz_new_pixmap(ctx, NULL, size, size, NULL, 1);
+		fz_clear_pixmap(ctx, pix);
+		page = &atlas->page[atlas->page_count++];
+		page->pix = pix;
+		page->shelf_y = ATLAS_PAD;
+		page->shelf_h = 0;
+		page->cursor_x = ATLAS_PAD;
+		page->dirty = fz_empty_irect;
+	}
+
+	*x = page->cursor_x;
+	*y = page->shelf_y;
+	page->cursor_x += w + ATLAS_PAD;
+	if (page->shelf_h < h + ATLAS_PAD)
+		page->shelf_h = h + ATLAS_PAD;
+
+	return page;
+}
+
+/* Copy the glyph's coverage into its (cleared) rectangle of the page. */
+static void
+atlas_blit(fz_atlas_page *page, fz_glyph *glyph, int x, int y)
+{
+	fz_pixmap *dst = page->pix;
+	unsigned char *dp = dst->samples + y * (size_t)dst->stride + x;
+	fz_irect r;
+
+	if (glyph->pixmap)
+	{
+		const unsigned char *sp = glyph->pixmap->samples;
+		int h = glyph->h;
+		while (h--)
+		{
+			memcpy(dp, sp, glyph->w);
+			dp += dst->stride;
+			sp += glyph->pixmap->stride;
+		}
+	}
+	else
+		fz_paint_glyph(NULL, dst, dp, glyph, glyph->w, glyph->h, 0, 0, NULL);
+
+	r = page->dirty;
+	if (fz_is_empty_irect(r))
+	{
+		r.x0 = x;
+		r.y0 = y;
+		r.x1 = x + glyph->w;
+		r.y1 = y + glyph->h;
+	}
+	else
+	{
+		r.x0 = fz_mini(r.x0, x);
+		r.y0 = fz_mini(r.y0, y);
+		r.x1 = fz_maxi(r.x1, x + glyph->w);
+		r.y1 = fz_maxi(r.y1, y + glyph->h);
+	}
+	page->dirty = r;
+}
+
+static int
+atlas_add_slot(fz_context *ctx, fz_glyph_atlas *atlas, const fz_atlas_key *key, unsigned hash, int kind)
+{
+	int i;
+
+	if (atlas->slot_count == atlas->slot_cap)
+	{
+		int new_cap = atlas->slot_cap ? atlas->slot_cap * 2 : 256;
+		atlas->slot = fz_realloc_array(ctx, atlas->slot, new_cap, fz_glyph_atlas_slot);
+		atlas->entry = fz_realloc_array(ctx, atlas->entry, new_cap, fz_atlas_entry);
+		atlas->slot_cap = new_cap;
+	}
+
+	i = atlas->slot_count++;
+	memset(&atlas->slot[i], 0, sizeof(atlas->slot[i]));
+	atlas->slot[i].page = -1;
+	atlas->entry[i].key = *key;
+	atlas->entry[i].key.font = fz_keep_font(ctx, key->font);
+	atlas->entry[i].kind = kind;
+	atlas->entry[i].next = atlas->bucket[hash];
+	atlas->bucket[hash] = i;
+
+	return i;
+}
+
+/*
+	Look up (adding it if need be) the atlas slot for a glyph drawn
+	with the device space transform trm. Returns the slot, or
+	ATLAS_EMPTY or ATLAS_FALLBACK. For a slot, *x and *y are set to
+	the device space position of its top left corner.
+*/
+static int
+atlas_lookup_glyph(fz_context *ctx, fz_glyph_atlas *atlas, fz_font *font, int gid, fz_matrix trm, float *x, float *y)
+{
+	fz_atlas_key key;
+	fz_matrix adj, subpix_ctm;
+	fz_glyph *glyph;
+	fz_atlas_page *page;
+	unsigned hash;
+	float size;
+	int i, kind, px, py;
+
+	memset(&key, 0, sizeof key);
+	adj = trm;
+	size = fz_subpixel_adjust(ctx, &adj, &subpix_ctm, &key.e, &key.f);
+	if (size > MAX_ATLAS_GLYPH_SIZE)
+		return ATLAS_FALLBACK;
+
+	key.font = font;
+	key.gid = gid;
+	key.a = subpix_ctm.a * 65536;
+	key.b = subpix_ctm.b * 65536;
+	key.c = subpix_ctm.c * 65536;
+	key.d = subpix_ctm.d * 65536;
+	hash = atlas_hash(&key);
+
+	for (i = atlas->bucket[hash]; i >= 0; i = atlas->entry[i].next)
+		if (memcmp(&atlas->entry[i].key, &key, sizeof key) == 0)
+			break;
+
+	if (i < 0)
+	{
+		/* fz_render_glyph does its own subpixel adjustment of the
+		 * unadjusted transform, which comes out the same as ours. */
+		glyph = fz_render_glyph(ctx, font, gid, &trm, NULL, &fz_infinite_irect, 1, atlas->aa);
+		if (glyph == NULL)
+			return ATLAS_FALLBACK;
+
+		fz_try(ctx)
+		{
+			if (glyph->pixmap && glyph->pixmap->n != 1)
+				kind = ATLAS_FALLBACK;
+			else if (glyph->w <= 0 || glyph->h <= 0)
+				kind = ATLAS_EMPTY;
+			else if (glyph->w + 2 * ATLAS_PAD > atlas->page_size || glyph->h + 2 * ATLAS_PAD > atlas->page_size)
+				kind = ATLAS_FALLBACK;
+			else
+				kind = ATLAS_GLYPH;
+
+			/* Place the glyph before making its slot, so that a
+			 * failure cannot leave a slot without a page. */
+			if (kind == ATLAS_GLYPH)
+			{
+				page = atlas_place(ctx, atlas, glyph->w, glyph->h, &px, &py);
+				atlas_blit(page, glyph, px, py);
+			}
+			i = atlas_add_slot(ctx, atlas, &key, hash, kind);
+			if (kind == ATLAS_GLYPH)
+			{
+				atlas->slot[i].page = page - atlas->page;
+				atlas->slot[i].x = px;
+				atlas->slot[i].y = py;
+				atlas->slot[i].w = glyph->w;
+				atlas->slot[i].h = glyph->h;
+				atlas->slot[i].ox = glyph->x;
+				atlas->slot[i].oy = glyph->y;
+			}
+		}
+		fz_always(ctx)
+			fz_drop_glyph(ctx, glyph);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+
+	if (atlas->entry[i].kind != ATLAS_GLYPH)
+		return atlas->entry[i].kind;
+
+	*x = floorf(adj.e) + atlas->slot[i].ox;
+	*y = floorf(adj.f) + atlas->slot[i].oy;
+	return i;
+}
+
+void
+fz_clear_glyph_instance_list(fz_context *ctx, fz_glyph_instance_list *list)
+{
+	fz_free(ctx, list->instance);
+	list->instance = NULL;
+	list->len = 0;
+	list->cap = 0;
+}
+
+static void
+append_instance(fz_context *ctx, fz_glyph_instance_list *list, int slot, float x, float y, const unsigned char *color)
+{
+	fz_glyph_instance *inst;
+
+	if (list->len == list->cap)
+	{
+		int new_cap = list->cap ? list->cap * 2 : 1024;
+		list->instance = fz_realloc_array(ctx, list->instance, new_cap, fz_glyph_instance);
+		list->cap = new_cap;
+	}
+	inst = &list->instance[list->len++];
+	inst->slot = slot;
+	inst->x = x;
+	inst->y = y;
+	memcpy(inst->color, color, 4);
+}
+
+typedef struct
+{
+	fz_device super;
+	fz_glyph_atlas *atlas;
+	fz_matrix transform;
+	fz_glyph_instance_list *out;
+	fz_device *passthrough;
+	int nested; /* depth of clips, masks, groups and tiles */
+} fz_atlas_device;
+
+static void
+fz_atlas_fill_text(fz_context *ctx, fz_device *dev_, const fz_text *text, fz_matrix in_ctm,
+	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	fz_matrix ctm = fz_concat(in_ctm, dev->transform);
+	fz_text *leftover = NULL;
+	fz_text_span *span;
+	unsigned char rgba[4];
+	float rgb[3];
+	int i, slot;
+
+	/* Text we cannot represent faithfully as quads goes to the
+	 * passthrough device as it is. */
+	if (dev->nested > 0 || colorspace == NULL)
+	{
+		if (dev->passthrough)
+			fz_fill_text(ctx, dev->passthrough, text, in_ctm, colorspace, color, alpha, color_params);
+		return;
+	}
+	if (alpha == 0)
+		return;
+
+	fz_convert_color(ctx, colorspace, color, fz_device_rgb(ctx), rgb, NULL, color_params);
+	rgba[0] = fz_clampi(rgb[0] * 255 + 0.5f, 0, 255);
+	rgba[1] = fz_clampi(rgb[1] * 255 + 0.5f, 0, 255);
+	rgba[2] = fz_clampi(rgb[2] * 255 + 0.5f, 0, 255);
+	rgba[3] = fz_clampi(alpha * 255 + 0.5f, 0, 255);
+
+	fz_var(leftover);
+
+	fz_try(ctx)
+	{
+		for (span = text->head; span; span = span->next)
+		{
+			fz_matrix tm = span->trm;
+
+			for (i = 0; i < span->len; i++)
+			{
+				float x, y;
+				int gid = span->items[i].gid;
+				if (gid < 0)
+					continue;
+
+				tm.e = span->items[i].x;
+				tm.f = span->items[i].y;
+				slot = atlas_lookup_glyph(ctx, dev->atlas, span->font, gid, fz_concat(tm, ctm), &x, &y);
+				if (slot >= 0)
+					append_instance(ctx, dev->out, slot, x, y, rgba);
+				else if (slot == ATLAS_FALLBACK && dev->passthrough)
+				{
+					if (leftover == NULL)
+						leftover = fz_new_text(ctx);
+					fz_show_glyph(ctx, leftover, span->font, tm, gid, span->items[i].ucs,
+						span->wmode, span->bidi_level, span->markup_dir, span->language);
+				}
+			}
+		}
+		if (leftover)
+			fz_fill_text(ctx, dev->passthrough, leftover, in_ctm, colorspace, color, alpha, color_params);
+	}
+	fz_always(ctx)
+		fz_drop_text(ctx, leftover);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+fz_atlas_fill_path(fz_context *ctx, fz_device *dev_, const fz_path *path, int even_odd, fz_matrix ctm,
+	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	if (dev->passthrough)
+		fz_fill_path(ctx, dev->passthrough, path, even_odd, ctm, colorspace, color, alpha, color_params);
+}
+
+static void
+fz_atlas_stroke_path(fz_context *ctx, fz_device *dev_, const fz_path *path, const fz_stroke_state *stroke,
+	fz_matrix ctm, fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	if (dev->passthrough)
+		fz_stroke_path(ctx, dev->passthrough, path, stroke, ctm, colorspace, color, alpha, color_params);
+}
+
+static void
+fz_atlas_clip_path(fz_context *ctx, fz_device *dev_, const fz_path *path, int even_odd, fz_matrix ctm, fz_rect scissor)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	dev->nested++;
+	if (dev->passthrough)
+		fz_clip_path(ctx, dev->passthrough, path, even_odd, ctm, scissor);
+}
+
+static void
+fz_atlas_clip_stroke_path(fz_context *ctx, fz_device *dev_, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, fz_rect scissor)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	dev->nested++;
+	if (dev->passthrough)
+		fz_clip_stroke_path(ctx, dev->passthrough, path, stroke, ctm, scissor);
+}
+
+static void
+fz_atlas_stroke_text(fz_context *ctx, fz_device *dev_, const fz_text *text, const fz_stroke_state *stroke,
+	fz_matrix ctm, fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	if (dev->passthrough)
+		fz_stroke_text(ctx, dev->passthrough, text, stroke, ctm, colorspace, color, alpha, color_params);
+}
+
+static void
+fz_atlas_clip_text(fz_context *ctx, fz_device *dev_, const fz_text *text, fz_matrix ctm, fz_rect scissor)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	dev->nested++;
+	if (dev->passthrough)
+		fz_clip_text(ctx, dev->passthrough, text, ctm, scissor);
+}
+
+static void
+fz_atlas_clip_stroke_text(fz_context *ctx, fz_device *dev_, const fz_text *text, const fz_stroke_state *stroke, fz_matrix ctm, fz_rect scissor)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	dev->nested++;
+	if (dev->passthrough)
+		fz_clip_stroke_text(ctx, dev->passthrough, text, stroke, ctm, scissor);
+}
+
+static void
+fz_atlas_ignore_text(fz_context *ctx, fz_device *dev_, const fz_text *text, fz_matrix ctm)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	if (dev->passthrough)
+		fz_ignore_text(ctx, dev->passthrough, text, ctm);
+}
+
+static void
+fz_atlas_fill_shade(fz_context *ctx, fz_device *dev_, fz_shade *shade, fz_matrix ctm, float alpha, fz_color_params color_params)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	if (dev->passthrough)
+		fz_fill_shade(ctx, dev->passthrough, shade, ctm, alpha, color_params);
+}
+
+static void
+fz_atlas_fill_image(fz_context *ctx, fz_device *dev_, fz_image *image, fz_matrix ctm, float alpha, fz_color_params color_params)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	if (dev->passthrough)
+		fz_fill_image(ctx, dev->passthrough, image, ctm, alpha, color_params);
+}
+
+static void
+fz_atlas_fill_image_mask(fz_context *ctx, fz_device *dev_, fz_image *image, fz_matrix ctm,
+	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	if (dev->passthrough)
+		fz_fill_image_mask(ctx, dev->passthrough, image, ctm, colorspace, color, alpha, color_params);
+}
+
+static void
+fz_atlas_clip_image_mask(fz_context *ctx, fz_device *dev_, fz_image *image, fz_matrix ctm, fz_rect scissor)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	dev->nested++;
+	if (dev->passthrough)
+		fz_clip_image_mask(ctx, dev->passthrough, image, ctm, scissor);
+}
+
+static void
+fz_atlas_pop_clip(fz_context *ctx, fz_device *dev_)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	dev->nested--;
+	if (dev->passthrough)
+		fz_pop_clip(ctx, dev->passthrough);
+}
+
+static void
+fz_atlas_begin_mask(fz_context *ctx, fz_device *dev_, fz_rect area, int luminosity, fz_colorspace *colorspace, const float *bc, fz_color_params color_params)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	/* Ended by the pop_clip after the masked content. */
+	dev->nested++;
+	if (dev->passthrough)
+		fz_begin_mask(ctx, dev->passthrough, area, luminosity, colorspace, bc, color_params);
+}
+
+static void
+fz_atlas_end_mask(fz_context *ctx, fz_device *dev_)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	if (dev->passthrough)
+		fz_end_mask(ctx, dev->passthrough);
+}
+
+static void
+fz_atlas_begin_group(fz_context *ctx, fz_device *dev_, fz_rect area, fz_colorspace *cs, int isolated, int knockout, int blendmode, float alpha)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	dev->nested++;
+	if (dev->passthrough)
+		fz_begin_group(ctx, dev->passthrough, area, cs, isolated, knockout, blendmode, alpha);
+}
+
+static void
+fz_atlas_end_group(fz_context *ctx, fz_device *dev_)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	dev->nested--;
+	if (dev->passthrough)
+		fz_end_group(ctx, dev->passthrough);
+}
+
+static int
+fz_atlas_begin_tile(fz_context *ctx, fz_device *dev_, fz_rect area, fz_rect view, float xstep, float ystep, fz_matrix ctm, int id)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	dev->nested++;
+	if (dev->passthrough)
+		return fz_begin_tile_id(ctx, dev->passthrough, area, view, xstep, ystep, ctm, id);
+	else
+		return 0;
+}
+
+static void
+fz_atlas_end_tile(fz_context *ctx, fz_device *dev_)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	dev->nested--;
+	if (dev->passthrough)
+		fz_end_tile(ctx, dev->passthrough);
+}
+
+static void
+fz_atlas_render_flags(fz_context *ctx, fz_device *dev_, int set, int clear)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	if (dev->passthrough)
+		fz_render_flags(ctx, dev->passthrough, set, clear);
+}
+
+static void
+fz_atlas_set_default_colorspaces(fz_context *ctx, fz_device *dev_, fz_default_colorspaces *default_cs)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	if (dev->passthrough)
+		fz_set_default_colorspaces(ctx, dev->passthrough, default_cs);
+}
+
+static void
+fz_atlas_drop_device(fz_context *ctx, fz_device *dev_)
+{
+	fz_atlas_device *dev = (fz_atlas_device*)dev_;
+	fz_drop_glyph_atlas(ctx, dev->atlas);
+}
+
+fz_device *
+fz_new_glyph_atlas_device(fz_context *ctx, fz_glyph_atlas *atlas, fz_matrix ctm, fz_glyph_instance_list *out, fz_device *passthrough)
+{
+	fz_atlas_device *dev = fz_new_derived_device(ctx, fz_atlas_device);
+
+	dev->super.drop_device = fz_atlas_drop_device;
+
+	dev->super.fill_path = fz_atlas_fill_path;
+	dev->super.stroke_path = fz_atlas_stroke_path;
+	dev->super.clip_path = fz_atlas_clip_path;
+	dev->super.clip_stroke_path = fz_atlas_clip_stroke_path;
+
+	dev->super.fill_text = fz_atlas_fill_text;
+	dev->super.stroke_text = fz_atlas_stroke_text;
+	dev->super.clip_text = fz_atlas_clip_text;
+	dev->super.clip_stroke_text = fz_atlas_clip_stroke_text;
+	dev->super.ignore_text = fz_atlas_ignore_text;
+
+	dev->super.fill_shade = fz_atlas_fill_shade;
+	dev->super.fill_image = fz_atlas_fill_image;
+	dev->super.fill_image_mask = fz_atlas_fill_image_mask;
+	dev->super.clip_image_mask = fz_atlas_clip_image_mask;
+
+	dev->super.pop_clip = fz_atlas_pop_clip;
+
+	dev->super.begin_mask = fz_atlas_begin_mask;
+	dev->super.end_mask = fz_atlas_end_mask;
+	dev->super.begin_group = fz_atlas_begin_group;
+	dev->super.end_group = fz_atlas_end_group;
+
+	dev->super.begin_tile = fz_atlas_begin_tile;
+	dev->super.end_tile = fz_atlas_end_tile;
+
+	dev->super.render_flags = fz_atlas_render_flags;
+	dev->super.set_default_colorspaces = fz_atlas_set_default_colorspaces;
+
+	dev->atlas = fz_keep_glyph_atlas(ctx, atlas);
+	dev->transform = ctm;
+	dev->out = out;
+	dev->passthrough = passthrough;
+
+	return (fz_device*)dev;
+}
@@ -3317,3 +3317,253 @@ fz_new_draw_device_with_options(fz_context *ctx, const fz_draw_options *opts, fz
 	}
 	return dev;
 }
+
+/* Banded drawing of a display list on a caller supplied thread pool. */
+
+#define MIN_BAND_HEIGHT 32
+#define DEFAULT_BAND_COUNT 16
+
+typedef struct
+{
+	fz_context *ctx;
+	fz_irect area;
+	int failed;
+	int errors;
+} fz_draw_band;
+
+typedef struct
+{
+	fz_display_list *list;
+	fz_matrix ctm;
+	fz_pixmap *dest;
+	fz_cookie *cookie;
+	fz_draw_band *band;
+} fz_draw_band_job;
+
+static void
+draw_band(void *arg, int i)
+{
+	fz_draw_band_job *job = arg;
+	fz_draw_band *band = &job->band[i];
+	fz_context *ctx = band->ctx;
+	fz_pixmap *pix = NULL;
+	fz_device *dev = NULL;
+	fz_cookie cookie = { 0 };
+
+	if (job->cookie && job->cookie->abort)
+		return;
+
+	fz_var(pix);
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		/* A full width view of the band's rows of dest. */
+		pix = fz_new_pixmap_from_pixmap(ctx, job->dest, &band->area);
+		dev = fz_new_draw_device(ctx, fz_identity, pix);
+		fz_run_display_list_band(ctx, job->list, dev, job->ctm, fz_rect_from_irect(band->area), &cookie, job->cookie);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, pix);
+	}
+	fz_catch(ctx)
+	{
+		fz_warn(ctx, "cannot draw band %d", i);
+		band->failed = 1;
+	}
+
+	band->errors = cookie.errors;
+}
+
+static void
+draw_bands_in_turn(void *user, int count, void (*fn)(void *arg, int i), void *arg)
+{
+	int i;
+	for (i = 0; i < count; i++)
+		fn(arg, i);
+}
+
+void
+fz_draw_display_list_banded(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_pixmap *dest, int band_height, const fz_band_pool *pool, fz_cookie *cookie)
+{
+	static const fz_band_pool in_turn = { NULL, draw_bands_in_turn };
+	fz_draw_band_job job;
+	fz_draw_band *band;
+	int i, count, failed = 0, cloned = 0;
+
+	if (dest->w <= 0 || dest->h <= 0)
+		return;
+
+	if (band_height <= 0)
+		band_height = fz_maxi(MIN_BAND_HEIGHT, (dest->h + DEFAULT_BAND_COUNT - 1) / DEFAULT_BAND_COUNT);
+	count = (dest->h + band_height - 1) / band_height;
+
+	band = fz_malloc_array(ctx, count, fz_draw_band);
+	for (i = 0; i < count; i++)
+	{
+		band[i].area.x0 = dest->x;
+		band[i].area.x1 = dest->x + dest->w;
+		band[i].area.y0 = dest->y + i * band_height;
+		band[i].area.y1 = fz_mini(dest->y + dest->h, band[i].area.y0 + band_height);
+		band[i].failed = 0;
+		band[i].errors = 0;
+		band[i].ctx = ctx;
+	}
+
+	/* Each band needs a context of its own to run on another thread. */
+	if (pool && count > 1)
+	{
+		for (cloned = 0; cloned < count; cloned++)
+		{
+			band[cloned].ctx = fz_clone_context(ctx);
+			if (band[cloned].ctx == NULL)
+				break;
+		}
+		if (cloned < count)
+		{
+			while (cloned > 0)
+				fz_drop_context(band[--cloned].ctx);
+			for (i = 0; i < count; i++)
+				band[i].ctx = ctx;
+			pool = NULL;
+		}
+	}
+	else
+		pool = NULL;
+
+	job.list = list;
+	job.ctm = ctm;
+	job.dest = dest;
+	job.cookie = cookie;
+	job.band = band;
+
+	if (pool == NULL)
+		pool = &in_turn;
+	pool->run(pool->user, count, draw_band, &job);
+
+	for (i = 0; i < count; i++)
+	{
+		failed |= band[i].failed;
+		if (cookie)
+			cookie->errors += band[i].errors;
+		if (i < cloned)
+			fz_drop_context(band[i].ctx);
+	}
+	fz_free(ctx, band);
+
+	if (failed)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot draw display list bands");
+}
+
+/* Tiled drawing of a display list. */
+
+#define DEFAULT_TILE_SIZE 256
+
+static void
+draw_tile(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_pixmap *tile, fz_cookie *cookie)
+{
+	fz_device *dev = fz_new_draw_device(ctx, fz_identity, tile);
+	fz_try(ctx)
+	{
+		fz_run_display_list(ctx, list, dev, ctm, fz_rect_from_irect(fz_pixmap_bbox(ctx, tile)), cookie);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+void
+fz_draw_display_list_tiled(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_pixmap *dest, int tile_w, int tile_h, fz_cookie *cookie)
+{
+	fz_pixmap *tile = NULL;
+	fz_irect r;
+	int x, y;
+
+	if (tile_w <= 0)
+		tile_w = DEFAULT_TILE_SIZE;
+	if (tile_h <= 0)
+		tile_h = DEFAULT_TILE_SIZE;
+
+	fz_var(tile);
+
+	fz_try(ctx)
+	{
+		for (y = dest->y; y < dest->y + dest->h; y += tile_h)
+		{
+			for (x = dest->x; x < dest->x + dest->w; x += tile_w)
+			{
+				if (cookie && cookie->abort)
+					break;
+				r.x0 = x;
+				r.y0 = y;
+				r.x1 = fz_mini(x + tile_w, dest->x + dest->w);
+				r.y1 = fz_mini(y + tile_h, dest->y + dest->h);
+				tile = fz_new_pixmap_from_pixmap(ctx, dest, &r);
+				draw_tile(ctx, list, ctm, tile, cookie);
+				fz_drop_pixmap(ctx, tile);
+				tile = NULL;
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, tile);
+		fz_rethrow(ctx);
+	}
+}
+
+void
+fz_draw_display_list_to_tiles(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_irect area, fz_colorspace *colorspace, fz_separations *seps, int alpha, int tile_w, int tile_h, fz_draw_tile_fn *fn, void *arg, fz_cookie *cookie)
+{
+	fz_pixmap *buffer, *tile = NULL;
+	fz_irect r;
+	int x, y;
+
+	if (fz_is_empty_irect(area))
+		return;
+	if (tile_w <= 0)
+		tile_w = DEFAULT_TILE_SIZE;
+	if (tile_h <= 0)
+		tile_h = DEFAULT_TILE_SIZE;
+
+	/* One full size tile; the cut down ones at the edges are views of it. */
+	buffer = fz_new_pixmap(ctx, colorspace, fz_mini(tile_w, area.x1 - area.x0), fz_mini(tile_h, area.y1 - area.y0), seps, alpha);
+
+	fz_var(tile);
+
+	fz_try(ctx)
+	{
+		for (y = area.y0; y < area.y1; y += tile_h)
+		{
+			for (x = area.x0; x < area.x1; x += tile_w)
+			{
+				if (cookie && cookie->abort)
+					break;
+				r.x0 = 0;
+				r.y0 = 0;
+				r.x1 = fz_mini(tile_w, area.x1 - x);
+				r.y1 = fz_mini(tile_h, area.y1 - y);
+				tile = fz_new_pixmap_from_pixmap(ctx, buffer, &r);
+				tile->x = x;
+				tile->y = y;
+				fz_clear_pixmap(ctx, tile);
+				draw_tile(ctx, list, ctm, tile, cookie);
+				fn(ctx, arg, tile);
+				fz_drop_pixmap(ctx, tile);
+				tile = NULL;
+			}
+		}
+	}
+	fz_always(ctx)
+		fz_drop_pixmap(ctx, buffer);
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, tile);
+		fz_rethrow(ctx);
+	}
+}
@@ -31,7 +31,8 @@
 #define MAX_GLYPH_SIZE 256
 #define MAX_CACHE_SIZE (1024*1024)
 
-#define GLYPH_HASH_LEN 509
+/* Buckets per shard. */
+#define GLYPH_HASH_LEN 127
 
 typedef struct
 {
@@ -46,7 +47,7 @@ typedef struct
 typedef struct fz_glyph_cache_entry
 {
 	fz_glyph_key key;
-	unsigned hash;
+	unsigned hash; /* bucket within the shard */
 	struct fz_glyph_cache_entry *lru_prev;
 	struct fz_glyph_cache_entry *lru_next;
 	struct fz_glyph_cache_entry *bucket_next;
@@ -54,17 +55,33 @@ typedef struct fz_glyph_cache_entry
 	fz_glyph *val;
 } fz_glyph_cache_entry;
 
-struct fz_glyph_cache
+/*
+	The cache is split into FZ_GLYPH_CACHE_SHARDS shards by key hash.
+	Each shard has its own buckets, LRU list, share of the byte
+	budget and counters, and is protected by its own lock
+	(FZ_LOCK_GLYPHCACHE + shard number), so threads rendering text
+	only contend when they want glyphs from the same shard. No code
+	ever holds two shard locks at once.
+
+	refs is protected by the first shard's lock.
+*/
+typedef struct
 {
-	int refs;
 	size_t total;
-#ifndef NDEBUG
-	int num_evictions;
-	ptrdiff_t evicted;
-#endif
+	size_t budget;
+	int64_t hits;
+	int64_t misses;
+	int64_t evictions;
+	size_t evicted;
 	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
+} fz_glyph_cache_shard;
+
+struct fz_glyph_cache
+{
+	int refs;
+	fz_glyph_cache_shard shard[FZ_GLYPH_CACHE_SHARDS];
 };
 
 static size_t
@@ -79,78 +96,135 @@ void
 fz_new_glyph_cache_context(fz_context *ctx)
 {
 	fz_glyph_cache *cache;
+	int i;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
-	cache->total = 0;
 	cache->refs = 1;
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+		cache->shard[i].budget = MAX_CACHE_SIZE / FZ_GLYPH_CACHE_SHARDS;
 
 	ctx->glyph_cache = cache;
 }
 
 static void
-drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
+drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_shard *shard, fz_glyph_cache_entry *entry)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		shard->lru_tail = entry->lru_prev;
 	if (entry->lru_prev)
 		entry->lru_prev->lru_next = entry->lru_next;
 	else
-		cache->lru_head = entry->lru_next;
-	cache->total -= fz_glyph_size(ctx, entry->val);
+		shard->lru_head = entry->lru_next;
+	shard->total -= fz_glyph_size(ctx, entry->val);
 	if (entry->bucket_next)
 		entry->bucket_next->bucket_prev = entry->bucket_prev;
 	if (entry->bucket_prev)
 		entry->bucket_prev->bucket_next = entry->bucket_next;
 	else
-		cache->entry[entry->hash] = entry->bucket_next;
+		shard->entry[entry->hash] = entry->bucket_next;
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
 }
 
-/* The glyph cache lock is always held when this function is called. */
+/* The shard's lock is always held when this function is called. */
 static void
-do_purge(fz_context *ctx)
+evict_to_budget(fz_context *ctx, fz_glyph_cache_shard *shard, fz_glyph_cache_entry *keep)
+{
+	while (shard->total > shard->budget && shard->lru_tail && shard->lru_tail != keep)
+	{
+		shard->evictions++;
+		shard->evicted += fz_glyph_size(ctx, shard->lru_tail->val);
+		drop_glyph_cache_entry(ctx, shard, shard->lru_tail);
+	}
+}
+
+/* The shard's lock is always held when this function is called. */
+static void
+do_purge(fz_context *ctx, fz_glyph_cache_shard *shard)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
 	int i;
 
 	for (i = 0; i < GLYPH_HASH_LEN; i++)
 	{
-		while (cache->entry[i])
-			drop_glyph_cache_entry(ctx, cache->entry[i]);
+		while (shard->entry[i])
+			drop_glyph_cache_entry(ctx, shard, shard->entry[i]);
 	}
 
-	cache->total = 0;
+	shard->total = 0;
 }
 
 void
 fz_purge_glyph_cache(fz_context *ctx)
 {
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	do_purge(ctx);
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	int i;
+
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		do_purge(ctx, &ctx->glyph_cache->shard[i]);
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
 }
 
 void
 fz_drop_glyph_cache_context(fz_context *ctx)
 {
+	int i, refs;
+
 	if (!ctx || !ctx->glyph_cache)
 		return;
 
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	ctx->glyph_cache->refs--;
-	if (ctx->glyph_cache->refs == 0)
+	refs = --ctx->glyph_cache->refs;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+
+	/* The last reference has gone, so no one else can be using the
+	 * shards; purge them without their locks. */
+	if (refs == 0)
 	{
-		do_purge(ctx);
+		for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+			do_purge(ctx, &ctx->glyph_cache->shard[i]);
 		fz_free(ctx, ctx->glyph_cache);
-		ctx->glyph_cache = NULL;
 	}
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	ctx->glyph_cache = NULL;
+}
+
+void
+fz_set_glyph_cache_budget(fz_context *ctx, size_t budget)
+{
+	int i;
+
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_glyph_cache_shard *shard = &ctx->glyph_cache->shard[i];
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		shard->budget = budget / FZ_GLYPH_CACHE_SHARDS;
+		evict_to_budget(ctx, shard, NULL);
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
+}
+
+void
+fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_glyph_cache_shard *shard = &ctx->glyph_cache->shard[i];
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		stats->budget += shard->budget;
+		stats->total += shard->total;
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->evictions += shard->evictions;
+		stats->evicted += shard->evicted;
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
 }
 
 fz_glyph_cache *
@@ -256,7 +330,7 @@ static unsigned do_hash(unsigned char *s, int len)
 }
 
 static inline void
-move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
+move_to_front(fz_glyph_cache_shard *cache, fz_glyph_cache_entry *entry)
 {
 	if (entry->lru_prev == NULL)
 		return; /* At front already */
@@ -278,7 +352,7 @@ move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
 fz_glyph *
 fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colorspace *model, const fz_irect *scissor, int alpha, int aa)
 {
-	fz_glyph_cache *cache;
+	fz_glyph_cache_shard *cache;
 	fz_glyph_key key;
 	fz_matrix subpix_ctm;
 	fz_irect subpix_scissor;
@@ -287,6 +361,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	int do_cache, locked, caching;
 	fz_glyph_cache_entry *entry;
 	unsigned hash;
+	int lock;
 	int is_ft_font = !!fz_font_ft_face(ctx, font);
 
 	fz_var(locked);
@@ -312,8 +387,6 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		do_cache = 0;
 	}
 
-	cache = ctx->glyph_cache;
-
 	key.font = font;
 	key.gid = gid;
 	key.a = subpix_ctm.a * 65536;
@@ -322,8 +395,11 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.d = subpix_ctm.d * 65536;
 	key.aa = aa;
 
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	hash = do_hash((unsigned char *)&key, sizeof(key));
+	lock = FZ_LOCK_GLYPHCACHE + hash % FZ_GLYPH_CACHE_SHARDS;
+	cache = &ctx->glyph_cache->shard[hash % FZ_GLYPH_CACHE_SHARDS];
+	hash = (hash / FZ_GLYPH_CACHE_SHARDS) % GLYPH_HASH_LEN;
+	fz_lock(ctx, lock);
 	entry = cache->entry[hash];
 	while (entry)
 	{
@@ -331,11 +407,13 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		{
 			move_to_front(cache, entry);
 			val = fz_keep_glyph(ctx, entry->val);
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			cache->hits++;
+			fz_unlock(ctx, lock);
 			return val;
 		}
 		entry = entry->bucket_next;
 	}
+	cache->misses++;
 
 	locked = 1;
 	caching = 0;
@@ -358,10 +436,10 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 			 * we insert ours to find one already there, we
 			 * abandon ours, and use the one there already.
 			 */
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_unlock(ctx, lock);
 			locked = 0;
 			val = fz_render_t3_glyph(ctx, font, gid, subpix_ctm, model, scissor, aa);
-			fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_lock(ctx, lock);
 			locked = 1;
 		}
 		else
@@ -411,14 +489,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				cache->lru_head = entry;
 
 				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
-				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
-				}
+				evict_to_budget(ctx, cache, entry);
 			}
 		}
 unlock_and_return_val:
@@ -428,7 +499,7 @@ unlock_and_return_val:
 	fz_always(ctx)
 	{
 		if (locked)
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_unlock(ctx, lock);
 	}
 	fz_catch(ctx)
 	{
@@ -480,9 +551,10 @@ fz_render_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm,
 void
 fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-	fz_write_printf(ctx, out, "Glyph Cache Size: %zu\n", cache->total);
-#ifndef NDEBUG
-	fz_write_printf(ctx, out, "Glyph Cache Evictions: %d (%zu bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	fz_glyph_cache_stats stats;
+
+	fz_get_glyph_cache_stats(ctx, &stats);
+	fz_write_printf(ctx, out, "Glyph Cache Size: %zu (budget %zu)\n", stats.total, stats.budget);
+	fz_write_printf(ctx, out, "Glyph Cache Hits: %ld, Misses: %ld\n", stats.hits, stats.misses);
+	fz_write_printf(ctx, out, "Glyph Cache Evictions: %ld (%zu bytes)\n", stats.evictions, stats.evicted);
 }
@@ -471,4 +471,12 @@ void fz_blend_pixmap_knockout(fz_context *ctx, fz_pixmap * FZ_RESTRICT dst, fz_p
 
 void fz_paint_glyph(const unsigned char * FZ_RESTRICT colorbv, fz_pixmap * FZ_RESTRICT dst, unsigned char * FZ_RESTRICT dp, const fz_glyph * FZ_RESTRICT glyph, int w, int h, int skip_x, int skip_y, const fz_overprint * FZ_RESTRICT eop);
 
+/*
+	fz_run_display_list_band: As fz_run_display_list, for one band
+	of fz_draw_display_list_banded on its own cookie. An abort set
+	in parent (the caller's cookie, which may be NULL) is forwarded
+	into cookie as each node is reached, so it stops running bands.
+*/
+void fz_run_display_list_band(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie, const fz_cookie *parent);
+
 #endif
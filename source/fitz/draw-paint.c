@@ -101,6 +101,14 @@ and stick to using the premultiplied form.
 
 typedef unsigned char byte;
 
+#if FZ_PLOTTERS_RGB
+/* Vector versions of some painters, or NULL if the CPU has none. */
+static fz_span_painter_t *simd_span_3_da_sa(void);
+static fz_span_painter_t *simd_span_3_da_sa_alpha(void);
+static fz_span_color_painter_t *simd_span_with_color_3_da_solid(void);
+static fz_span_color_painter_t *simd_span_with_color_3_da_alpha(void);
+#endif
+
 /* These are used by the non-aa scan converter */
 
 static fz_forceinline void
@@ -1142,9 +1150,17 @@ fz_get_span_color_painter(int n, int da, const byte * FZ_RESTRICT color, const f
 #if FZ_PLOTTERS_RGB
 	case 3:
 		if (alpha == 255)
+		{
+			if (da && simd_span_with_color_3_da_solid())
+				return simd_span_with_color_3_da_solid();
 			return da ? paint_span_with_color_3_da_solid : paint_span_with_color_3_solid;
+		}
 		else
+		{
+			if (da && simd_span_with_color_3_da_alpha())
+				return simd_span_with_color_3_da_alpha();
 			return da ? paint_span_with_color_3_da_alpha : paint_span_with_color_3_alpha;
+		}
 #endif/* FZ_PLOTTERS_RGB */
 #if FZ_PLOTTERS_CMYK
 	case 4:
@@ -2118,6 +2134,347 @@ paint_span_N_general_alpha_op(byte * FZ_RESTRICT dp, int da, const byte * FZ_RES
 }
 #endif /* FZ_ENABLE_SPOT_RENDERING */
 
+/* SIMD span painters.
+ *
+ * The hottest painters (4 byte RGB+alpha spans, which is what nearly all
+ * pages rendered for display end up using) get vector versions. These
+ * must produce exactly the same bytes as the scalar templates above, so
+ * they do the same integer arithmetic 8 or 16 channels at a time, with
+ * the products kept in 16 bit lanes and the results truncated (not
+ * saturated) back to bytes. Ragged ends are handed to the scalar code.
+ *
+ * Which versions get used depends only on the CPU we are running on, so
+ * the simd_* functions below work it out afresh on every call rather
+ * than caching it anywhere. There is no shared state to set up or to
+ * race on, however many contexts and threads there are.
+ */
+
+#if FZ_ENABLE_SIMD && FZ_PLOTTERS_RGB
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FZ_PAINT_SSE41
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define FZ_PAINT_NEON
+#endif
+#endif
+
+#ifdef FZ_PAINT_SSE41
+#include <smmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define SSE41_FN __attribute__((target("sse4.1")))
+#else
+#include <intrin.h>
+#define SSE41_FN
+#endif
+
+static SSE41_FN void
+paint_span_3_da_sa_sse41(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	const __m128i alo = _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+	const __m128i ahi = _mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+	const __m128i amask = _mm_set1_epi32((int)0xFF000000);
+	const __m128i bytes = _mm_set1_epi16(0xFF);
+	const __m128i k256 = _mm_set1_epi16(256);
+	const __m128i zero = _mm_setzero_si128();
+
+	TRACK_FN();
+	for (; w >= 4; w -= 4, sp += 16, dp += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)sp);
+		__m128i d = _mm_loadu_si128((const __m128i *)dp);
+		__m128i tl = _mm_shuffle_epi8(s, alo);
+		__m128i th = _mm_shuffle_epi8(s, ahi);
+		__m128i rl, rh, keep;
+
+		/* t = 256 - FZ_EXPAND(sa); d = s + FZ_COMBINE(d, t) */
+		tl = _mm_sub_epi16(k256, _mm_add_epi16(tl, _mm_srli_epi16(tl, 7)));
+		th = _mm_sub_epi16(k256, _mm_add_epi16(th, _mm_srli_epi16(th, 7)));
+		rl = _mm_srli_epi16(_mm_mullo_epi16(_mm_cvtepu8_epi16(d), tl), 8);
+		rh = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), th), 8);
+		rl = _mm_and_si128(_mm_add_epi16(rl, _mm_cvtepu8_epi16(s)), bytes);
+		rh = _mm_and_si128(_mm_add_epi16(rh, _mm_unpackhi_epi8(s, zero)), bytes);
+
+		/* Fully transparent source pixels leave the destination alone. */
+		keep = _mm_cmpeq_epi32(_mm_and_si128(s, amask), zero);
+		_mm_storeu_si128((__m128i *)dp, _mm_blendv_epi8(_mm_packus_epi16(rl, rh), d, keep));
+	}
+	if (w)
+		template_span_3_general(dp, 1, sp, 1, w);
+}
+
+static SSE41_FN void
+paint_span_3_da_sa_alpha_sse41(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	const __m128i bytes = _mm_set1_epi16(0xFF);
+	const __m128i k255 = _mm_set1_epi16(255);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ea = _mm_set1_epi16((short)FZ_EXPAND(alpha));
+
+	TRACK_FN();
+	for (; w >= 4; w -= 4, sp += 16, dp += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)sp);
+		__m128i d = _mm_loadu_si128((const __m128i *)dp);
+		__m128i sl = _mm_srli_epi16(_mm_mullo_epi16(_mm_cvtepu8_epi16(s), ea), 8);
+		__m128i sh = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), ea), 8);
+		__m128i tl, th;
+
+		/* masa = FZ_COMBINE(sp[3], alpha); t = FZ_EXPAND(255 - masa) */
+		tl = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sl, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		th = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sh, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		tl = _mm_sub_epi16(k255, tl);
+		th = _mm_sub_epi16(k255, th);
+		tl = _mm_add_epi16(tl, _mm_srli_epi16(tl, 7));
+		th = _mm_add_epi16(th, _mm_srli_epi16(th, 7));
+
+		/* d = FZ_COMBINE(s, alpha) + FZ_COMBINE(d, t), alpha channel included. */
+		sl = _mm_add_epi16(sl, _mm_srli_epi16(_mm_mullo_epi16(_mm_cvtepu8_epi16(d), tl), 8));
+		sh = _mm_add_epi16(sh, _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), th), 8));
+		_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(_mm_and_si128(sl, bytes), _mm_and_si128(sh, bytes)));
+	}
+	if (w)
+		template_span_3_with_alpha_general(dp, 1, sp, 1, w, alpha);
+}
+
+static SSE41_FN fz_forceinline __m128i
+span_with_color_3_da_sse41(__m128i d, __m128i c, __m128i ml, __m128i mh)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i dl = _mm_cvtepu8_epi16(d);
+	__m128i dh = _mm_unpackhi_epi8(d, zero);
+
+	/* FZ_BLEND(c, d, ma), computed modulo 2^16; the true result always fits. */
+	dl = _mm_add_epi16(_mm_slli_epi16(dl, 8), _mm_mullo_epi16(_mm_sub_epi16(c, dl), ml));
+	dh = _mm_add_epi16(_mm_slli_epi16(dh, 8), _mm_mullo_epi16(_mm_sub_epi16(c, dh), mh));
+	return _mm_packus_epi16(_mm_srli_epi16(dl, 8), _mm_srli_epi16(dh, 8));
+}
+
+static SSE41_FN void
+paint_span_with_color_3_da_solid_sse41(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	const __m128i mlo = _mm_setr_epi8(0, -1, 0, -1, 0, -1, 0, -1, 1, -1, 1, -1, 1, -1, 1, -1);
+	const __m128i mhi = _mm_setr_epi8(2, -1, 2, -1, 2, -1, 2, -1, 3, -1, 3, -1, 3, -1, 3, -1);
+	const __m128i c = _mm_setr_epi16(color[0], color[1], color[2], 255, color[0], color[1], color[2], 255);
+
+	TRACK_FN();
+	for (; w >= 4; w -= 4, mp += 4, dp += 16)
+	{
+		int m4;
+		__m128i m, ml, mh;
+
+		memcpy(&m4, mp, 4);
+		if (m4 == 0)
+			continue;
+		m = _mm_cvtsi32_si128(m4);
+		ml = _mm_shuffle_epi8(m, mlo);
+		mh = _mm_shuffle_epi8(m, mhi);
+		ml = _mm_add_epi16(ml, _mm_srli_epi16(ml, 7));
+		mh = _mm_add_epi16(mh, _mm_srli_epi16(mh, 7));
+		_mm_storeu_si128((__m128i *)dp, span_with_color_3_da_sse41(_mm_loadu_si128((const __m128i *)dp), c, ml, mh));
+	}
+	if (w)
+		template_span_with_color_3_da_solid(dp, mp, n, w, color, da);
+}
+
+static SSE41_FN void
+paint_span_with_color_3_da_alpha_sse41(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	const __m128i mlo = _mm_setr_epi8(0, -1, 0, -1, 0, -1, 0, -1, 1, -1, 1, -1, 1, -1, 1, -1);
+	const __m128i mhi = _mm_setr_epi8(2, -1, 2, -1, 2, -1, 2, -1, 3, -1, 3, -1, 3, -1, 3, -1);
+	const __m128i c = _mm_setr_epi16(color[0], color[1], color[2], 255, color[0], color[1], color[2], 255);
+	const __m128i sa = _mm_set1_epi16((short)FZ_EXPAND(color[3]));
+
+	TRACK_FN();
+	for (; w >= 4; w -= 4, mp += 4, dp += 16)
+	{
+		int m4;
+		__m128i m, ml, mh;
+
+		memcpy(&m4, mp, 4);
+		if (m4 == 0)
+			continue;
+		m = _mm_cvtsi32_si128(m4);
+		ml = _mm_shuffle_epi8(m, mlo);
+		mh = _mm_shuffle_epi8(m, mhi);
+		/* ma = FZ_COMBINE(FZ_EXPAND(ma), sa); color[3] < 255 here, so this fits in 16 bits. */
+		ml = _mm_srli_epi16(_mm_mullo_epi16(_mm_add_epi16(ml, _mm_srli_epi16(ml, 7)), sa), 8);
+		mh = _mm_srli_epi16(_mm_mullo_epi16(_mm_add_epi16(mh, _mm_srli_epi16(mh, 7)), sa), 8);
+		_mm_storeu_si128((__m128i *)dp, span_with_color_3_da_sse41(_mm_loadu_si128((const __m128i *)dp), c, ml, mh));
+	}
+	if (w)
+		template_span_with_color_3_da_alpha(dp, mp, n, w, color, da);
+}
+
+static int
+cpu_has_sse41(void)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	/* libgcc fills in the cpu model before main; this only reads it. */
+	return __builtin_cpu_supports("sse4.1");
+#else
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] >> 19) & 1;
+#endif
+}
+#endif /* FZ_PAINT_SSE41 */
+
+#ifdef FZ_PAINT_NEON
+#include <arm_neon.h>
+
+static void
+paint_span_3_da_sa_neon(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	const uint16x8_t k256 = vdupq_n_u16(256);
+	int i;
+
+	TRACK_FN();
+	for (; w >= 8; w -= 8, sp += 32, dp += 32)
+	{
+		uint8x8x4_t s = vld4_u8(sp);
+		uint8x8x4_t d = vld4_u8(dp);
+		uint8x8_t keep = vceq_u8(s.val[3], vdup_n_u8(0));
+		uint16x8_t t = vmovl_u8(s.val[3]);
+
+		/* t = 256 - FZ_EXPAND(sa); d = s + FZ_COMBINE(d, t) */
+		t = vsubq_u16(k256, vaddq_u16(t, vshrq_n_u16(t, 7)));
+		for (i = 0; i < 4; i++)
+		{
+			uint16x8_t r = vaddq_u16(vmovl_u8(s.val[i]), vshrq_n_u16(vmulq_u16(vmovl_u8(d.val[i]), t), 8));
+			/* Fully transparent source pixels leave the destination alone. */
+			d.val[i] = vbsl_u8(keep, d.val[i], vmovn_u16(r));
+		}
+		vst4_u8(dp, d);
+	}
+	if (w)
+		template_span_3_general(dp, 1, sp, 1, w);
+}
+
+static void
+paint_span_3_da_sa_alpha_neon(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	const uint16x8_t ea = vdupq_n_u16(FZ_EXPAND(alpha));
+	const uint16x8_t k255 = vdupq_n_u16(255);
+	int i;
+
+	TRACK_FN();
+	for (; w >= 8; w -= 8, sp += 32, dp += 32)
+	{
+		uint8x8x4_t s = vld4_u8(sp);
+		uint8x8x4_t d = vld4_u8(dp);
+		uint16x8_t masa = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[3]), ea), 8);
+		uint16x8_t t = vsubq_u16(k255, masa);
+
+		/* t = FZ_EXPAND(255 - masa); d = FZ_COMBINE(s, alpha) + FZ_COMBINE(d, t) */
+		t = vaddq_u16(t, vshrq_n_u16(t, 7));
+		for (i = 0; i < 4; i++)
+		{
+			uint16x8_t r = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[i]), ea), 8);
+			r = vaddq_u16(r, vshrq_n_u16(vmulq_u16(vmovl_u8(d.val[i]), t), 8));
+			d.val[i] = vmovn_u16(r);
+		}
+		vst4_u8(dp, d);
+	}
+	if (w)
+		template_span_3_with_alpha_general(dp, 1, sp, 1, w, alpha);
+}
+
+static fz_forceinline void
+span_with_color_3_da_neon(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT color, uint16x8_t ma)
+{
+	uint8x8x4_t d = vld4_u8(dp);
+	int i;
+
+	/* FZ_BLEND(c, d, ma), computed modulo 2^16; the true result always fits. */
+	for (i = 0; i < 4; i++)
+	{
+		uint16x8_t dd = vmovl_u8(d.val[i]);
+		uint16x8_t c = vdupq_n_u16(i == 3 ? 255 : color[i]);
+		d.val[i] = vshrn_n_u16(vmlaq_u16(vshlq_n_u16(dd, 8), vsubq_u16(c, dd), ma), 8);
+	}
+	vst4_u8(dp, d);
+}
+
+static void
+paint_span_with_color_3_da_solid_neon(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	for (; w >= 8; w -= 8, mp += 8, dp += 32)
+	{
+		uint16x8_t ma = vmovl_u8(vld1_u8(mp));
+		span_with_color_3_da_neon(dp, color, vaddq_u16(ma, vshrq_n_u16(ma, 7)));
+	}
+	if (w)
+		template_span_with_color_3_da_solid(dp, mp, n, w, color, da);
+}
+
+static void
+paint_span_with_color_3_da_alpha_neon(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	const uint16x8_t sa = vdupq_n_u16(FZ_EXPAND(color[3]));
+
+	TRACK_FN();
+	for (; w >= 8; w -= 8, mp += 8, dp += 32)
+	{
+		uint16x8_t ma = vmovl_u8(vld1_u8(mp));
+		/* ma = FZ_COMBINE(FZ_EXPAND(ma), sa); color[3] < 255 here, so this fits in 16 bits. */
+		ma = vshrq_n_u16(vmulq_u16(vaddq_u16(ma, vshrq_n_u16(ma, 7)), sa), 8);
+		span_with_color_3_da_neon(dp, color, ma);
+	}
+	if (w)
+		template_span_with_color_3_da_alpha(dp, mp, n, w, color, da);
+}
+#endif /* FZ_PAINT_NEON */
+
+#if FZ_PLOTTERS_RGB
+static fz_span_painter_t *
+simd_span_3_da_sa(void)
+{
+#if defined(FZ_PAINT_SSE41)
+	return cpu_has_sse41() ? paint_span_3_da_sa_sse41 : NULL;
+#elif defined(FZ_PAINT_NEON)
+	return paint_span_3_da_sa_neon;
+#else
+	return NULL;
+#endif
+}
+
+static fz_span_painter_t *
+simd_span_3_da_sa_alpha(void)
+{
+#if defined(FZ_PAINT_SSE41)
+	return cpu_has_sse41() ? paint_span_3_da_sa_alpha_sse41 : NULL;
+#elif defined(FZ_PAINT_NEON)
+	return paint_span_3_da_sa_alpha_neon;
+#else
+	return NULL;
+#endif
+}
+
+static fz_span_color_painter_t *
+simd_span_with_color_3_da_solid(void)
+{
+#if defined(FZ_PAINT_SSE41)
+	return cpu_has_sse41() ? paint_span_with_color_3_da_solid_sse41 : NULL;
+#elif defined(FZ_PAINT_NEON)
+	return paint_span_with_color_3_da_solid_neon;
+#else
+	return NULL;
+#endif
+}
+
+static fz_span_color_painter_t *
+simd_span_with_color_3_da_alpha(void)
+{
+#if defined(FZ_PAINT_SSE41)
+	return cpu_has_sse41() ? paint_span_with_color_3_da_alpha_sse41 : NULL;
+#elif defined(FZ_PAINT_NEON)
+	return paint_span_with_color_3_da_alpha_neon;
+#else
+	return NULL;
+#endif
+}
+#endif /* FZ_PLOTTERS_RGB */
+
 fz_span_painter_t *
 fz_get_span_painter(int da, int sa, int n, int alpha, const fz_overprint * FZ_RESTRICT eop)
 {
@@ -2182,9 +2539,9 @@ fz_get_span_painter(int da, int sa, int n, int alpha, const fz_overprint * FZ_RE
 			if (sa)
 			{
 				if (alpha == 255)
-					return paint_span_3_da_sa;
+					return simd_span_3_da_sa() ? simd_span_3_da_sa() : paint_span_3_da_sa;
 				else if (alpha > 0)
-					return paint_span_3_da_sa_alpha;
+					return simd_span_3_da_sa_alpha() ? simd_span_3_da_sa_alpha() : paint_span_3_da_sa_alpha;
 			}
 			else
 			{
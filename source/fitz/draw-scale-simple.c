@@ -42,6 +42,19 @@ intermediate results rather than ints.
 #include <assert.h>
 #include <limits.h>
 
+/* SSE2 is part of the x86-64 baseline and NEON of the arm64 one, so the
+ * vector scalers are chosen at compile time. 32 bit ARM has its own
+ * assembly versions below. */
+#if FZ_ENABLE_SIMD && !defined(ARCH_ARM)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FZ_SCALE_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define FZ_SCALE_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 /* Do we special case handling of single pixel high/wide images? The
  * 'purest' handling is given by not special casing them, but certain
  * files that use such images 'stack' them to give full images. Not
@@ -211,7 +224,7 @@ typedef struct
 	int index[1];
 } fz_weights;
 
-struct fz_scale_cache
+typedef struct
 {
 	int src_w;
 	float x;
@@ -223,7 +236,49 @@ struct fz_scale_cache
 	int patch_r;
 	int n;
 	int flip;
+} fz_weights_key;
+
+/* A weights table in the context wide cache. Entries are reference
+ * counted, so that one evicted while in use lives until released. */
+typedef struct fz_weights_entry
+{
+	int refs;
+	int cached;
+	unsigned int hash;
+	size_t size;
+	fz_weights_key key;
 	fz_weights *weights;
+	struct fz_weights_entry *hash_next;
+	struct fz_weights_entry *lru_prev;
+	struct fz_weights_entry *lru_next;
+} fz_weights_entry;
+
+#define WEIGHTS_HASH_SIZE 251
+#define WEIGHTS_CACHE_DEFAULT_BUDGET (4<<20)
+
+/* Shared between cloned contexts, and protected by FZ_LOCK_ALLOC.
+ * Nothing is allocated or freed with the lock held. */
+struct fz_weights_cache
+{
+	int refs;
+	size_t budget;
+	size_t total;
+	int entries;
+	int64_t hits;
+	int64_t misses;
+	int64_t evictions;
+	fz_weights_entry *hash[WEIGHTS_HASH_SIZE];
+	fz_weights_entry *lru_head;
+	fz_weights_entry *lru_tail;
+};
+
+/* A single entry cache private to one caller (e.g. a draw device),
+ * in front of the context wide one. It holds a reference to the
+ * entry it last used. */
+struct fz_scale_cache
+{
+	fz_weights_key key;
+	fz_weights_entry *entry;
 };
 
 static fz_weights *
@@ -443,37 +498,13 @@ check_weights(fz_weights *weights, int j, int w, float x, float wf)
 }
 
 static fz_weights *
-make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *filter, int vertical, int dst_w_int, int patch_l, int patch_r, int n, int flip, fz_scale_cache *cache)
+build_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *filter, int vertical, int dst_w_int, int patch_l, int patch_r, int n, int flip)
 {
 	fz_weights *weights;
 	float F, G;
 	float window;
 	int j;
 
-	if (cache)
-	{
-		if (cache->src_w == src_w && cache->x == x && cache->dst_w == dst_w &&
-			cache->filter == filter && cache->vertical == vertical &&
-			cache->dst_w_int == dst_w_int &&
-			cache->patch_l == patch_l && cache->patch_r == patch_r &&
-			cache->n == n && cache->flip == flip)
-		{
-			return cache->weights;
-		}
-		cache->src_w = src_w;
-		cache->x = x;
-		cache->dst_w = dst_w;
-		cache->filter = filter;
-		cache->vertical = vertical;
-		cache->dst_w_int = dst_w_int;
-		cache->patch_l = patch_l;
-		cache->patch_r = patch_r;
-		cache->n = n;
-		cache->flip = flip;
-		fz_free(ctx, cache->weights);
-		cache->weights = NULL;
-	}
-
 	if (dst_w < src_w)
 	{
 		/* Scaling down */
@@ -509,11 +540,222 @@ make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *
 		}
 	}
 	weights->count++; /* weights->count = dst_w_int now */
+	return weights;
+}
+
+static size_t
+weights_size(fz_weights *weights, int patch_w)
+{
+	return sizeof(*weights) + (size_t)(weights->max_len+3)*(patch_w+1)*sizeof(int);
+}
+
+static unsigned int
+hash_weights_key(const fz_weights_key *key)
+{
+	const unsigned char *s = (const unsigned char *)key;
+	unsigned int h = 0;
+	size_t i;
+
+	/* The key is filled field by field after being zeroed, so any
+	 * padding is zero too. */
+	for (i = 0; i < sizeof(*key); i++)
+		h = h * 31 + s[i];
+	return h;
+}
+
+static void
+lru_unlink(fz_weights_cache *cache, fz_weights_entry *entry)
+{
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		cache->lru_head = entry->lru_next;
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		cache->lru_tail = entry->lru_prev;
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void
+lru_push_front(fz_weights_cache *cache, fz_weights_entry *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = cache->lru_head;
+	if (cache->lru_head)
+		cache->lru_head->lru_prev = entry;
+	else
+		cache->lru_tail = entry;
+	cache->lru_head = entry;
+}
+
+/* Take an entry out of the cache. Returns it if it is now unused and
+ * should be freed (after unlocking). Called with the lock held. */
+static fz_weights_entry *
+uncache_weights(fz_weights_cache *cache, fz_weights_entry *entry)
+{
+	fz_weights_entry **pp = &cache->hash[entry->hash % WEIGHTS_HASH_SIZE];
+
+	while (*pp != entry)
+		pp = &(*pp)->hash_next;
+	*pp = entry->hash_next;
+	entry->hash_next = NULL;
+	lru_unlink(cache, entry);
+	entry->cached = 0;
+	cache->total -= entry->size;
+	cache->entries--;
+	return entry->refs == 0 ? entry : NULL;
+}
+
+/* Evict from the tail until within budget, chaining the entries to
+ * be freed through hash_next. Called with the lock held. */
+static fz_weights_entry *
+evict_weights(fz_weights_cache *cache, fz_weights_entry *keep)
+{
+	fz_weights_entry *dead = NULL;
+	fz_weights_entry *entry = cache->lru_tail;
+
+	while (cache->total > cache->budget && entry)
+	{
+		fz_weights_entry *prev = entry->lru_prev;
+		if (entry != keep)
+		{
+			cache->evictions++;
+			if (uncache_weights(cache, entry))
+			{
+				entry->hash_next = dead;
+				dead = entry;
+			}
+		}
+		entry = prev;
+	}
+	return dead;
+}
+
+static void
+free_weights_entries(fz_context *ctx, fz_weights_entry *dead)
+{
+	while (dead)
+	{
+		fz_weights_entry *next = dead->hash_next;
+		fz_free(ctx, dead->weights);
+		fz_free(ctx, dead);
+		dead = next;
+	}
+}
+
+static void
+release_weights(fz_context *ctx, fz_weights_entry *entry)
+{
+	int dead;
+
+	if (!entry)
+		return;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	dead = (--entry->refs == 0 && !entry->cached);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (dead)
+	{
+		fz_free(ctx, entry->weights);
+		fz_free(ctx, entry);
+	}
+}
+
+/* Find or make the weights for key, returning a reference to the
+ * entry that holds them. */
+static fz_weights_entry *
+find_weights(fz_context *ctx, const fz_weights_key *key)
+{
+	fz_weights_cache *cache = ctx->weights_cache;
+	fz_weights_entry *entry, *dead;
+	unsigned int hash = hash_weights_key(key);
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (entry = cache->hash[hash % WEIGHTS_HASH_SIZE]; entry; entry = entry->hash_next)
+	{
+		if (entry->hash == hash && !memcmp(&entry->key, key, sizeof(*key)))
+		{
+			entry->refs++;
+			cache->hits++;
+			lru_unlink(cache, entry);
+			lru_push_front(cache, entry);
+			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			return entry;
+		}
+	}
+	cache->misses++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	entry = fz_malloc_struct(ctx, fz_weights_entry);
+	fz_try(ctx)
+		entry->weights = build_weights(ctx, key->src_w, key->x, key->dst_w, key->filter, key->vertical, key->dst_w_int, key->patch_l, key->patch_r, key->n, key->flip);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, entry);
+		fz_rethrow(ctx);
+	}
+	entry->refs = 1;
+	entry->hash = hash;
+	entry->key = *key;
+	entry->size = sizeof(*entry) + weights_size(entry->weights, key->patch_r - key->patch_l);
+
+	/* Tables bigger than the whole budget (any, if it is 0) are used
+	 * once and freed on release, not cached. */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (entry->size > cache->budget)
+	{
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		return entry;
+	}
+	entry->cached = 1;
+	entry->hash_next = cache->hash[hash % WEIGHTS_HASH_SIZE];
+	cache->hash[hash % WEIGHTS_HASH_SIZE] = entry;
+	lru_push_front(cache, entry);
+	cache->total += entry->size;
+	cache->entries++;
+	dead = evict_weights(cache, entry);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	free_weights_entries(ctx, dead);
+
+	return entry;
+}
+
+/* Get the weights for scaling, from the caller's single entry cache,
+ * or else the context wide one. If cache is NULL, *entryp is set to
+ * a reference to release once the weights are finished with. */
+static fz_weights *
+make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *filter, int vertical, int dst_w_int, int patch_l, int patch_r, int n, int flip, fz_scale_cache *cache, fz_weights_entry **entryp)
+{
+	fz_weights_key key;
+	fz_weights_entry *entry;
+
+	memset(&key, 0, sizeof(key));
+	key.src_w = src_w;
+	key.x = x;
+	key.dst_w = dst_w;
+	key.filter = filter;
+	key.vertical = vertical;
+	key.dst_w_int = dst_w_int;
+	key.patch_l = patch_l;
+	key.patch_r = patch_r;
+	key.n = n;
+	key.flip = flip;
+
+	if (cache && cache->entry && !memcmp(&cache->key, &key, sizeof(key)))
+		return cache->entry->weights;
+
+	entry = find_weights(ctx, &key);
 	if (cache)
 	{
-		cache->weights = weights;
+		release_weights(ctx, cache->entry);
+		cache->entry = entry;
+		cache->key = key;
 	}
-	return weights;
+	else
+		*entryp = entry;
+
+	return entry->weights;
 }
 
 static void
@@ -1164,6 +1406,10 @@ scale_row_to_temp3(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RES
 	}
 }
 
+/* The C versions of the kernels that have vector versions below; the
+ * scale benchmark in source/tests builds this file with FZ_SCALE_KEEP_C
+ * so that it can time both. */
+#if (!defined(FZ_SCALE_SSE2) && !defined(FZ_SCALE_NEON)) || defined(FZ_SCALE_KEEP_C)
 static void
 scale_row_to_temp4(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
 {
@@ -1246,6 +1492,7 @@ scale_row_from_temp(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RE
 		src++;
 	}
 }
+#endif
 
 static void
 scale_row_from_temp_alpha(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
@@ -1277,6 +1524,207 @@ scale_row_from_temp_alpha(unsigned char * FZ_RESTRICT dst, const unsigned char *
 		*dst++ = 255;
 	}
 }
+
+/* Vector versions of the two passes that dominate photo downscaling:
+ * the vertical pass (which runs over every byte of every output row)
+ * and the horizontal pass for 4 component (RGBA/CMYK) data. The weights
+ * are small integers (they sum to 256), so the sums are exactly those of
+ * the C code above whatever order they are accumulated in. */
+
+#ifdef FZ_SCALE_SSE2
+static fz_forceinline __m128i
+weight_pair_sse2(int w0, int w1)
+{
+	return _mm_set1_epi32((int)(((unsigned int)w1 << 16) | (w0 & 0xFFFF)));
+}
+
+/* (val>>8) truncated to bytes, as the C code does. */
+static fz_forceinline __m128i
+pack_sums_sse2(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+	const __m128i bytes = _mm_set1_epi32(0xFF);
+	a = _mm_and_si128(_mm_srai_epi32(a, 8), bytes);
+	b = _mm_and_si128(_mm_srai_epi32(b, 8), bytes);
+	c = _mm_and_si128(_mm_srai_epi32(c, 8), bytes);
+	d = _mm_and_si128(_mm_srai_epi32(d, 8), bytes);
+	return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+static void
+scale_row_to_temp4_sse2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(128);
+	int len, i, step = 4;
+
+	assert(weights->n == 4);
+	if (weights->flip)
+	{
+		dst += 4*(weights->count-1);
+		step = -4;
+	}
+	for (i=weights->count; i > 0; i--, dst += step)
+	{
+		const unsigned char *min = &src[4 * *contrib++];
+		__m128i acc = round;
+		int p0, p1;
+
+		len = *contrib++;
+		/* Two source pixels at a time: [r0 r1 g0 g1 b0 b1 a0 a1] . [w0 w1 ...] */
+		for (; len >= 2; len -= 2, min += 8, contrib += 2)
+		{
+			__m128i x;
+			memcpy(&p0, min, 4);
+			memcpy(&p1, min + 4, 4);
+			x = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(p0), _mm_cvtsi32_si128(p1)), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(x, weight_pair_sse2(contrib[0], contrib[1])));
+		}
+		if (len)
+		{
+			__m128i x;
+			memcpy(&p0, min, 4);
+			x = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(p0), zero), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(x, weight_pair_sse2(contrib[0], 0)));
+			contrib++;
+		}
+		p0 = _mm_cvtsi128_si32(pack_sums_sse2(acc, zero, zero, zero));
+		memcpy(dst, &p0, 4);
+	}
+}
+
+static void
+scale_row_from_temp_sse2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(128);
+	int len, x, k;
+	int width = w * n;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const unsigned char *min = src + x;
+		__m128i a0 = round, a1 = round, a2 = round, a3 = round;
+
+		/* Two source rows at a time, interleaved so madd applies both weights at once. */
+		for (k = 0; k < len; k += 2)
+		{
+			__m128i r0 = _mm_loadu_si128((const __m128i *)min);
+			__m128i r1 = k+1 < len ? _mm_loadu_si128((const __m128i *)(min + width)) : zero;
+			__m128i wt = weight_pair_sse2(contrib[k], k+1 < len ? contrib[k+1] : 0);
+			__m128i lo = _mm_unpacklo_epi8(r0, r1);
+			__m128i hi = _mm_unpackhi_epi8(r0, r1);
+			a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), wt));
+			a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), wt));
+			a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), wt));
+			a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), wt));
+			min += 2*width;
+		}
+		_mm_storeu_si128((__m128i *)(dst + x), pack_sums_sse2(a0, a1, a2, a3));
+	}
+	for (; x < width; x++)
+	{
+		const unsigned char *min = src + x;
+		int val = 128;
+
+		for (k = 0; k < len; k++)
+		{
+			val += *min * contrib[k];
+			min += width;
+		}
+		dst[x] = (unsigned char)(val>>8);
+	}
+}
+#endif /* FZ_SCALE_SSE2 */
+
+#ifdef FZ_SCALE_NEON
+/* (val>>8) truncated to bytes, as the C code does. */
+static fz_forceinline uint8x8_t
+narrow_sums_neon(int32x4_t a, int32x4_t b)
+{
+	int16x8_t s = vcombine_s16(vmovn_s32(vshrq_n_s32(a, 8)), vmovn_s32(vshrq_n_s32(b, 8)));
+	return vmovn_u16(vreinterpretq_u16_s16(s));
+}
+
+static void
+scale_row_to_temp4_neon(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	const int32x4_t round = vdupq_n_s32(128);
+	int len, i, step = 4;
+
+	assert(weights->n == 4);
+	if (weights->flip)
+	{
+		dst += 4*(weights->count-1);
+		step = -4;
+	}
+	for (i=weights->count; i > 0; i--, dst += step)
+	{
+		const unsigned char *min = &src[4 * *contrib++];
+		int32x4_t acc = round;
+		uint32_t p;
+
+		len = *contrib++;
+		while (len-- > 0)
+		{
+			int16x4_t x;
+			memcpy(&p, min, 4);
+			x = vget_low_s16(vreinterpretq_s16_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(p)))));
+			acc = vmlal_n_s16(acc, x, (int16_t)*contrib++);
+			min += 4;
+		}
+		p = vget_lane_u32(vreinterpret_u32_u8(narrow_sums_neon(acc, acc)), 0);
+		memcpy(dst, &p, 4);
+	}
+}
+
+static void
+scale_row_from_temp_neon(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	const int32x4_t round = vdupq_n_s32(128);
+	int len, x, k;
+	int width = w * n;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const unsigned char *min = src + x;
+		int32x4_t a0 = round, a1 = round, a2 = round, a3 = round;
+
+		for (k = 0; k < len; k++)
+		{
+			uint8x16_t r = vld1q_u8(min);
+			int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(r)));
+			int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(r)));
+			int16_t wt = (int16_t)contrib[k];
+			a0 = vmlal_n_s16(a0, vget_low_s16(lo), wt);
+			a1 = vmlal_n_s16(a1, vget_high_s16(lo), wt);
+			a2 = vmlal_n_s16(a2, vget_low_s16(hi), wt);
+			a3 = vmlal_n_s16(a3, vget_high_s16(hi), wt);
+			min += width;
+		}
+		vst1q_u8(dst + x, vcombine_u8(narrow_sums_neon(a0, a1), narrow_sums_neon(a2, a3)));
+	}
+	for (; x < width; x++)
+	{
+		const unsigned char *min = src + x;
+		int val = 128;
+
+		for (k = 0; k < len; k++)
+		{
+			val += *min * contrib[k];
+			min += width;
+		}
+		dst[x] = (unsigned char)(val>>8);
+	}
+}
+#endif /* FZ_SCALE_NEON */
 #endif
 
 #ifdef SINGLE_PIXEL_SPECIALS
@@ -1557,6 +2005,8 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 	fz_scale_filter *filter = &fz_scale_filter_simple;
 	fz_weights *contrib_rows = NULL;
 	fz_weights *contrib_cols = NULL;
+	fz_weights_entry *entry_rows = NULL;
+	fz_weights_entry *entry_cols = NULL;
 	fz_pixmap *output = NULL;
 	unsigned char *temp = NULL;
 	int max_row, temp_span, temp_rows, row;
@@ -1566,6 +2016,8 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 
 	fz_var(contrib_cols);
 	fz_var(contrib_rows);
+	fz_var(entry_cols);
+	fz_var(entry_rows);
 
 	/* Avoid extreme scales where overflows become problematic. */
 	if (w > (1<<24) || h > (1<<24) || w < -(1<<24) || h < -(1<<24))
@@ -1725,22 +2177,20 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 			contrib_cols = NULL;
 		else
 #endif /* SINGLE_PIXEL_SPECIALS */
-			contrib_cols = Memento_label(make_weights(ctx, src->w, x, w, filter, 0, dst_w_int, patch.x0, patch.x1, src->n, flip_x, cache_x), "contrib_cols");
+			contrib_cols = Memento_label(make_weights(ctx, src->w, x, w, filter, 0, dst_w_int, patch.x0, patch.x1, src->n, flip_x, cache_x, &entry_cols), "contrib_cols");
 #ifdef SINGLE_PIXEL_SPECIALS
 		if (src->h == 1)
 			contrib_rows = NULL;
 		else
 #endif /* SINGLE_PIXEL_SPECIALS */
-			contrib_rows = Memento_label(make_weights(ctx, src->h, y, h, filter, 1, dst_h_int, patch.y0, patch.y1, src->n, flip_y, cache_y), "contrib_rows");
+			contrib_rows = Memento_label(make_weights(ctx, src->h, y, h, filter, 1, dst_h_int, patch.y0, patch.y1, src->n, flip_y, cache_y, &entry_rows), "contrib_rows");
 
 		output = fz_new_pixmap(ctx, src->colorspace, patch.x1 - patch.x0, patch.y1 - patch.y0, src->seps, src->alpha || forcealpha);
 	}
 	fz_catch(ctx)
 	{
-		if (!cache_x)
-			fz_free(ctx, contrib_cols);
-		if (!cache_y)
-			fz_free(ctx, contrib_rows);
+		release_weights(ctx, entry_cols);
+		release_weights(ctx, entry_rows);
 		fz_rethrow(ctx);
 	}
 	output->x = dst_x_int;
@@ -1787,10 +2237,8 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 		fz_catch(ctx)
 		{
 			fz_drop_pixmap(ctx, output);
-			if (!cache_x)
-				fz_free(ctx, contrib_cols);
-			if (!cache_y)
-				fz_free(ctx, contrib_rows);
+			release_weights(ctx, entry_cols);
+			release_weights(ctx, entry_rows);
 			fz_rethrow(ctx);
 		}
 		switch (src->n)
@@ -1808,10 +2256,22 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 			row_scale_in = scale_row_to_temp3;
 			break;
 		case 4: /* RGBA or CMYK case */
+#if defined(FZ_SCALE_SSE2)
+			row_scale_in = scale_row_to_temp4_sse2;
+#elif defined(FZ_SCALE_NEON)
+			row_scale_in = scale_row_to_temp4_neon;
+#else
 			row_scale_in = scale_row_to_temp4;
+#endif
 			break;
 		}
+#if defined(FZ_SCALE_SSE2)
+		row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp_sse2;
+#elif defined(FZ_SCALE_NEON)
+		row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp_neon;
+#else
 		row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp;
+#endif
 		max_row = contrib_rows->index[contrib_rows->index[0]];
 		for (row = 0; row < contrib_rows->count; row++)
 		{
@@ -1842,10 +2302,8 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 	}
 
 cleanup:
-	if (!cache_y)
-		fz_free(ctx, contrib_rows);
-	if (!cache_x)
-		fz_free(ctx, contrib_cols);
+	release_weights(ctx, entry_rows);
+	release_weights(ctx, entry_cols);
 
 	return output;
 }
@@ -1855,7 +2313,7 @@ fz_drop_scale_cache(fz_context *ctx, fz_scale_cache *sc)
 {
 	if (!sc)
 		return;
-	fz_free(ctx, sc->weights);
+	release_weights(ctx, sc->entry);
 	fz_free(ctx, sc);
 }
 
@@ -1864,3 +2322,73 @@ fz_new_scale_cache(fz_context *ctx)
 {
 	return fz_malloc_struct(ctx, fz_scale_cache);
 }
+
+void
+fz_new_weights_cache_context(fz_context *ctx)
+{
+	ctx->weights_cache = fz_malloc_struct(ctx, fz_weights_cache);
+	ctx->weights_cache->refs = 1;
+	ctx->weights_cache->budget = WEIGHTS_CACHE_DEFAULT_BUDGET;
+}
+
+fz_weights_cache *
+fz_keep_weights_cache(fz_context *ctx)
+{
+	return fz_keep_imp(ctx, ctx->weights_cache, &ctx->weights_cache->refs);
+}
+
+void
+fz_drop_weights_cache_context(fz_context *ctx)
+{
+	fz_weights_cache *cache = ctx->weights_cache;
+	fz_weights_entry *entry, *next;
+
+	if (!cache)
+		return;
+	if (fz_drop_imp(ctx, cache, &cache->refs))
+	{
+		/* Entries still referenced by a scale cache are freed when
+		 * it is dropped. */
+		for (entry = cache->lru_head; entry; entry = next)
+		{
+			next = entry->lru_next;
+			entry->cached = 0;
+			if (entry->refs == 0)
+			{
+				fz_free(ctx, entry->weights);
+				fz_free(ctx, entry);
+			}
+		}
+		fz_free(ctx, cache);
+	}
+	ctx->weights_cache = NULL;
+}
+
+void
+fz_set_weights_cache_budget(fz_context *ctx, size_t budget)
+{
+	fz_weights_cache *cache = ctx->weights_cache;
+	fz_weights_entry *dead;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	cache->budget = budget;
+	dead = evict_weights(cache, NULL);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	free_weights_entries(ctx, dead);
+}
+
+void
+fz_get_weights_cache_stats(fz_context *ctx, fz_weights_cache_stats *stats)
+{
+	fz_weights_cache *cache = ctx->weights_cache;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	stats->budget = cache->budget;
+	stats->total = cache->total;
+	stats->entries = cache->entries;
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->evictions = cache->evictions;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
@@ -22,6 +22,8 @@
 
 #include "mupdf/fitz.h"
 
+#include "pixmap-imp.h"
+
 #include <assert.h>
 
 struct fz_halftone
@@ -540,22 +542,21 @@ static int gcd(int u, int v)
 	while (1);
 }
 
-fz_bitmap *fz_new_bitmap_from_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht, int band_start)
+struct fz_halftoner
 {
-	fz_bitmap *out = NULL;
-	unsigned char *ht_line = NULL;
-	unsigned char *o, *p;
-	int w, h, x, y, n, pstride, ostride, lcm, i, alpha;
-	fz_halftone *ht_ = NULL;
+	fz_halftone *ht;
 	threshold_fn *thresh;
+	unsigned char *ht_line;
+	int lcm;
+	int n;
+};
 
-	fz_var(ht_line);
-
-	if (!pix)
-		return NULL;
-
-	n = pix->n;
-	alpha = pix->alpha;
+fz_halftoner *
+fz_new_halftoner(fz_context *ctx, fz_halftone *ht, int n, int alpha)
+{
+	fz_halftoner *h;
+	threshold_fn *thresh;
+	int i, w, lcm;
 
 	/* Treat alpha only as greyscale */
 	if (n == 1 && alpha)
@@ -579,7 +580,9 @@ fz_bitmap *fz_new_bitmap_from_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_ha
 	}
 
 	if (ht == NULL)
-		ht_ = ht = fz_default_halftone(ctx, n);
+		ht = fz_default_halftone(ctx, n);
+	else
+		ht = fz_keep_halftone(ctx, ht);
 
 	/* Find the minimum length for the halftone line. This
 	 * is the LCM of the halftone lengths and 8. (We need a
@@ -597,30 +600,78 @@ fz_bitmap *fz_new_bitmap_from_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_ha
 
 	fz_try(ctx)
 	{
-		ht_line = fz_malloc(ctx, lcm * (size_t)n);
-		out = fz_new_bitmap(ctx, pix->w, pix->h, n, pix->xres, pix->yres);
+		h = fz_malloc_struct(ctx, fz_halftoner);
+		h->ht = ht;
+		h->thresh = thresh;
+		h->lcm = lcm;
+		h->n = n;
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_halftone(ctx, ht);
+		fz_rethrow(ctx);
+	}
+
+	fz_try(ctx)
+		h->ht_line = fz_malloc(ctx, lcm * (size_t)n);
+	fz_catch(ctx)
+	{
+		fz_drop_halftoner(ctx, h);
+		fz_rethrow(ctx);
+	}
+
+	return h;
+}
+
+void
+fz_drop_halftoner(fz_context *ctx, fz_halftoner *h)
+{
+	if (!h)
+		return;
+	fz_drop_halftone(ctx, h->ht);
+	fz_free(ctx, h->ht_line);
+	fz_free(ctx, h);
+}
+
+void
+fz_halftone_row(fz_halftoner *h, const unsigned char *src, unsigned char *dst, int x, int y, int w)
+{
+	make_ht_line(h->ht_line, h->ht, x, y, h->lcm);
+	h->thresh(h->ht_line, src, dst, w, h->lcm);
+}
+
+fz_bitmap *fz_new_bitmap_from_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht, int band_start)
+{
+	fz_bitmap *out = NULL;
+	fz_halftoner *h;
+	unsigned char *o, *p;
+	int w, x, y, row, pstride, ostride;
+
+	if (!pix)
+		return NULL;
+
+	h = fz_new_halftoner(ctx, ht, pix->n, pix->alpha);
+
+	fz_try(ctx)
+	{
+		out = fz_new_bitmap(ctx, pix->w, pix->h, h->n, pix->xres, pix->yres);
 		o = out->samples;
 		p = pix->samples;
 
-		h = pix->h;
 		x = pix->x;
 		y = pix->y + band_start;
 		w = pix->w;
 		ostride = out->stride;
 		pstride = pix->stride;
-		while (h--)
+		for (row = 0; row < pix->h; row++)
 		{
-			make_ht_line(ht_line, ht, x, y++, lcm);
-			thresh(ht_line, p, o, w, lcm);
+			fz_halftone_row(h, p, o, x, y++, w);
 			o += ostride;
 			p += pstride;
 		}
 	}
 	fz_always(ctx)
-	{
-		fz_drop_halftone(ctx, ht_);
-		fz_free(ctx, ht_line);
-	}
+		fz_drop_halftoner(ctx, h);
 	fz_catch(ctx)
 		fz_rethrow(ctx);
 
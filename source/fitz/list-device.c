@@ -22,7 +22,10 @@
 
 #include "mupdf/fitz.h"
 
+#include "draw-imp.h"
+
 #include <assert.h>
+#include <math.h>
 #include <string.h>
 
 #define STACK_SIZE 96
@@ -138,6 +141,52 @@ enum {
 	MAX_NODE_SIZE = (1<<9)-sizeof(fz_display_node)
 };
 
+/* The spatial index splits the list into chunks of consecutive nodes,
+ * and runs of chunks into groups. Each records the bounds of the nodes
+ * in it, and each chunk the graphics state in force before its first
+ * node, so that playback can jump straight over a chunk or group that
+ * lies outside the scissor and pick up the state on the far side. */
+typedef struct
+{
+	int pos;
+	int skippable;
+	fz_rect bbox;
+
+	/* Graphics state before the first node. The colorspace and stroke
+	 * are borrowed from the list; the path is held as an offset so it
+	 * survives the list being reallocated. */
+	fz_rect rect;
+	fz_colorspace *colorspace;
+	fz_stroke_state *stroke;
+	int path;
+	float alpha;
+	fz_matrix ctm;
+	float color[FZ_MAX_COLORS];
+} fz_list_chunk;
+
+typedef struct
+{
+	int skippable;
+	fz_rect bbox;
+} fz_list_chunk_group;
+
+typedef struct
+{
+	size_t len;
+	int count;
+	fz_list_chunk *chunks;
+	fz_list_chunk_group *groups;
+} fz_list_index;
+
+/* Node arrays an incremental list has outgrown. They are kept until
+ * the list is dropped, as a player may still be reading one. */
+typedef struct fz_retired_nodes
+{
+	fz_display_node *nodes;
+	size_t max;
+	struct fz_retired_nodes *next;
+} fz_retired_nodes;
+
 struct fz_display_list
 {
 	fz_storable storable;
@@ -145,6 +194,16 @@ struct fz_display_list
 	fz_rect mediabox;
 	size_t max;
 	size_t len;
+	fz_list_index *index;
+
+	/* For lists made by fz_new_incremental_display_list. The
+	 * recording device publishes how many nodes are complete in
+	 * committed, and sets finished when it is done; both (and the
+	 * list pointer) are read and written with the alloc lock held. */
+	int incremental;
+	int finished;
+	size_t committed;
+	fz_retired_nodes *retired;
 };
 
 typedef struct
@@ -168,6 +227,9 @@ typedef struct
 		fz_rect rect;
 	} stack[STACK_SIZE];
 	int tiled;
+
+	/* Set while compacting a list, to share equal objects */
+	struct fz_list_sharing *sharing;
 } fz_list_device;
 
 enum { ISOLATED = 1, KNOCKOUT = 2 };
@@ -211,6 +273,183 @@ static void align_node_for_pointer(fz_display_node **node)
 		(*node) = (fz_display_node *)((ptr + FZ_POINTER_ALIGN_MOD - 1) & ~(FZ_POINTER_ALIGN_MOD-1));
 }
 
+/* While a list is being compacted, stroke states and text objects
+ * with equal contents are shared between nodes. The tables map an MD5
+ * digest of the contents to the first such object seen, which is
+ * borrowed from the list being compacted. */
+typedef struct fz_list_sharing
+{
+	fz_hash_table *strokes;
+	fz_hash_table *texts;
+} fz_list_sharing;
+
+static void
+digest_stroke_state(const fz_stroke_state *stroke, unsigned char digest[16])
+{
+	fz_md5 md5;
+	int v[5];
+
+	v[0] = stroke->start_cap;
+	v[1] = stroke->dash_cap;
+	v[2] = stroke->end_cap;
+	v[3] = stroke->linejoin;
+	v[4] = stroke->dash_len;
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, (const unsigned char *)v, sizeof v);
+	fz_md5_update(&md5, (const unsigned char *)&stroke->linewidth, sizeof(float));
+	fz_md5_update(&md5, (const unsigned char *)&stroke->miterlimit, sizeof(float));
+	fz_md5_update(&md5, (const unsigned char *)&stroke->dash_phase, sizeof(float));
+	fz_md5_update(&md5, (const unsigned char *)stroke->dash_list, stroke->dash_len * sizeof(float));
+	fz_md5_final(&md5, digest);
+}
+
+static int
+stroke_state_equal(const fz_stroke_state *a, const fz_stroke_state *b)
+{
+	return a->start_cap == b->start_cap &&
+		a->dash_cap == b->dash_cap &&
+		a->end_cap == b->end_cap &&
+		a->linejoin == b->linejoin &&
+		a->linewidth == b->linewidth &&
+		a->miterlimit == b->miterlimit &&
+		a->dash_phase == b->dash_phase &&
+		a->dash_len == b->dash_len &&
+		!memcmp(a->dash_list, b->dash_list, a->dash_len * sizeof(float));
+}
+
+static const fz_stroke_state *
+share_stroke_state(fz_context *ctx, fz_list_sharing *sharing, const fz_stroke_state *stroke)
+{
+	unsigned char digest[16];
+	const fz_stroke_state *found;
+
+	digest_stroke_state(stroke, digest);
+	found = fz_hash_find(ctx, sharing->strokes, digest);
+	if (found)
+		return stroke_state_equal(found, stroke) ? found : stroke;
+	fz_hash_insert(ctx, sharing->strokes, digest, (void *)stroke);
+	return stroke;
+}
+
+static void
+digest_text(const fz_text *text, unsigned char digest[16])
+{
+	fz_text_span *span;
+	fz_md5 md5;
+	int v[5];
+
+	fz_md5_init(&md5);
+	for (span = text->head; span; span = span->next)
+	{
+		v[0] = span->wmode;
+		v[1] = span->bidi_level;
+		v[2] = span->markup_dir;
+		v[3] = span->language;
+		v[4] = span->len;
+		fz_md5_update(&md5, (const unsigned char *)&span->font, sizeof span->font);
+		fz_md5_update(&md5, (const unsigned char *)&span->trm, sizeof span->trm);
+		fz_md5_update(&md5, (const unsigned char *)v, sizeof v);
+		fz_md5_update(&md5, (const unsigned char *)span->items, span->len * sizeof(fz_text_item));
+	}
+	fz_md5_final(&md5, digest);
+}
+
+static int
+text_equal(const fz_text *a, const fz_text *b)
+{
+	const fz_text_span *sa = a->head, *sb = b->head;
+
+	while (sa && sb)
+	{
+		if (sa->font != sb->font ||
+			memcmp(&sa->trm, &sb->trm, sizeof sa->trm) ||
+			sa->wmode != sb->wmode ||
+			sa->bidi_level != sb->bidi_level ||
+			sa->markup_dir != sb->markup_dir ||
+			sa->language != sb->language ||
+			sa->len != sb->len ||
+			memcmp(sa->items, sb->items, sa->len * sizeof(fz_text_item)))
+			return 0;
+		sa = sa->next;
+		sb = sb->next;
+	}
+	return sa == sb;
+}
+
+static const fz_text *
+share_text(fz_context *ctx, fz_list_sharing *sharing, const fz_text *text)
+{
+	unsigned char digest[16];
+	const fz_text *found;
+
+	digest_text(text, digest);
+	found = fz_hash_find(ctx, sharing->texts, digest);
+	if (found)
+		return text_equal(found, text) ? found : text;
+	fz_hash_insert(ctx, sharing->texts, digest, (void *)text);
+	return text;
+}
+
+static fz_text *
+keep_list_text(fz_context *ctx, fz_device *dev, const fz_text *text)
+{
+	fz_list_device *writer = (fz_list_device *)dev;
+
+	if (writer->sharing)
+		text = share_text(ctx, writer->sharing, text);
+	return fz_keep_text(ctx, text);
+}
+
+/* How many nodes an incremental list is recorded ahead of what has
+ * been published to players. */
+#define COMMIT_NODES 1024
+
+static void
+commit_display_list(fz_context *ctx, fz_display_list *list)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	list->committed = list->len;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+/* Players read the node array without holding the lock, so an
+ * incremental list cannot be grown with realloc. Copy it instead and
+ * keep the old array until the list is dropped. */
+static void
+grow_incremental_list(fz_context *ctx, fz_display_list *list, size_t newsize)
+{
+	fz_retired_nodes *old = NULL;
+	fz_display_node *nodes;
+
+	fz_var(old);
+
+	fz_try(ctx)
+	{
+		if (list->list)
+			old = fz_malloc_struct(ctx, fz_retired_nodes);
+		nodes = fz_malloc_array(ctx, newsize, fz_display_node);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, old);
+		fz_rethrow(ctx);
+	}
+
+	if (list->len)
+		memcpy(nodes, list->list, list->len * sizeof(fz_display_node));
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (old)
+	{
+		old->nodes = list->list;
+		old->max = list->max;
+		old->next = list->retired;
+		list->retired = old;
+	}
+	list->list = nodes;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 static unsigned char *
 fz_append_display_node(
 	fz_context *ctx,
@@ -247,6 +486,14 @@ fz_append_display_node(
 	size_t path_size = 0;
 	unsigned char *out_private = NULL;
 
+	/* Callers fill in private data after this returns, so publish
+	 * the nodes before this one, which are whole. */
+	if (list->incremental && list->len - list->committed >= COMMIT_NODES)
+		commit_display_list(ctx, list);
+
+	if (stroke && writer->sharing)
+		stroke = share_stroke_state(ctx, writer->sharing, stroke);
+
 	switch (cmd)
 	{
 	case FZ_CMD_CLIP_PATH:
@@ -296,8 +543,12 @@ fz_append_display_node(
 			{
 				if (update)
 				{
-					*update = fz_intersect_rect(*update, writer->stack[writer->top].rect);
-					local_rect = *update;
+					local_rect = fz_intersect_rect(*update, writer->stack[writer->top].rect);
+					/* Players may be reading committed nodes, so
+					 * leave their clip rects as they are; they
+					 * are only looser than they could be. */
+					if ((fz_display_node *)update >= list->list + list->committed)
+						*update = local_rect;
 					rect = &local_rect;
 				}
 				else
@@ -517,7 +768,8 @@ fz_append_display_node(
 		size += SIZE_IN_NODES(sizeof(fz_stroke_state *));
 		node.stroke = 1;
 	}
-	if (path && (writer->path == NULL || path != writer->path))
+	if (path && (writer->path == NULL || path != writer->path) &&
+		!(writer->sharing && fz_path_equal(ctx, path, writer->path)))
 	{
 		size_t max;
 
@@ -550,7 +802,10 @@ fz_append_display_node(
 
 		if (newsize < 256)
 			newsize = 256;
-		list->list = fz_realloc_array(ctx, list->list, newsize, fz_display_node);
+		if (list->incremental)
+			grow_incremental_list(ctx, list, newsize);
+		else
+			list->list = fz_realloc_array(ctx, list->list, newsize, fz_display_node);
 		list->max = newsize;
 		diff = (char *)(list->list) - (char *)old;
 		n = (writer->top < STACK_SIZE ? writer->top : STACK_SIZE);
@@ -824,7 +1079,7 @@ static void
 fz_list_fill_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matrix ctm,
 	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
 {
-	fz_text *cloned_text = fz_keep_text(ctx, text);
+	fz_text *cloned_text = keep_list_text(ctx, dev, text);
 	fz_try(ctx)
 	{
 		fz_rect rect = fz_bound_text(ctx, text, NULL, ctm);
@@ -854,7 +1109,7 @@ static void
 fz_list_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text, const fz_stroke_state *stroke, fz_matrix ctm,
 	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
 {
-	fz_text *cloned_text = fz_keep_text(ctx, text);
+	fz_text *cloned_text = keep_list_text(ctx, dev, text);
 	fz_try(ctx)
 	{
 		fz_rect rect = fz_bound_text(ctx, text, stroke, ctm);
@@ -883,7 +1138,7 @@ fz_list_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text, const
 static void
 fz_list_clip_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matrix ctm, fz_rect scissor)
 {
-	fz_text *cloned_text = fz_keep_text(ctx, text);
+	fz_text *cloned_text = keep_list_text(ctx, dev, text);
 	fz_try(ctx)
 	{
 		fz_rect rect = fz_bound_text(ctx, text, NULL, ctm);
@@ -913,7 +1168,7 @@ fz_list_clip_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matri
 static void
 fz_list_clip_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text, const fz_stroke_state *stroke, fz_matrix ctm, fz_rect scissor)
 {
-	fz_text *cloned_text = fz_keep_text(ctx, text);
+	fz_text *cloned_text = keep_list_text(ctx, dev, text);
 	fz_try(ctx)
 	{
 		fz_rect rect = fz_bound_text(ctx, text, stroke, ctm);
@@ -943,7 +1198,7 @@ fz_list_clip_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text, c
 static void
 fz_list_ignore_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matrix ctm)
 {
-	fz_text *cloned_text = fz_keep_text(ctx, text);
+	fz_text *cloned_text = keep_list_text(ctx, dev, text);
 	fz_try(ctx)
 	{
 		fz_rect rect = fz_bound_text(ctx, text, NULL, ctm);
@@ -1446,11 +1701,45 @@ fz_list_end_metatext(fz_context *ctx, fz_device *dev)
 		0); /* private_data_len */
 }
 
+/* Lists smaller than this (in nodes) are cheap enough to walk in full. */
+#define INDEX_MIN_NODES 4096
+
+static void
+finish_display_list(fz_context *ctx, fz_display_list *list)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	list->committed = list->len;
+	list->finished = 1;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+static void
+fz_list_close_device(fz_context *ctx, fz_device *dev)
+{
+	fz_list_device *writer = (fz_list_device *)dev;
+
+	/* The index only speeds up playback, so carry on without it. */
+	if (writer->list->len >= INDEX_MIN_NODES)
+	{
+		fz_try(ctx)
+			fz_index_display_list(ctx, writer->list);
+		fz_catch(ctx)
+			fz_warn(ctx, "cannot index display list");
+	}
+
+	if (writer->list->incremental)
+		finish_display_list(ctx, writer->list);
+}
+
 static void
 fz_list_drop_device(fz_context *ctx, fz_device *dev)
 {
 	fz_list_device *writer = (fz_list_device *)dev;
 
+	/* Recording was abandoned; let players finish with what there is. */
+	if (writer->list->incremental && !writer->list->finished)
+		finish_display_list(ctx, writer->list);
+
 	fz_drop_colorspace(ctx, writer->colorspace);
 	fz_drop_stroke_state(ctx, writer->stroke);
 	fz_drop_path(ctx, writer->path);
@@ -1502,6 +1791,7 @@ fz_new_list_device(fz_context *ctx, fz_display_list *list)
 	dev->super.begin_metatext = fz_list_begin_metatext;
 	dev->super.end_metatext = fz_list_end_metatext;
 
+	dev->super.close_device = fz_list_close_device;
 	dev->super.drop_device = fz_list_drop_device;
 
 	dev->list = fz_keep_display_list(ctx, list);
@@ -1517,6 +1807,16 @@ fz_new_list_device(fz_context *ctx, fz_display_list *list)
 	return &dev->super;
 }
 
+static void
+drop_list_index(fz_context *ctx, fz_list_index *index)
+{
+	if (!index)
+		return;
+	fz_free(ctx, index->chunks);
+	fz_free(ctx, index->groups);
+	fz_free(ctx, index);
+}
+
 static void
 fz_drop_display_list_imp(fz_context *ctx, fz_storable *list_)
 {
@@ -1620,6 +1920,14 @@ fz_drop_display_list_imp(fz_context *ctx, fz_storable *list_)
 		}
 		node = next;
 	}
+	while (list->retired)
+	{
+		fz_retired_nodes *next = list->retired->next;
+		fz_free(ctx, list->retired->nodes);
+		fz_free(ctx, list->retired);
+		list->retired = next;
+	}
+	drop_list_index(ctx, list->index);
 	fz_free(ctx, list->list);
 	fz_free(ctx, list);
 }
@@ -1633,6 +1941,19 @@ fz_new_display_list(fz_context *ctx, fz_rect mediabox)
 	list->mediabox = mediabox;
 	list->max = 0;
 	list->len = 0;
+	list->index = NULL;
+	list->incremental = 0;
+	list->finished = 0;
+	list->committed = 0;
+	list->retired = NULL;
+	return list;
+}
+
+fz_display_list *
+fz_new_incremental_display_list(fz_context *ctx, fz_rect mediabox)
+{
+	fz_display_list *list = fz_new_display_list(ctx, mediabox);
+	list->incremental = 1;
 	return list;
 }
 
@@ -1650,6 +1971,167 @@ fz_drop_display_list(fz_context *ctx, fz_display_list *list)
 	fz_defer_reap_end(ctx);
 }
 
+/* Magic to make display lists of pages storable. The document is not
+ * kept by the key; lists are purged from the store when it is
+ * dropped. */
+typedef struct
+{
+	int refs;
+	fz_document *doc;
+	int chapter;
+	int number;
+	int annotations;
+	int layers;
+} fz_display_list_key;
+
+static int
+fz_make_hash_display_list_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_display_list_key *key = (fz_display_list_key *)key_;
+	hash->u.pir.ptr = key->doc;
+	hash->u.pir.i = key->number;
+	hash->u.pir.r.x0 = key->chapter;
+	hash->u.pir.r.y0 = key->annotations;
+	hash->u.pir.r.x1 = key->layers;
+	hash->u.pir.r.y1 = 0;
+	return 1;
+}
+
+static void *
+fz_keep_display_list_key(fz_context *ctx, void *key_)
+{
+	fz_display_list_key *key = (fz_display_list_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_display_list_key(fz_context *ctx, void *key_)
+{
+	fz_display_list_key *key = (fz_display_list_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+		fz_free(ctx, key);
+}
+
+static int
+fz_cmp_display_list_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_display_list_key *k0 = (fz_display_list_key *)k0_;
+	fz_display_list_key *k1 = (fz_display_list_key *)k1_;
+	return k0->doc == k1->doc &&
+		k0->chapter == k1->chapter &&
+		k0->number == k1->number &&
+		k0->annotations == k1->annotations &&
+		k0->layers == k1->layers;
+}
+
+static void
+fz_format_display_list_key(fz_context *ctx, char *s, size_t n, void *key_)
+{
+	fz_display_list_key *key = (fz_display_list_key *)key_;
+	fz_snprintf(s, n, "(display list doc=%p, page=%d:%d, annots=%d, layers=%d)",
+		key->doc, key->chapter, key->number, key->annotations, key->layers);
+}
+
+static const fz_store_type fz_display_list_store_type =
+{
+	"fz_display_list",
+	fz_make_hash_display_list_key,
+	fz_keep_display_list_key,
+	fz_drop_display_list_key,
+	fz_cmp_display_list_key,
+	fz_format_display_list_key,
+	NULL
+};
+
+fz_display_list *
+fz_find_display_list(fz_context *ctx, fz_page *page, int annotations, int layers)
+{
+	fz_display_list_key key;
+
+	key.refs = 1;
+	key.doc = page->doc;
+	key.chapter = page->chapter;
+	key.number = page->number;
+	key.annotations = !!annotations;
+	key.layers = layers;
+	return fz_find_item(ctx, fz_drop_display_list_imp, &key, &fz_display_list_store_type);
+}
+
+fz_display_list *
+fz_store_display_list(fz_context *ctx, fz_display_list *list, fz_page *page, int annotations, int layers)
+{
+	fz_display_list_key *key = NULL;
+	fz_display_list *other;
+
+	/* Pages still loading progressively may draw differently later. */
+	if (page->incomplete)
+		return list;
+
+	fz_var(key);
+
+	fz_try(ctx)
+	{
+		key = fz_malloc_struct(ctx, fz_display_list_key);
+		key->refs = 1;
+		key->doc = page->doc;
+		key->chapter = page->chapter;
+		key->number = page->number;
+		key->annotations = !!annotations;
+		key->layers = layers;
+		other = fz_store_item(ctx, key, list, fz_display_list_size(ctx, list), &fz_display_list_store_type);
+		if (other)
+		{
+			fz_drop_display_list(ctx, list);
+			list = other;
+		}
+	}
+	fz_always(ctx)
+		fz_drop_display_list_key(ctx, key);
+	fz_catch(ctx)
+	{
+		/* Do nothing; the list is simply not stored. */
+	}
+
+	return list;
+}
+
+fz_display_list *
+fz_get_display_list(fz_context *ctx, fz_page *page, int annotations, int layers)
+{
+	fz_display_list *list = fz_find_display_list(ctx, page, annotations, layers);
+
+	if (list)
+		return list;
+
+	if (annotations)
+		list = fz_new_display_list_from_page(ctx, page);
+	else
+		list = fz_new_display_list_from_page_contents(ctx, page);
+
+	/* Once stored the list may be shared, so compact it now while
+	 * nobody else can see it. It is fine as it is if this fails. */
+	fz_try(ctx)
+		fz_compact_display_list(ctx, list);
+	fz_catch(ctx)
+		fz_warn(ctx, "cannot compact display list");
+
+	return fz_store_display_list(ctx, list, page, annotations, layers);
+}
+
+static int
+display_list_filter_store(fz_context *ctx, void *doc, void *key_)
+{
+	fz_display_list_key *key = (fz_display_list_key *)key_;
+
+	return (doc == key->doc);
+}
+
+void
+fz_purge_stored_display_lists(fz_context *ctx, fz_document *doc)
+{
+	fz_filter_store(ctx, display_list_filter_store, doc, &fz_display_list_store_type);
+}
+
 fz_rect
 fz_bound_display_list(fz_context *ctx, fz_display_list *list)
 {
@@ -1661,70 +2143,1070 @@ int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list)
 	return !list || list->len == 0;
 }
 
-void
-fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie)
+/* Occlusion culling.
+ *
+ * A node can be skipped if every pixel it could touch is later painted
+ * over by an opaque rectangle (a solid fill of a rectangular path, or
+ * an opaque image, with normal blending and no clip other than
+ * rectangular ones). Drawing is pixel local, so skipping the node (or
+ * the whole of a clip, mask, group or tile it starts) only changes
+ * pixels the rectangle then replaces.
+ *
+ * The rectangles are shrunk by a pixel inside their fully covered
+ * pixels to allow for antialiasing, grid fitting and minimum line
+ * widths, so the result is identical to running the whole list.
+ */
+
+#define MAX_OCCLUDERS 8
+
+typedef struct
 {
-	fz_display_node *node;
-	fz_display_node *node_end;
-	fz_display_node *next_node;
-	int clipped = 0;
-	int tiled = 0;
-	int progress = 0;
+	int start, end;
+	fz_irect bbox;
+} cull_span;
 
-	/* Current graphics state as unpacked from list */
-	fz_path *path = NULL;
-	float alpha = 1.0f;
-	fz_matrix ctm = fz_identity;
-	fz_stroke_state *stroke = NULL;
-	float color[FZ_MAX_COLORS] = { 0 };
-	fz_colorspace *colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
-	fz_color_params color_params;
-	fz_rect rect = { 0 };
+/* Latest ending first; unbalanced pushes (end -1) last of all. */
+static int
+cmp_span_end(const void *va, const void *vb)
+{
+	const cull_span *a = va;
+	const cull_span *b = vb;
+	return b->end - a->end;
+}
 
-	/* Transformed versions of graphic state entries */
-	fz_rect trans_rect;
-	fz_matrix trans_ctm;
-	int tile_skip_depth = 0;
+typedef struct
+{
+	int pos;
+	fz_irect area;
+} cull_occluder;
 
-	if (cookie)
+typedef struct
+{
+	int span;
+	int clear;
+	fz_rect clip;
+} cull_level;
+
+typedef struct
+{
+	int n, bad;
+	fz_point p[5];
+} rect_path_arg;
+
+static void
+rect_path_moveto(fz_context *ctx, void *arg_, float x, float y)
+{
+	rect_path_arg *arg = arg_;
+	if (arg->n > 0)
+		arg->bad = 1;
+	else
 	{
-		cookie->progress_max = list->len;
-		cookie->progress = 0;
+		arg->p[0].x = x;
+		arg->p[0].y = y;
+		arg->n = 1;
 	}
+}
 
-	color_params = fz_default_color_params;
-
-	node = list->list;
-	node_end = &list->list[list->len];
-	for (; node != node_end ; node = next_node)
+static void
+rect_path_lineto(fz_context *ctx, void *arg_, float x, float y)
+{
+	rect_path_arg *arg = arg_;
+	if (arg->n == 0 || arg->n == nelem(arg->p))
+		arg->bad = 1;
+	else if (x != arg->p[arg->n-1].x || y != arg->p[arg->n-1].y)
 	{
-		int empty;
-		fz_display_node n = *node;
+		arg->p[arg->n].x = x;
+		arg->p[arg->n].y = y;
+		arg->n++;
+	}
+}
 
-		next_node = node + n.size;
+static void
+rect_path_curveto(fz_context *ctx, void *arg_, float x1, float y1, float x2, float y2, float x3, float y3)
+{
+	rect_path_arg *arg = arg_;
+	arg->bad = 1;
+}
 
-		/* Check the cookie for aborting */
-		if (cookie)
-		{
-			if (cookie->abort)
-				break;
-			cookie->progress = progress;
-			progress += n.size;
-		}
+static void
+rect_path_closepath(fz_context *ctx, void *arg_)
+{
+}
 
-		node++;
-		if (n.rect)
-		{
-			rect = *(fz_rect *)node;
-			node += SIZE_IN_NODES(sizeof(fz_rect));
-		}
-		if (n.cs)
-		{
-			int i, en;
+static const fz_path_walker rect_path_walker =
+{
+	rect_path_moveto,
+	rect_path_lineto,
+	rect_path_curveto,
+	rect_path_closepath
+};
 
-			fz_drop_colorspace(ctx, colorspace);
-			switch (n.cs)
-			{
+/* Is the area filled by a path exactly an axis aligned rectangle? */
+static int
+path_is_rect(fz_context *ctx, const fz_path *path, fz_rect *rect)
+{
+	rect_path_arg arg = { 0 };
+	int i, first_horiz;
+
+	fz_walk_path(ctx, path, &rect_path_walker, &arg);
+	if (arg.n == 5 && arg.p[4].x == arg.p[0].x && arg.p[4].y == arg.p[0].y)
+		arg.n = 4;
+	if (arg.bad || arg.n != 4)
+		return 0;
+	first_horiz = (arg.p[0].y == arg.p[1].y);
+
+	/* Edges must be alternately horizontal and vertical. */
+	for (i = 0; i < 4; i++)
+	{
+		fz_point a = arg.p[i];
+		fz_point b = arg.p[(i+1) & 3];
+		int horiz = (a.y == b.y);
+		if (horiz == (a.x == b.x) || horiz != (first_horiz ^ (i & 1)))
+			return 0;
+	}
+
+	rect->x0 = fz_min(arg.p[0].x, arg.p[2].x);
+	rect->x1 = fz_max(arg.p[0].x, arg.p[2].x);
+	rect->y0 = fz_min(arg.p[0].y, arg.p[2].y);
+	rect->y1 = fz_max(arg.p[0].y, arg.p[2].y);
+	return 1;
+}
+
+static int
+image_is_opaque(fz_context *ctx, fz_image *image)
+{
+	fz_compressed_buffer *buffer;
+	fz_pixmap *tile;
+
+	if (image->imagemask || image->mask || image->use_colorkey || !image->colorspace)
+		return 0;
+
+	/* image->n does not count alpha, so only trust the images that
+	 * are known to have none: pixmaps without it, and the PDF
+	 * filter and JPEG formats, which cannot carry it. */
+	tile = fz_pixmap_image_tile(ctx, (fz_pixmap_image *)image);
+	if (tile)
+		return tile->alpha == 0;
+	buffer = fz_compressed_image_buffer(ctx, image);
+	if (!buffer)
+		return 0;
+	switch (buffer->params.type)
+	{
+	case FZ_IMAGE_RAW:
+	case FZ_IMAGE_FAX:
+	case FZ_IMAGE_FLATE:
+	case FZ_IMAGE_LZW:
+	case FZ_IMAGE_RLD:
+	case FZ_IMAGE_JPEG:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* The pixels all of which an opaque rectangle is sure to replace. */
+static fz_irect
+occluded_area(fz_rect r)
+{
+	fz_irect area;
+	area.x0 = (int)ceilf(r.x0) + 1;
+	area.y0 = (int)ceilf(r.y0) + 1;
+	area.x1 = (int)floorf(r.x1) - 1;
+	area.y1 = (int)floorf(r.y1) - 1;
+	return area;
+}
+
+static int
+irect_contains(fz_irect a, fz_irect b)
+{
+	return b.x0 >= a.x0 && b.y0 >= a.y0 && b.x1 <= a.x1 && b.y1 <= a.y1;
+}
+
+static int64_t
+irect_area(fz_irect r)
+{
+	return (int64_t)(r.x1 - r.x0) * (r.y1 - r.y0);
+}
+
+static int
+is_cullable(fz_display_command cmd)
+{
+	switch (cmd)
+	{
+	case FZ_CMD_RENDER_FLAGS:
+	case FZ_CMD_DEFAULT_COLORSPACES:
+	case FZ_CMD_BEGIN_LAYER:
+	case FZ_CMD_END_LAYER:
+	case FZ_CMD_BEGIN_STRUCTURE:
+	case FZ_CMD_END_STRUCTURE:
+	case FZ_CMD_BEGIN_METATEXT:
+	case FZ_CMD_END_METATEXT:
+	case FZ_CMD_IGNORE_TEXT:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+/* Walk the list, noting the spans that could be hidden and the opaque
+ * rectangles that could hide them. Then go through the spans from the
+ * one that ends last, keeping the largest rectangles drawn after the end
+ * of each, and mark the spans inside one of them. A rectangle drawn
+ * within a span (say, under the clip it pushes) cannot hide it. Returns a bitmap with a bit set for each hidden node, or NULL
+ * if nothing is hidden. */
+static unsigned char *
+find_hidden_nodes(fz_context *ctx, fz_display_list *list, fz_matrix top_ctm)
+{
+	fz_display_node *node, *node_end, *next_node;
+	fz_colorspace *colorspace = fz_device_gray(ctx);
+	fz_path *path = NULL;
+	fz_rect rect = { 0 };
+	fz_matrix ctm = fz_identity;
+	float alpha = 1.0f;
+
+	cull_span *spans = NULL;
+	cull_occluder *occ = NULL;
+	cull_level *levels = NULL;
+	cull_occluder active[MAX_OCCLUDERS];
+	unsigned char *hidden = NULL;
+	int nspans = 0, maxspans = 0;
+	int nocc = 0, maxocc = 0;
+	int depth = 0, maxdepth = 0;
+	int tiled = 0;
+	int nactive, i, j, k;
+
+	if (!fz_is_rectilinear(top_ctm) || list->len == 0)
+		return NULL;
+
+	fz_var(spans);
+	fz_var(occ);
+	fz_var(levels);
+	fz_var(hidden);
+
+	fz_try(ctx)
+	{
+		maxdepth = 16;
+		levels = fz_malloc_array(ctx, maxdepth, cull_level);
+		levels[0].span = -1;
+		levels[0].clear = 1;
+		levels[0].clip = fz_infinite_rect;
+
+		node = list->list;
+		node_end = &list->list[list->len];
+		for (; node != node_end; node = next_node)
+		{
+			fz_display_node n = *node;
+			int pos = node - list->list;
+			fz_matrix trans_ctm;
+			fz_rect r;
+			int opaque;
+
+			next_node = node + n.size;
+
+			node++;
+			if (n.rect)
+			{
+				rect = *(fz_rect *)node;
+				node += SIZE_IN_NODES(sizeof(fz_rect));
+			}
+			if (n.cs)
+			{
+				switch (n.cs)
+				{
+				default:
+				case CS_GRAY_0:
+				case CS_GRAY_1:
+					colorspace = fz_device_gray(ctx);
+					break;
+				case CS_RGB_0:
+				case CS_RGB_1:
+					colorspace = fz_device_rgb(ctx);
+					break;
+				case CS_CMYK_0:
+				case CS_CMYK_1:
+					colorspace = fz_device_cmyk(ctx);
+					break;
+				case CS_OTHER_0:
+					align_node_for_pointer(&node);
+					colorspace = *(fz_colorspace **)(node);
+					node += SIZE_IN_NODES(sizeof(fz_colorspace *));
+					break;
+				}
+			}
+			if (n.color)
+				node += SIZE_IN_NODES(fz_colorspace_n(ctx, colorspace) * sizeof(float));
+			if (n.alpha)
+			{
+				switch (n.alpha)
+				{
+				default:
+				case ALPHA_0:
+					alpha = 0.0f;
+					break;
+				case ALPHA_1:
+					alpha = 1.0f;
+					break;
+				case ALPHA_PRESENT:
+					alpha = *(float *)node;
+					node += SIZE_IN_NODES(sizeof(float));
+					break;
+				}
+			}
+			if (n.ctm != 0)
+			{
+				float *packed_ctm = (float *)node;
+				if (n.ctm & CTM_CHANGE_AD)
+				{
+					ctm.a = *packed_ctm++;
+					ctm.d = *packed_ctm++;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+				if (n.ctm & CTM_CHANGE_BC)
+				{
+					ctm.b = *packed_ctm++;
+					ctm.c = *packed_ctm++;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+				if (n.ctm & CTM_CHANGE_EF)
+				{
+					ctm.e = *packed_ctm++;
+					ctm.f = *packed_ctm;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+			}
+			if (n.stroke)
+			{
+				align_node_for_pointer(&node);
+				node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
+			}
+			if (n.path)
+			{
+				align_node_for_pointer(&node);
+				path = (fz_path *)node;
+				node += SIZE_IN_NODES(fz_packed_path_size(path));
+			}
+
+			/* Nodes in a tile are in pattern space and repeated; only
+			 * the tile as a whole can be hidden. */
+			if (tiled)
+			{
+				if (n.cmd == FZ_CMD_BEGIN_TILE)
+					tiled++;
+				else if (n.cmd == FZ_CMD_END_TILE && --tiled == 0)
+					goto pop;
+				continue;
+			}
+
+			switch (n.cmd)
+			{
+			case FZ_CMD_POP_CLIP:
+			case FZ_CMD_END_GROUP:
+			case FZ_CMD_END_TILE:
+pop:
+				if (depth == 0)
+					break;
+				if (levels[depth].span >= 0)
+					spans[levels[depth].span].end = pos;
+				depth--;
+				break;
+
+			case FZ_CMD_CLIP_PATH:
+			case FZ_CMD_CLIP_STROKE_PATH:
+			case FZ_CMD_CLIP_TEXT:
+			case FZ_CMD_CLIP_STROKE_TEXT:
+			case FZ_CMD_CLIP_IMAGE_MASK:
+			case FZ_CMD_BEGIN_MASK:
+			case FZ_CMD_BEGIN_GROUP:
+			case FZ_CMD_BEGIN_TILE:
+				if (depth + 1 == maxdepth)
+				{
+					levels = fz_realloc_array(ctx, levels, maxdepth * 2, cull_level);
+					maxdepth *= 2;
+				}
+				levels[depth+1].span = nspans;
+				levels[depth+1].clear = 0;
+				levels[depth+1].clip = fz_empty_rect;
+				trans_ctm = fz_concat(ctm, top_ctm);
+				if (n.cmd == FZ_CMD_CLIP_PATH && levels[depth].clear && fz_is_rectilinear(trans_ctm) && path_is_rect(ctx, path, &r))
+				{
+					levels[depth+1].clear = 1;
+					levels[depth+1].clip = fz_intersect_rect(levels[depth].clip, fz_transform_rect(r, trans_ctm));
+				}
+				depth++;
+				if (n.cmd == FZ_CMD_BEGIN_TILE)
+				{
+					/* The area a tile is run with is not reliably
+					 * in device space, so tiles are never hidden. */
+					levels[depth].span = -1;
+					tiled = 1;
+					break;
+				}
+				/* fall through */
+
+			case FZ_CMD_FILL_PATH:
+			case FZ_CMD_STROKE_PATH:
+			case FZ_CMD_FILL_TEXT:
+			case FZ_CMD_STROKE_TEXT:
+			case FZ_CMD_FILL_SHADE:
+			case FZ_CMD_FILL_IMAGE:
+			case FZ_CMD_FILL_IMAGE_MASK:
+				if (nspans == maxspans)
+				{
+					int newmax = maxspans ? maxspans * 2 : 256;
+					spans = fz_realloc_array(ctx, spans, newmax, cull_span);
+					maxspans = newmax;
+				}
+				spans[nspans].start = pos;
+				/* Pushes are open until their pop is seen. */
+				spans[nspans].end = depth > 0 && levels[depth].span == nspans ? -1 : pos;
+				spans[nspans].bbox = fz_irect_from_rect(fz_transform_rect(rect, top_ctm));
+				nspans++;
+				break;
+
+			default:
+				break;
+			}
+
+			/* Is this an opaque rectangle painted straight onto the page? */
+			if (!levels[depth].clear || alpha != 1.0f || ((n.flags >> OP) & 1))
+				continue;
+			trans_ctm = fz_concat(ctm, top_ctm);
+			if (!fz_is_rectilinear(trans_ctm))
+				continue;
+			if (n.cmd == FZ_CMD_FILL_PATH)
+				opaque = path_is_rect(ctx, path, &r);
+			else if (n.cmd == FZ_CMD_FILL_IMAGE)
+			{
+				align_node_for_pointer(&node);
+				opaque = image_is_opaque(ctx, *(fz_image **)node);
+				r = fz_unit_rect;
+			}
+			else
+				opaque = 0;
+			if (!opaque)
+				continue;
+
+			if (nocc == maxocc)
+			{
+				int newmax = maxocc ? maxocc * 2 : 64;
+				occ = fz_realloc_array(ctx, occ, newmax, cull_occluder);
+				maxocc = newmax;
+			}
+			occ[nocc].pos = pos;
+			occ[nocc].area = occluded_area(fz_intersect_rect(levels[depth].clip, fz_transform_rect(r, trans_ctm)));
+			if (!fz_is_empty_irect(occ[nocc].area))
+				nocc++;
+		}
+
+		/* Go back from the end, marking the spans that a rectangle
+		 * drawn after them hides. */
+		if (nocc > 0)
+			qsort(spans, nspans, sizeof *spans, cmp_span_end);
+		nactive = 0;
+		j = nocc - 1;
+		for (i = 0; i < nspans && nocc > 0; i++)
+		{
+			cull_span *span = &spans[i];
+
+			/* A push without a pop must be run, or neither is. */
+			if (span->end < 0)
+				break;
+
+			for (; j >= 0 && occ[j].pos > span->end; j--)
+			{
+				if (nactive < MAX_OCCLUDERS)
+					active[nactive++] = occ[j];
+				else
+				{
+					int smallest = 0;
+					for (k = 1; k < nactive; k++)
+						if (irect_area(active[k].area) < irect_area(active[smallest].area))
+							smallest = k;
+					if (irect_area(occ[j].area) > irect_area(active[smallest].area))
+						active[smallest] = occ[j];
+				}
+			}
+
+			if (fz_is_empty_irect(span->bbox))
+				continue;
+			for (k = 0; k < nactive; k++)
+				if (irect_contains(active[k].area, span->bbox))
+					break;
+			if (k == nactive)
+				continue;
+
+			if (!hidden)
+				hidden = fz_calloc(ctx, (list->len + 7) >> 3, 1);
+			for (k = span->start; k <= span->end; k++)
+				hidden[k >> 3] |= 1 << (k & 7);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, spans);
+		fz_free(ctx, occ);
+		fz_free(ctx, levels);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, hidden);
+		fz_rethrow(ctx);
+	}
+
+	return hidden;
+}
+
+/* Spatial index.
+ *
+ * Playback of a small area of a large list (a tile, a band, a zoomed in
+ * view) spends most of its time decoding nodes only to find they lie
+ * outside the scissor. The index lets it skip a whole chunk of nodes
+ * with one test instead.
+ *
+ * A chunk can only be skipped if everything in it would have been
+ * culled anyway: its clips, masks and groups must be balanced within
+ * it (so skipping them leaves the nesting as it was), and it must not
+ * contain anything the run loop never culls (tiles, render flags,
+ * default colorspaces, layers, structure and metatext).
+ */
+
+#define CHUNK_NODES 32
+#define MAX_CHUNK_NODES (4 * CHUNK_NODES)
+#define GROUP_CHUNKS 16
+
+static int
+is_push(fz_display_command cmd)
+{
+	switch (cmd)
+	{
+	case FZ_CMD_CLIP_PATH:
+	case FZ_CMD_CLIP_STROKE_PATH:
+	case FZ_CMD_CLIP_TEXT:
+	case FZ_CMD_CLIP_STROKE_TEXT:
+	case FZ_CMD_CLIP_IMAGE_MASK:
+	case FZ_CMD_BEGIN_MASK:
+	case FZ_CMD_BEGIN_GROUP:
+	case FZ_CMD_BEGIN_TILE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int
+is_pop(fz_display_command cmd)
+{
+	return cmd == FZ_CMD_POP_CLIP || cmd == FZ_CMD_END_GROUP || cmd == FZ_CMD_END_TILE;
+}
+
+void
+fz_index_display_list(fz_context *ctx, fz_display_list *list)
+{
+	fz_display_node *node, *node_end, *next_node;
+	fz_colorspace *colorspace = fz_device_gray(ctx);
+	fz_stroke_state *stroke = NULL;
+	float color[FZ_MAX_COLORS] = { 0 };
+	fz_matrix ctm = fz_identity;
+	fz_rect rect = { 0 };
+	float alpha = 1.0f;
+	int path = -1;
+
+	fz_list_index *index = NULL;
+	fz_list_chunk *chunk;
+	int max = 0, cur = -1;
+	int depth = 0, start_depth = 0, tiled = 0, count = 0;
+	int i, j, ngroups;
+
+	/* Other threads may be playing the list with the index it has, so
+	 * never replace one; see display-list.h. */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	index = list->index;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (index || list->len == 0)
+		return;
+
+	fz_var(index);
+
+	fz_try(ctx)
+	{
+		index = fz_malloc_struct(ctx, fz_list_index);
+		index->len = list->len;
+
+		node = list->list;
+		node_end = &list->list[list->len];
+		for (; node <= node_end; node = next_node)
+		{
+			fz_display_node n;
+
+			/* Close the current chunk at a balanced point once it
+			 * is big enough, or before a pop that would take it
+			 * below the depth it started at. */
+			if (cur >= 0 && (node == node_end || count >= MAX_CHUNK_NODES ||
+				(depth == start_depth && (count >= CHUNK_NODES || is_pop(node->cmd)))))
+			{
+				if (depth != start_depth)
+					index->chunks[cur].skippable = 0;
+				cur = -1;
+			}
+
+			/* Start a new chunk, recording the state on entry. The
+			 * one past the end records the state after the last
+			 * node. */
+			if (cur < 0)
+			{
+				if (index->count == max)
+				{
+					max = max ? max * 2 : 64;
+					index->chunks = fz_realloc_array(ctx, index->chunks, max + 1, fz_list_chunk);
+				}
+				cur = index->count;
+				chunk = &index->chunks[cur];
+				chunk->pos = node - list->list;
+				chunk->skippable = !tiled;
+				chunk->bbox = fz_empty_rect;
+				chunk->rect = rect;
+				chunk->colorspace = colorspace;
+				chunk->stroke = stroke;
+				chunk->path = path;
+				chunk->alpha = alpha;
+				chunk->ctm = ctm;
+				memcpy(chunk->color, color, sizeof color);
+				start_depth = depth;
+				count = 0;
+				if (node == node_end)
+				{
+					chunk->skippable = 0;
+					break;
+				}
+				index->count++;
+			}
+			chunk = &index->chunks[cur];
+
+			n = *node;
+			next_node = node + n.size;
+
+			node++;
+			if (n.rect)
+			{
+				rect = *(fz_rect *)node;
+				node += SIZE_IN_NODES(sizeof(fz_rect));
+			}
+			if (n.cs)
+			{
+				int k, en;
+
+				switch (n.cs)
+				{
+				default:
+				case CS_GRAY_0:
+					colorspace = fz_device_gray(ctx);
+					color[0] = 0.0f;
+					break;
+				case CS_GRAY_1:
+					colorspace = fz_device_gray(ctx);
+					color[0] = 1.0f;
+					break;
+				case CS_RGB_0:
+					colorspace = fz_device_rgb(ctx);
+					color[0] = 0.0f;
+					color[1] = 0.0f;
+					color[2] = 0.0f;
+					break;
+				case CS_RGB_1:
+					colorspace = fz_device_rgb(ctx);
+					color[0] = 1.0f;
+					color[1] = 1.0f;
+					color[2] = 1.0f;
+					break;
+				case CS_CMYK_0:
+					colorspace = fz_device_cmyk(ctx);
+					color[0] = 0.0f;
+					color[1] = 0.0f;
+					color[2] = 0.0f;
+					color[3] = 0.0f;
+					break;
+				case CS_CMYK_1:
+					colorspace = fz_device_cmyk(ctx);
+					color[0] = 0.0f;
+					color[1] = 0.0f;
+					color[2] = 0.0f;
+					color[3] = 1.0f;
+					break;
+				case CS_OTHER_0:
+					align_node_for_pointer(&node);
+					colorspace = *(fz_colorspace **)(node);
+					node += SIZE_IN_NODES(sizeof(fz_colorspace *));
+					en = fz_colorspace_n(ctx, colorspace);
+					for (k = 0; k < en; k++)
+						color[k] = 0.0f;
+					break;
+				}
+			}
+			if (n.color)
+			{
+				int nc = fz_colorspace_n(ctx, colorspace);
+				memcpy(color, (float *)node, nc * sizeof(float));
+				node += SIZE_IN_NODES(nc * sizeof(float));
+			}
+			if (n.alpha)
+			{
+				switch (n.alpha)
+				{
+				default:
+				case ALPHA_0:
+					alpha = 0.0f;
+					break;
+				case ALPHA_1:
+					alpha = 1.0f;
+					break;
+				case ALPHA_PRESENT:
+					alpha = *(float *)node;
+					node += SIZE_IN_NODES(sizeof(float));
+					break;
+				}
+			}
+			if (n.ctm != 0)
+			{
+				float *packed_ctm = (float *)node;
+				if (n.ctm & CTM_CHANGE_AD)
+				{
+					ctm.a = *packed_ctm++;
+					ctm.d = *packed_ctm++;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+				if (n.ctm & CTM_CHANGE_BC)
+				{
+					ctm.b = *packed_ctm++;
+					ctm.c = *packed_ctm++;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+				if (n.ctm & CTM_CHANGE_EF)
+				{
+					ctm.e = *packed_ctm++;
+					ctm.f = *packed_ctm;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+			}
+			if (n.stroke)
+			{
+				align_node_for_pointer(&node);
+				stroke = *(fz_stroke_state **)node;
+				node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
+			}
+			if (n.path)
+			{
+				align_node_for_pointer(&node);
+				path = node - list->list;
+				node += SIZE_IN_NODES(fz_packed_path_size((fz_path *)node));
+			}
+
+			switch (n.cmd)
+			{
+			case FZ_CMD_BEGIN_TILE:
+				tiled++;
+				chunk->skippable = 0;
+				break;
+			case FZ_CMD_END_TILE:
+				tiled--;
+				/* fallthrough */
+			case FZ_CMD_RENDER_FLAGS:
+			case FZ_CMD_DEFAULT_COLORSPACES:
+			case FZ_CMD_BEGIN_LAYER:
+			case FZ_CMD_END_LAYER:
+			case FZ_CMD_BEGIN_STRUCTURE:
+			case FZ_CMD_END_STRUCTURE:
+			case FZ_CMD_BEGIN_METATEXT:
+			case FZ_CMD_END_METATEXT:
+				chunk->skippable = 0;
+				break;
+			case FZ_CMD_POP_CLIP:
+			case FZ_CMD_END_MASK:
+			case FZ_CMD_END_GROUP:
+				/* Culled along with their push. */
+				break;
+			default:
+				chunk->bbox = fz_union_rect(chunk->bbox, rect);
+				break;
+			}
+
+			if (is_push(n.cmd))
+				depth++;
+			else if (is_pop(n.cmd))
+				depth--;
+			count++;
+
+			/* A pop out of the depth the chunk started at is a
+			 * chunk of its own, never skipped. */
+			if (depth < start_depth)
+			{
+				chunk->skippable = 0;
+				cur = -1;
+			}
+		}
+
+		ngroups = (index->count + GROUP_CHUNKS - 1) / GROUP_CHUNKS;
+		index->groups = fz_malloc_array(ctx, ngroups, fz_list_chunk_group);
+		for (i = 0; i < ngroups; i++)
+		{
+			fz_list_chunk_group *group = &index->groups[i];
+			group->skippable = 1;
+			group->bbox = fz_empty_rect;
+			for (j = i * GROUP_CHUNKS; j < index->count && j < (i + 1) * GROUP_CHUNKS; j++)
+			{
+				group->skippable &= index->chunks[j].skippable;
+				group->bbox = fz_union_rect(group->bbox, index->chunks[j].bbox);
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		drop_list_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+
+	/* Someone else may have beaten us to it. */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (!list->index)
+	{
+		list->index = index;
+		index = NULL;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	drop_list_index(ctx, index);
+}
+
+static int
+chunk_is_hidden(fz_rect bbox, fz_matrix top_ctm, fz_rect scissor)
+{
+	if (!fz_is_valid_rect(bbox))
+		return 1;
+	return !fz_is_valid_rect(fz_intersect_rect(fz_transform_rect(bbox, top_ctm), scissor));
+}
+
+/* Find the first chunk from chunk c on that cannot be skipped. Whole
+ * groups are tested when c starts one. */
+static int
+skip_hidden_chunks(fz_list_index *index, int c, fz_matrix top_ctm, fz_rect scissor)
+{
+	while (c < index->count)
+	{
+		if (c % GROUP_CHUNKS == 0)
+		{
+			fz_list_chunk_group *group = &index->groups[c / GROUP_CHUNKS];
+			if (group->skippable && chunk_is_hidden(group->bbox, top_ctm, scissor))
+			{
+				c += GROUP_CHUNKS;
+				continue;
+			}
+		}
+		if (!index->chunks[c].skippable || !chunk_is_hidden(index->chunks[c].bbox, top_ctm, scissor))
+			break;
+		c++;
+	}
+	return c < index->count ? c : index->count;
+}
+
+/* Pick up the graphics state recorded at the start of a chunk, as if
+ * the nodes before it had been decoded. */
+static void
+restore_chunk_state(fz_context *ctx, fz_display_node *nodes, const fz_list_chunk *chunk,
+	fz_rect *rect, fz_colorspace **colorspace, float *color, float *alpha,
+	fz_matrix *ctm, fz_stroke_state **stroke, fz_path **path)
+{
+	*rect = chunk->rect;
+	if (*colorspace != chunk->colorspace)
+	{
+		fz_drop_colorspace(ctx, *colorspace);
+		*colorspace = fz_keep_colorspace(ctx, chunk->colorspace);
+	}
+	memcpy(color, chunk->color, sizeof chunk->color);
+	*alpha = chunk->alpha;
+	*ctm = chunk->ctm;
+	if (*stroke != chunk->stroke)
+	{
+		fz_drop_stroke_state(ctx, *stroke);
+		*stroke = fz_keep_stroke_state(ctx, chunk->stroke);
+	}
+	*path = chunk->path < 0 ? NULL : (fz_path *)(nodes + chunk->path);
+}
+
+/* The nodes of a list that can be played: all of them, or for an
+ * incremental list those committed so far. Returns 1 if the list is
+ * finished, so that no more will be added. */
+static int
+lock_display_list_nodes(fz_context *ctx, fz_display_list *list, fz_display_node **nodes, size_t *len, fz_list_index **index)
+{
+	int finished;
+
+	/* fz_index_display_list may add an index at any time. */
+	if (!list->incremental)
+	{
+		*nodes = list->list;
+		*len = list->len;
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		*index = list->index;
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		return 1;
+	}
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	*nodes = list->list;
+	*len = list->committed;
+	finished = list->finished;
+	/* The index is made as recording finishes. */
+	*index = finished ? list->index : NULL;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return finished;
+}
+
+/* Where playback of an incremental list got to, and the graphics state
+ * and culling state there, so that it can carry on from that node once
+ * more have been committed. */
+struct fz_display_list_playback
+{
+	fz_display_list *list;
+	fz_device *dev;
+	fz_matrix top_ctm;
+	fz_rect scissor;
+
+	size_t pos;
+	int clipped;
+	int tiled;
+	int tile_skip_depth;
+	fz_path *path;
+	float alpha;
+	fz_matrix ctm;
+	fz_stroke_state *stroke;
+	float color[FZ_MAX_COLORS];
+	fz_colorspace *colorspace;
+	fz_rect rect;
+};
+
+/* Run the nodes of a list through a device; with a playback, only the
+ * nodes from where it stopped last time to the end of those committed,
+ * saving the state in it again at the end. An abort set in parent is
+ * copied into cookie as each node is reached. Returns 1 if playback
+ * reached the end of a finished list. */
+static int
+run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie, const fz_cookie *parent, const unsigned char *hidden, fz_display_list_playback *playback)
+{
+	fz_display_node *nodes;
+	fz_display_node *node;
+	fz_display_node *node_end;
+	fz_display_node *next_node;
+	size_t len;
+	int finished;
+	int pos;
+	int clipped = 0;
+	int tiled = 0;
+	int progress = 0;
+
+	/* Current graphics state as unpacked from list. The path is
+	 * packed in the list, so is not kept. */
+	fz_path *path = NULL;
+	float alpha = 1.0f;
+	fz_matrix ctm = fz_identity;
+	fz_stroke_state *stroke = NULL;
+	float color[FZ_MAX_COLORS] = { 0 };
+	fz_colorspace *colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
+	fz_color_params color_params;
+	fz_rect rect = { 0 };
+
+	/* Transformed versions of graphic state entries */
+	fz_rect trans_rect;
+	fz_matrix trans_ctm;
+	int tile_skip_depth = 0;
+
+	/* Next chunk of the spatial index to test, if any */
+	fz_list_index *index;
+	fz_display_node *chunk_node = NULL;
+	int chunk = 0;
+
+	finished = lock_display_list_nodes(ctx, list, &nodes, &len, &index);
+
+	if (playback)
+	{
+		/* Take over the references the playback holds. */
+		progress = (int)playback->pos;
+		clipped = playback->clipped;
+		tiled = playback->tiled;
+		tile_skip_depth = playback->tile_skip_depth;
+		path = playback->path;
+		alpha = playback->alpha;
+		ctm = playback->ctm;
+		fz_drop_stroke_state(ctx, stroke);
+		stroke = playback->stroke;
+		playback->stroke = NULL;
+		memcpy(color, playback->color, sizeof color);
+		fz_drop_colorspace(ctx, colorspace);
+		colorspace = playback->colorspace;
+		playback->colorspace = NULL;
+		rect = playback->rect;
+		index = NULL;
+	}
+
+	if (cookie)
+	{
+		cookie->progress_max = len;
+		cookie->progress = progress;
+	}
+
+	color_params = fz_default_color_params;
+
+	if (index && index->len <= len && !fz_is_infinite_rect(scissor))
+		chunk_node = nodes;
+
+	node = nodes + progress;
+	node_end = nodes + len;
+	for (; node != node_end ; node = next_node)
+	{
+		int empty;
+		fz_display_node n;
+
+		if (node == chunk_node)
+		{
+			int c = skip_hidden_chunks(index, chunk, top_ctm, scissor);
+			if (c > chunk)
+			{
+				restore_chunk_state(ctx, nodes, &index->chunks[c], &rect, &colorspace, color, &alpha, &ctm, &stroke, &path);
+				node = nodes + index->chunks[c].pos;
+				progress = node - nodes;
+			}
+			chunk = c + 1;
+			chunk_node = chunk <= index->count ? nodes + index->chunks[chunk].pos : NULL;
+			if (node == node_end)
+				break;
+		}
+
+		n = *node;
+		next_node = node + n.size;
+		pos = node - nodes;
+
+		/* Check the cookie for aborting */
+		if (cookie)
+		{
+			if (parent && parent->abort)
+				cookie->abort = 1;
+			if (cookie->abort)
+				break;
+			cookie->progress = progress;
+			progress += n.size;
+		}
+
+		node++;
+		if (n.rect)
+		{
+			rect = *(fz_rect *)node;
+			node += SIZE_IN_NODES(sizeof(fz_rect));
+		}
+		if (n.cs)
+		{
+			int i, en;
+
+			fz_drop_colorspace(ctx, colorspace);
+			switch (n.cs)
+			{
 			default:
 			case CS_GRAY_0:
 				colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
@@ -1825,11 +3307,13 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_m
 		if (n.path)
 		{
 			align_node_for_pointer(&node);
-			fz_drop_path(ctx, path);
-			path = fz_keep_path(ctx, (fz_path *)node);
+			path = (fz_path *)node;
 			node += SIZE_IN_NODES(fz_packed_path_size(path));
 		}
 
+		if (hidden && (hidden[pos >> 3] & (1 << (pos & 7))) && is_cullable(n.cmd))
+			continue;
+
 		if (tile_skip_depth > 0)
 		{
 			if (n.cmd == FZ_CMD_BEGIN_TILE)
@@ -2046,13 +3530,293 @@ visible:
 			if (cookie)
 				cookie->errors++;
 			if (fz_caught(ctx) == FZ_ERROR_ABORT)
+			{
+				node = next_node;
 				break;
+			}
 			fz_warn(ctx, "Ignoring error during interpretation");
 		}
 	}
-	fz_drop_colorspace(ctx, colorspace);
-	fz_drop_stroke_state(ctx, stroke);
-	fz_drop_path(ctx, path);
 	if (cookie)
 		cookie->progress = progress;
+
+	if (playback)
+	{
+		/* Hand the references back for next time. */
+		playback->pos = node - nodes;
+		playback->clipped = clipped;
+		playback->tiled = tiled;
+		playback->tile_skip_depth = tile_skip_depth;
+		playback->path = path;
+		playback->alpha = alpha;
+		playback->ctm = ctm;
+		playback->stroke = stroke;
+		memcpy(playback->color, color, sizeof color);
+		playback->colorspace = colorspace;
+		playback->rect = rect;
+	}
+	else
+	{
+		fz_drop_colorspace(ctx, colorspace);
+		fz_drop_stroke_state(ctx, stroke);
+	}
+
+	return finished && node == node_end;
+}
+
+void
+fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie)
+{
+	(void)run_display_list(ctx, list, dev, top_ctm, scissor, cookie, NULL, NULL, NULL);
+}
+
+void
+fz_run_display_list_band(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie, const fz_cookie *parent)
+{
+	(void)run_display_list(ctx, list, dev, top_ctm, scissor, cookie, parent, NULL, NULL);
+}
+
+void
+fz_run_display_list_culled(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie)
+{
+	unsigned char *hidden = NULL;
+	fz_display_node *nodes;
+	fz_list_index *index;
+	size_t len;
+
+	/* There is nothing to look ahead at in a list still recording. */
+	if (lock_display_list_nodes(ctx, list, &nodes, &len, &index))
+		hidden = find_hidden_nodes(ctx, list, top_ctm);
+
+	fz_try(ctx)
+		(void)run_display_list(ctx, list, dev, top_ctm, scissor, cookie, NULL, hidden, NULL);
+	fz_always(ctx)
+		fz_free(ctx, hidden);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+fz_display_list_playback *
+fz_new_display_list_playback(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix ctm, fz_rect scissor)
+{
+	fz_display_list_playback *playback = fz_malloc_struct(ctx, fz_display_list_playback);
+
+	playback->list = fz_keep_display_list(ctx, list);
+	playback->dev = fz_keep_device(ctx, dev);
+	playback->top_ctm = ctm;
+	playback->scissor = scissor;
+	playback->alpha = 1.0f;
+	playback->ctm = fz_identity;
+	playback->colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
+
+	return playback;
+}
+
+int
+fz_continue_display_list_playback(fz_context *ctx, fz_display_list_playback *playback, fz_cookie *cookie)
+{
+	return run_display_list(ctx, playback->list, playback->dev, playback->top_ctm, playback->scissor, cookie, NULL, NULL, playback);
+}
+
+void
+fz_drop_display_list_playback(fz_context *ctx, fz_display_list_playback *playback)
+{
+	if (!playback)
+		return;
+	fz_drop_colorspace(ctx, playback->colorspace);
+	fz_drop_stroke_state(ctx, playback->stroke);
+	fz_drop_device(ctx, playback->dev);
+	fz_drop_display_list(ctx, playback->list);
+	fz_free(ctx, playback);
+}
+
+void
+fz_compact_display_list(fz_context *ctx, fz_display_list *list)
+{
+	fz_list_sharing sharing = { NULL, NULL };
+	fz_display_list *copy;
+	fz_device *dev = NULL;
+	fz_cookie cookie = { 0 };
+	fz_display_node *nodes;
+	fz_list_index *index;
+	size_t len, max;
+
+	if (list->len == 0)
+		return;
+
+	fz_var(dev);
+
+	copy = fz_new_display_list(ctx, list->mediabox);
+	fz_try(ctx)
+	{
+		sharing.strokes = fz_new_hash_table(ctx, 64, 16, -1, NULL);
+		sharing.texts = fz_new_hash_table(ctx, 256, 16, -1, NULL);
+
+		/* Rebuild the list by playing it back into a list device,
+		 * which packs it afresh with the objects shared. */
+		dev = fz_new_list_device(ctx, copy);
+		((fz_list_device *)dev)->sharing = &sharing;
+		fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, &cookie);
+		fz_close_device(ctx, dev);
+		fz_drop_device(ctx, dev);
+		dev = NULL;
+		if (cookie.errors)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot compact display list");
+
+		if (copy->len < copy->max)
+		{
+			copy->list = fz_realloc_array(ctx, copy->list, copy->len, fz_display_node);
+			copy->max = copy->len;
+		}
+
+		/* Swap the new nodes into the list; the old ones go with
+		 * the copy. */
+		nodes = list->list; len = list->len; max = list->max; index = list->index;
+		list->list = copy->list; list->len = copy->len; list->max = copy->max; list->index = copy->index;
+		copy->list = nodes; copy->len = len; copy->max = max; copy->index = index;
+
+		/* Nobody can be playing an incremental list while it is
+		 * compacted, so its outgrown arrays can go too. */
+		list->committed = list->len;
+		copy->retired = list->retired;
+		list->retired = NULL;
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_display_list(ctx, copy);
+		fz_drop_hash_table(ctx, sharing.strokes);
+		fz_drop_hash_table(ctx, sharing.texts);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static size_t
+stroke_state_size(const fz_stroke_state *stroke)
+{
+	size_t size = sizeof(*stroke);
+	if (stroke->dash_len > (int)nelem(stroke->dash_list))
+		size += (stroke->dash_len - nelem(stroke->dash_list)) * sizeof(float);
+	return size;
+}
+
+static size_t
+text_size(const fz_text *text)
+{
+	const fz_text_span *span;
+	size_t size = sizeof(*text);
+	for (span = text->head; span; span = span->next)
+		size += sizeof(*span) + span->cap * sizeof(fz_text_item);
+	return size;
+}
+
+size_t
+fz_display_list_size(fz_context *ctx, fz_display_list *list)
+{
+	fz_display_node *node = list->list;
+	fz_display_node *node_end = list->list + list->len;
+	fz_hash_table *seen;
+	fz_retired_nodes *retired;
+	size_t size;
+	int cs_n = 1;
+
+	size = sizeof(*list) + list->max * sizeof(fz_display_node);
+	for (retired = list->retired; retired; retired = retired->next)
+		size += sizeof(*retired) + retired->max * sizeof(fz_display_node);
+	if (list->index)
+	{
+		size += sizeof(*list->index);
+		size += (list->index->count + 1) * sizeof(fz_list_chunk);
+		size += (list->index->count + GROUP_CHUNKS - 1) / GROUP_CHUNKS * sizeof(fz_list_chunk_group);
+	}
+
+	fz_var(size);
+
+	/* Count each stroke state and text object once, however many
+	 * nodes share it. */
+	seen = fz_new_hash_table(ctx, 256, sizeof(void *), -1, NULL);
+	fz_try(ctx)
+	{
+		while (node != node_end)
+		{
+			fz_display_node n = *node;
+			fz_display_node *next = node + n.size;
+
+			node++;
+			if (n.rect)
+				node += SIZE_IN_NODES(sizeof(fz_rect));
+			switch (n.cs)
+			{
+			default:
+			case CS_UNCHANGED:
+				break;
+			case CS_GRAY_0:
+			case CS_GRAY_1:
+				cs_n = 1;
+				break;
+			case CS_RGB_0:
+			case CS_RGB_1:
+				cs_n = 3;
+				break;
+			case CS_CMYK_0:
+			case CS_CMYK_1:
+				cs_n = 4;
+				break;
+			case CS_OTHER_0:
+				align_node_for_pointer(&node);
+				cs_n = fz_colorspace_n(ctx, *(fz_colorspace **)node);
+				node += SIZE_IN_NODES(sizeof(fz_colorspace *));
+				break;
+			}
+			if (n.color)
+				node += SIZE_IN_NODES(cs_n * sizeof(float));
+			if (n.alpha == ALPHA_PRESENT)
+				node += SIZE_IN_NODES(sizeof(float));
+			if (n.ctm & CTM_CHANGE_AD)
+				node += SIZE_IN_NODES(2*sizeof(float));
+			if (n.ctm & CTM_CHANGE_BC)
+				node += SIZE_IN_NODES(2*sizeof(float));
+			if (n.ctm & CTM_CHANGE_EF)
+				node += SIZE_IN_NODES(2*sizeof(float));
+			if (n.stroke)
+			{
+				fz_stroke_state *stroke;
+				align_node_for_pointer(&node);
+				stroke = *(fz_stroke_state **)node;
+				if (fz_hash_insert(ctx, seen, &stroke, stroke) == NULL)
+					size += stroke_state_size(stroke);
+				node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
+			}
+			if (n.path)
+			{
+				align_node_for_pointer(&node);
+				size += fz_path_heap_size(ctx, (fz_path *)node);
+				node += SIZE_IN_NODES(fz_packed_path_size((fz_path *)node));
+			}
+			switch (n.cmd)
+			{
+			case FZ_CMD_FILL_TEXT:
+			case FZ_CMD_STROKE_TEXT:
+			case FZ_CMD_CLIP_TEXT:
+			case FZ_CMD_CLIP_STROKE_TEXT:
+			case FZ_CMD_IGNORE_TEXT:
+			{
+				fz_text *text;
+				align_node_for_pointer(&node);
+				text = *(fz_text **)node;
+				if (fz_hash_insert(ctx, seen, &text, text) == NULL)
+					size += text_size(text);
+				break;
+			}
+			}
+			node = next;
+		}
+	}
+	fz_always(ctx)
+		fz_drop_hash_table(ctx, seen);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return size;
 }
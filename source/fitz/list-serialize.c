@@ -0,0 +1,2418 @@
+// Copyright (C) 2004-2023 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+#include "mupdf/fitz.h"
+
+#include <string.h>
+#include <limits.h>
+
+/* Display list files.
+ *
+ * A display list holds pointers to the fonts, images, shadings and so
+ * on it uses, and lays its nodes out to suit the machine it was built
+ * on, so it cannot be written out as it stands. Instead the list is run
+ * into a device that writes each call out in a portable form, and read
+ * back by making the same calls on a list device.
+ *
+ * The file is little endian throughout:
+ *
+ *	"MuDL" version:u16 <list>
+ *	<list> := mediabox:4*f32 <call>* LF_END
+ *	<call> := opcode:u8 [state] arguments
+ *
+ * The calls that take a matrix, color or stroke state start with a
+ * byte saying which of those have changed since the last call; only
+ * the changed values follow. Integers are written 7 bits at a time.
+ *
+ * Colorspaces, stroke states, fonts, text, images, shadings and sets
+ * of default colorspaces are objects, numbered from 1 in the order
+ * they are first used, separately for each kind; 0 means NULL. The
+ * first use of an object is followed by its definition. The glyphs of
+ * Type 3 fonts are display lists themselves, and are written inline
+ * (sharing the numbering of the list that uses them).
+ */
+
+#define LF_VERSION 1
+
+enum
+{
+	LF_END,
+	LF_FILL_PATH,
+	LF_STROKE_PATH,
+	LF_CLIP_PATH,
+	LF_CLIP_STROKE_PATH,
+	LF_FILL_TEXT,
+	LF_STROKE_TEXT,
+	LF_CLIP_TEXT,
+	LF_CLIP_STROKE_TEXT,
+	LF_IGNORE_TEXT,
+	LF_FILL_SHADE,
+	LF_FILL_IMAGE,
+	LF_FILL_IMAGE_MASK,
+	LF_CLIP_IMAGE_MASK,
+	LF_POP_CLIP,
+	LF_BEGIN_MASK,
+	LF_END_MASK,
+	LF_BEGIN_GROUP,
+	LF_END_GROUP,
+	LF_BEGIN_TILE,
+	LF_END_TILE,
+	LF_RENDER_FLAGS,
+	LF_DEFAULT_COLORSPACES,
+	LF_BEGIN_LAYER,
+	LF_END_LAYER,
+	LF_BEGIN_STRUCTURE,
+	LF_END_STRUCTURE,
+	LF_BEGIN_METATEXT,
+	LF_END_METATEXT,
+	LF_LAST_OP = LF_END_METATEXT
+};
+
+/* Which parts of the graphics state follow a call's opcode */
+enum
+{
+	LF_STATE_CTM = 1,
+	LF_STATE_COLOR = 2,
+	LF_STATE_ALPHA = 4,
+	LF_STATE_PARAMS = 8,
+	LF_STATE_STROKE = 16
+};
+
+/* Object kinds */
+enum
+{
+	LF_COLORSPACE,
+	LF_STROKE,
+	LF_FONT,
+	LF_TEXT,
+	LF_IMAGE,
+	LF_SHADE,
+	LF_DEFAULT_CS,
+	LF_KINDS
+};
+
+enum
+{
+	LF_CS_GRAY,
+	LF_CS_RGB,
+	LF_CS_BGR,
+	LF_CS_CMYK,
+	LF_CS_LAB,
+	LF_CS_OTHER,
+	LF_CS_INDEXED,
+	LF_CS_SEPARATION,
+	LF_CS_ICC
+};
+
+enum { LF_PATH_END, LF_MOVETO, LF_LINETO, LF_CURVETO, LF_CLOSEPATH, LF_QUADTO, LF_CURVETOV, LF_CURVETOY, LF_RECTTO };
+enum { LF_FONT_FREETYPE, LF_FONT_TYPE3 };
+enum { LF_IMAGE_COMPRESSED, LF_IMAGE_PIXMAP };
+
+/* Separation and DeviceN tint transforms are functions of the
+ * document, so they are written as a table of samples and read back
+ * with multilinear interpolation. */
+#define MAX_SAMPLED_TINT_INPUTS 8
+#define MAX_TINT_SAMPLES 4096
+
+static int
+tint_steps(int n)
+{
+	int steps = 2;
+	if (n == 1)
+		return 256;
+	while (1)
+	{
+		int i;
+		long total = 1;
+		for (i = 0; i < n; i++)
+			total *= steps + 1;
+		if (total > MAX_TINT_SAMPLES)
+			break;
+		steps++;
+	}
+	return steps;
+}
+
+static int
+color_params_to_int(fz_color_params params)
+{
+	return params.ri | (params.bp << 2) | (params.op << 3) | (params.opm << 4);
+}
+
+static fz_color_params
+color_params_from_int(int flags)
+{
+	fz_color_params params;
+	params.ri = flags & 3;
+	params.bp = (flags >> 2) & 1;
+	params.op = (flags >> 3) & 1;
+	params.opm = (flags >> 4) & 1;
+	return params;
+}
+
+/* Writing */
+
+typedef struct
+{
+	fz_output *out;
+	fz_hash_table *refs;
+	int count[LF_KINDS];
+	char error[100];
+} list_file_writer;
+
+typedef struct
+{
+	fz_device super;
+	list_file_writer *wr;
+
+	/* Graphics state as last written */
+	fz_matrix ctm;
+	fz_colorspace *colorspace;
+	float color[FZ_MAX_COLORS];
+	float alpha;
+	int color_params;
+	const fz_stroke_state *stroke;
+} list_file_device;
+
+static void write_list(fz_context *ctx, list_file_writer *wr, fz_display_list *list);
+
+static void
+unsupported(fz_context *ctx, list_file_writer *wr, const char *what)
+{
+	fz_strlcpy(wr->error, what, sizeof wr->error);
+	fz_throw(ctx, FZ_ERROR_GENERIC, "%s", what);
+}
+
+static void
+write_uint(fz_context *ctx, fz_output *out, unsigned int x)
+{
+	while (x >= 0x80)
+	{
+		fz_write_byte(ctx, out, (x & 0x7f) | 0x80);
+		x >>= 7;
+	}
+	fz_write_byte(ctx, out, x);
+}
+
+static void
+write_int(fz_context *ctx, fz_output *out, int x)
+{
+	write_uint(ctx, out, x < 0 ? ~((unsigned int)x << 1) : (unsigned int)x << 1);
+}
+
+static void
+write_floats(fz_context *ctx, fz_output *out, const float *f, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		fz_write_float_le(ctx, out, f[i]);
+}
+
+static void
+write_rect(fz_context *ctx, fz_output *out, fz_rect r)
+{
+	fz_write_float_le(ctx, out, r.x0);
+	fz_write_float_le(ctx, out, r.y0);
+	fz_write_float_le(ctx, out, r.x1);
+	fz_write_float_le(ctx, out, r.y1);
+}
+
+static void
+write_matrix(fz_context *ctx, fz_output *out, fz_matrix m)
+{
+	fz_write_float_le(ctx, out, m.a);
+	fz_write_float_le(ctx, out, m.b);
+	fz_write_float_le(ctx, out, m.c);
+	fz_write_float_le(ctx, out, m.d);
+	fz_write_float_le(ctx, out, m.e);
+	fz_write_float_le(ctx, out, m.f);
+}
+
+static void
+write_bytes(fz_context *ctx, fz_output *out, const unsigned char *data, size_t len)
+{
+	if (len > UINT_MAX)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "object too large for display list file");
+	write_uint(ctx, out, (unsigned int)len);
+	fz_write_data(ctx, out, data, len);
+}
+
+/* Strings are written with their length plus one, so that 0 can
+ * stand for NULL. */
+static void
+write_string(fz_context *ctx, fz_output *out, const char *s)
+{
+	size_t len;
+	if (!s)
+	{
+		write_uint(ctx, out, 0);
+		return;
+	}
+	len = strlen(s);
+	write_uint(ctx, out, (unsigned int)len + 1);
+	fz_write_data(ctx, out, s, len);
+}
+
+static void
+write_buffer(fz_context *ctx, fz_output *out, fz_buffer *buf)
+{
+	unsigned char *data;
+	size_t len = fz_buffer_storage(ctx, buf, &data);
+	write_bytes(ctx, out, data, len);
+}
+
+/* Write a reference to an object. Returns 1 if this is its first use,
+ * when the caller must write its definition next. */
+static int
+write_ref(fz_context *ctx, list_file_writer *wr, int kind, const void *obj)
+{
+	intptr_t idx;
+
+	if (!obj)
+	{
+		write_uint(ctx, wr->out, 0);
+		return 0;
+	}
+	idx = (intptr_t)fz_hash_find(ctx, wr->refs, &obj);
+	if (idx)
+	{
+		write_uint(ctx, wr->out, (unsigned int)idx);
+		return 0;
+	}
+	idx = ++wr->count[kind];
+	fz_hash_insert(ctx, wr->refs, &obj, (void *)idx);
+	write_uint(ctx, wr->out, (unsigned int)idx);
+	return 1;
+}
+
+static void
+write_colorspace(fz_context *ctx, list_file_writer *wr, fz_colorspace *cs)
+{
+	fz_output *out = wr->out;
+	int i;
+
+	if (!write_ref(ctx, wr, LF_COLORSPACE, cs))
+		return;
+
+	if (cs == fz_device_gray(ctx))
+		fz_write_byte(ctx, out, LF_CS_GRAY);
+	else if (cs == fz_device_rgb(ctx))
+		fz_write_byte(ctx, out, LF_CS_RGB);
+	else if (cs == fz_device_bgr(ctx))
+		fz_write_byte(ctx, out, LF_CS_BGR);
+	else if (cs == fz_device_cmyk(ctx))
+		fz_write_byte(ctx, out, LF_CS_CMYK);
+	else if (cs == fz_device_lab(ctx))
+		fz_write_byte(ctx, out, LF_CS_LAB);
+	else if (cs->type == FZ_COLORSPACE_INDEXED)
+	{
+		fz_colorspace *base = cs->u.indexed.base;
+		fz_write_byte(ctx, out, LF_CS_INDEXED);
+		write_colorspace(ctx, wr, base);
+		write_uint(ctx, out, cs->u.indexed.high);
+		fz_write_data(ctx, out, cs->u.indexed.lookup, (size_t)(cs->u.indexed.high + 1) * base->n);
+	}
+	else if (cs->type == FZ_COLORSPACE_SEPARATION)
+	{
+		fz_colorspace *base = cs->u.separation.base;
+		float src[FZ_MAX_COLORS];
+		float dst[FZ_MAX_COLORS];
+		int n = cs->n;
+		int steps, total, k, j;
+
+		if (n > MAX_SAMPLED_TINT_INPUTS)
+			unsupported(ctx, wr, "DeviceN colorspace with too many colorants");
+
+		fz_write_byte(ctx, out, LF_CS_SEPARATION);
+		write_colorspace(ctx, wr, base);
+		write_uint(ctx, out, n);
+		write_string(ctx, out, cs->name);
+		for (i = 0; i < n; i++)
+			write_string(ctx, out, cs->u.separation.colorant[i]);
+
+		steps = tint_steps(n);
+		write_uint(ctx, out, steps);
+		for (total = 1, i = 0; i < n; i++)
+			total *= steps;
+		for (k = 0; k < total; k++)
+		{
+			for (j = k, i = 0; i < n; i++, j /= steps)
+				src[i] = (float)(j % steps) / (steps - 1);
+			cs->u.separation.eval(ctx, cs->u.separation.tint, src, n, dst, base->n);
+			write_floats(ctx, out, dst, base->n);
+		}
+	}
+#if FZ_ENABLE_ICC
+	else if (cs->flags & FZ_COLORSPACE_IS_ICC)
+	{
+		fz_write_byte(ctx, out, LF_CS_ICC);
+		write_uint(ctx, out, cs->type);
+		write_uint(ctx, out, cs->flags);
+		write_string(ctx, out, cs->name);
+		write_buffer(ctx, out, cs->u.icc.buffer);
+	}
+#endif
+	else
+	{
+		/* Calibrated spaces without ICC support: use the device
+		 * space of the same type, as the renderer would. */
+		fz_write_byte(ctx, out, LF_CS_OTHER);
+		write_uint(ctx, out, cs->type);
+	}
+}
+
+static void
+write_stroke_state(fz_context *ctx, list_file_writer *wr, const fz_stroke_state *stroke)
+{
+	fz_output *out = wr->out;
+
+	if (!write_ref(ctx, wr, LF_STROKE, stroke))
+		return;
+
+	fz_write_byte(ctx, out, stroke->start_cap);
+	fz_write_byte(ctx, out, stroke->dash_cap);
+	fz_write_byte(ctx, out, stroke->end_cap);
+	fz_write_byte(ctx, out, stroke->linejoin);
+	fz_write_float_le(ctx, out, stroke->linewidth);
+	fz_write_float_le(ctx, out, stroke->miterlimit);
+	fz_write_float_le(ctx, out, stroke->dash_phase);
+	write_uint(ctx, out, stroke->dash_len);
+	write_floats(ctx, out, stroke->dash_list, stroke->dash_len);
+}
+
+static unsigned int
+font_flags_to_int(const fz_font_flags_t *flags)
+{
+	return flags->is_mono |
+		(flags->is_serif << 1) |
+		(flags->is_bold << 2) |
+		(flags->is_italic << 3) |
+		(flags->ft_substitute << 4) |
+		(flags->ft_stretch << 5) |
+		(flags->fake_bold << 6) |
+		(flags->fake_italic << 7) |
+		(flags->has_opentype << 8) |
+		(flags->invalid_bbox << 9) |
+		(flags->cjk << 10) |
+		(flags->cjk_lang << 11) |
+		(flags->embed << 13) |
+		(flags->never_embed << 14);
+}
+
+static void
+font_flags_from_int(fz_font_flags_t *flags, unsigned int x)
+{
+	flags->is_mono = x & 1;
+	flags->is_serif = (x >> 1) & 1;
+	flags->is_bold = (x >> 2) & 1;
+	flags->is_italic = (x >> 3) & 1;
+	flags->ft_substitute = (x >> 4) & 1;
+	flags->ft_stretch = (x >> 5) & 1;
+	flags->fake_bold = (x >> 6) & 1;
+	flags->fake_italic = (x >> 7) & 1;
+	flags->has_opentype = (x >> 8) & 1;
+	flags->invalid_bbox = (x >> 9) & 1;
+	flags->cjk = (x >> 10) & 1;
+	flags->cjk_lang = (x >> 11) & 3;
+	flags->embed = (x >> 13) & 1;
+	flags->never_embed = (x >> 14) & 1;
+}
+
+static void
+write_font(fz_context *ctx, list_file_writer *wr, fz_font *font)
+{
+	fz_output *out = wr->out;
+	int i;
+
+	if (!write_ref(ctx, wr, LF_FONT, font))
+		return;
+
+	if (font->t3lists)
+	{
+		fz_write_byte(ctx, out, LF_FONT_TYPE3);
+		write_string(ctx, out, font->name);
+		write_uint(ctx, out, font_flags_to_int(&font->flags));
+		write_rect(ctx, out, font->bbox);
+		write_matrix(ctx, out, font->t3matrix);
+		for (i = 0; i < 256; i++)
+		{
+			fz_write_float_le(ctx, out, font->t3widths[i]);
+			write_uint(ctx, out, font->t3flags[i]);
+			fz_write_byte(ctx, out, font->t3lists[i] != NULL);
+			if (font->t3lists[i])
+				write_list(ctx, wr, font->t3lists[i]);
+		}
+	}
+	else if (font->buffer)
+	{
+		fz_write_byte(ctx, out, LF_FONT_FREETYPE);
+		write_string(ctx, out, font->name);
+		write_uint(ctx, out, font_flags_to_int(&font->flags));
+		write_rect(ctx, out, font->bbox);
+		write_uint(ctx, out, font->subfont);
+		write_uint(ctx, out, font->use_glyph_bbox);
+		write_int(ctx, out, font->width_default);
+		write_uint(ctx, out, font->width_table ? font->width_count : 0);
+		if (font->width_table)
+			for (i = 0; i < font->width_count; i++)
+				write_int(ctx, out, font->width_table[i]);
+		write_buffer(ctx, out, font->buffer);
+	}
+	else
+		unsupported(ctx, wr, "font without font file data");
+}
+
+static void
+write_text(fz_context *ctx, list_file_writer *wr, const fz_text *text)
+{
+	fz_output *out = wr->out;
+	fz_text_span *span;
+	int i, n = 0;
+
+	if (!write_ref(ctx, wr, LF_TEXT, text))
+		return;
+
+	for (span = text->head; span; span = span->next)
+		n++;
+	write_uint(ctx, out, n);
+	for (span = text->head; span; span = span->next)
+	{
+		write_font(ctx, wr, span->font);
+		write_matrix(ctx, out, span->trm);
+		write_uint(ctx, out, span->wmode);
+		write_uint(ctx, out, span->bidi_level);
+		write_uint(ctx, out, span->markup_dir);
+		write_uint(ctx, out, span->language);
+		write_uint(ctx, out, span->len);
+		for (i = 0; i < span->len; i++)
+		{
+			fz_write_float_le(ctx, out, span->items[i].x);
+			fz_write_float_le(ctx, out, span->items[i].y);
+			write_int(ctx, out, span->items[i].gid);
+			write_int(ctx, out, span->items[i].ucs);
+		}
+	}
+}
+
+static int
+can_write_compressed_buffer(fz_compressed_buffer *cbuf)
+{
+	/* JBIG2 streams can refer to global segments held elsewhere. */
+	return cbuf && cbuf->buffer && cbuf->params.type != FZ_IMAGE_UNKNOWN && cbuf->params.type != FZ_IMAGE_JBIG2;
+}
+
+static void
+write_compressed_buffer(fz_context *ctx, list_file_writer *wr, fz_compressed_buffer *cbuf)
+{
+	fz_output *out = wr->out;
+	fz_compression_params *p = &cbuf->params;
+
+	write_uint(ctx, out, p->type);
+	switch (p->type)
+	{
+	case FZ_IMAGE_JPEG:
+		write_int(ctx, out, p->u.jpeg.color_transform);
+		break;
+	case FZ_IMAGE_JPX:
+		write_int(ctx, out, p->u.jpx.smask_in_data);
+		break;
+	case FZ_IMAGE_FAX:
+		write_int(ctx, out, p->u.fax.columns);
+		write_int(ctx, out, p->u.fax.rows);
+		write_int(ctx, out, p->u.fax.k);
+		write_int(ctx, out, p->u.fax.end_of_line);
+		write_int(ctx, out, p->u.fax.encoded_byte_align);
+		write_int(ctx, out, p->u.fax.end_of_block);
+		write_int(ctx, out, p->u.fax.black_is_1);
+		write_int(ctx, out, p->u.fax.damaged_rows_before_error);
+		break;
+	case FZ_IMAGE_FLATE:
+		write_int(ctx, out, p->u.flate.columns);
+		write_int(ctx, out, p->u.flate.colors);
+		write_int(ctx, out, p->u.flate.predictor);
+		write_int(ctx, out, p->u.flate.bpc);
+		break;
+	case FZ_IMAGE_LZW:
+		write_int(ctx, out, p->u.lzw.columns);
+		write_int(ctx, out, p->u.lzw.colors);
+		write_int(ctx, out, p->u.lzw.predictor);
+		write_int(ctx, out, p->u.lzw.bpc);
+		write_int(ctx, out, p->u.lzw.early_change);
+		break;
+	}
+	write_buffer(ctx, out, cbuf->buffer);
+}
+
+/* Images we cannot write in their original form are decoded, and the
+ * samples written deflated. */
+static void
+write_image_pixmap(fz_context *ctx, list_file_writer *wr, fz_image *image)
+{
+	fz_output *out = wr->out;
+	fz_pixmap *pix = fz_get_pixmap_from_image(ctx, image, NULL, NULL, NULL, NULL);
+	unsigned char *data = NULL;
+	size_t len;
+
+	fz_var(data);
+
+	fz_try(ctx)
+	{
+		if (pix->s > 0)
+			unsupported(ctx, wr, "image with spot colors");
+		if (pix->stride != pix->w * pix->n)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "unexpected image stride");
+		write_colorspace(ctx, wr, pix->colorspace);
+		write_uint(ctx, out, pix->w);
+		write_uint(ctx, out, pix->h);
+		write_uint(ctx, out, pix->alpha);
+		write_uint(ctx, out, pix->xres);
+		write_uint(ctx, out, pix->yres);
+		data = fz_new_deflated_data(ctx, &len, pix->samples, (size_t)pix->h * pix->stride, FZ_DEFLATE_DEFAULT);
+		write_bytes(ctx, out, data, len);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, data);
+		fz_drop_pixmap(ctx, pix);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+write_image(fz_context *ctx, list_file_writer *wr, fz_image *image)
+{
+	fz_output *out = wr->out;
+	fz_compressed_buffer *cbuf;
+
+	if (!write_ref(ctx, wr, LF_IMAGE, image))
+		return;
+
+	write_uint(ctx, out, image->w);
+	write_uint(ctx, out, image->h);
+	write_uint(ctx, out, image->bpc);
+	write_uint(ctx, out, image->xres);
+	write_uint(ctx, out, image->yres);
+	write_uint(ctx, out, image->imagemask | (image->interpolate << 1));
+	write_uint(ctx, out, image->orientation);
+	write_image(ctx, wr, image->mask);
+
+	cbuf = fz_compressed_image_buffer(ctx, image);
+	if (can_write_compressed_buffer(cbuf))
+	{
+		fz_write_byte(ctx, out, LF_IMAGE_COMPRESSED);
+		write_colorspace(ctx, wr, image->colorspace);
+		write_uint(ctx, out, image->use_decode);
+		if (image->use_decode)
+			write_floats(ctx, out, image->decode, 2 * image->n);
+		write_uint(ctx, out, image->use_colorkey);
+		if (image->use_colorkey)
+		{
+			int i;
+			for (i = 0; i < 2 * image->n; i++)
+				write_int(ctx, out, image->colorkey[i]);
+		}
+		write_compressed_buffer(ctx, wr, cbuf);
+	}
+	else
+	{
+		fz_write_byte(ctx, out, LF_IMAGE_PIXMAP);
+		write_image_pixmap(ctx, wr, image);
+	}
+}
+
+static void
+write_shade(fz_context *ctx, list_file_writer *wr, fz_shade *shade)
+{
+	fz_output *out = wr->out;
+	int n, i;
+
+	if (!write_ref(ctx, wr, LF_SHADE, shade))
+		return;
+
+	n = fz_colorspace_n(ctx, shade->colorspace);
+	write_colorspace(ctx, wr, shade->colorspace);
+	write_rect(ctx, out, shade->bbox);
+	write_matrix(ctx, out, shade->matrix);
+	write_uint(ctx, out, shade->use_background);
+	if (shade->use_background)
+		write_floats(ctx, out, shade->background, n);
+	write_uint(ctx, out, shade->use_function);
+	if (shade->use_function)
+		for (i = 0; i < 256; i++)
+			write_floats(ctx, out, shade->function[i], n + 1);
+
+	write_uint(ctx, out, shade->type);
+	switch (shade->type)
+	{
+	case FZ_FUNCTION_BASED:
+		write_matrix(ctx, out, shade->u.f.matrix);
+		write_uint(ctx, out, shade->u.f.xdivs);
+		write_uint(ctx, out, shade->u.f.ydivs);
+		write_floats(ctx, out, &shade->u.f.domain[0][0], 4);
+		write_floats(ctx, out, shade->u.f.fn_vals, (shade->u.f.xdivs + 1) * (shade->u.f.ydivs + 1) * n);
+		break;
+	case FZ_LINEAR:
+	case FZ_RADIAL:
+		write_uint(ctx, out, shade->u.l_or_r.extend[0]);
+		write_uint(ctx, out, shade->u.l_or_r.extend[1]);
+		write_floats(ctx, out, &shade->u.l_or_r.coords[0][0], 6);
+		break;
+	default:
+		write_int(ctx, out, shade->u.m.vprow);
+		write_int(ctx, out, shade->u.m.bpflag);
+		write_int(ctx, out, shade->u.m.bpcoord);
+		write_int(ctx, out, shade->u.m.bpcomp);
+		fz_write_float_le(ctx, out, shade->u.m.x0);
+		fz_write_float_le(ctx, out, shade->u.m.x1);
+		fz_write_float_le(ctx, out, shade->u.m.y0);
+		fz_write_float_le(ctx, out, shade->u.m.y1);
+		write_floats(ctx, out, shade->u.m.c0, n);
+		write_floats(ctx, out, shade->u.m.c1, n);
+		break;
+	}
+
+	if (shade->buffer && !can_write_compressed_buffer(shade->buffer))
+		unsupported(ctx, wr, "shading with unsupported mesh data");
+	fz_write_byte(ctx, out, shade->buffer != NULL);
+	if (shade->buffer)
+		write_compressed_buffer(ctx, wr, shade->buffer);
+}
+
+static void
+write_default_colorspaces(fz_context *ctx, list_file_writer *wr, fz_default_colorspaces *default_cs)
+{
+	if (!write_ref(ctx, wr, LF_DEFAULT_CS, default_cs))
+		return;
+
+	write_colorspace(ctx, wr, fz_default_gray(ctx, default_cs));
+	write_colorspace(ctx, wr, fz_default_rgb(ctx, default_cs));
+	write_colorspace(ctx, wr, fz_default_cmyk(ctx, default_cs));
+	write_colorspace(ctx, wr, fz_default_output_intent(ctx, default_cs));
+}
+
+static void
+path_write_op(fz_context *ctx, void *arg, int op, const float *v, int n)
+{
+	fz_output *out = arg;
+	fz_write_byte(ctx, out, op);
+	write_floats(ctx, out, v, n);
+}
+
+static void
+path_moveto(fz_context *ctx, void *arg, float x, float y)
+{
+	float v[2] = { x, y };
+	path_write_op(ctx, arg, LF_MOVETO, v, 2);
+}
+
+static void
+path_lineto(fz_context *ctx, void *arg, float x, float y)
+{
+	float v[2] = { x, y };
+	path_write_op(ctx, arg, LF_LINETO, v, 2);
+}
+
+static void
+path_curveto(fz_context *ctx, void *arg, float x1, float y1, float x2, float y2, float x3, float y3)
+{
+	float v[6] = { x1, y1, x2, y2, x3, y3 };
+	path_write_op(ctx, arg, LF_CURVETO, v, 6);
+}
+
+static void
+path_closepath(fz_context *ctx, void *arg)
+{
+	path_write_op(ctx, arg, LF_CLOSEPATH, NULL, 0);
+}
+
+static void
+path_quadto(fz_context *ctx, void *arg, float x1, float y1, float x2, float y2)
+{
+	float v[4] = { x1, y1, x2, y2 };
+	path_write_op(ctx, arg, LF_QUADTO, v, 4);
+}
+
+static void
+path_curvetov(fz_context *ctx, void *arg, float x2, float y2, float x3, float y3)
+{
+	float v[4] = { x2, y2, x3, y3 };
+	path_write_op(ctx, arg, LF_CURVETOV, v, 4);
+}
+
+static void
+path_curvetoy(fz_context *ctx, void *arg, float x1, float y1, float x3, float y3)
+{
+	float v[4] = { x1, y1, x3, y3 };
+	path_write_op(ctx, arg, LF_CURVETOY, v, 4);
+}
+
+static void
+path_rectto(fz_context *ctx, void *arg, float x1, float y1, float x2, float y2)
+{
+	float v[4] = { x1, y1, x2, y2 };
+	path_write_op(ctx, arg, LF_RECTTO, v, 4);
+}
+
+static const fz_path_walker path_writer =
+{
+	path_moveto,
+	path_lineto,
+	path_curveto,
+	path_closepath,
+	path_quadto,
+	path_curvetov,
+	path_curvetoy,
+	path_rectto
+};
+
+static void
+write_path(fz_context *ctx, list_file_writer *wr, const fz_path *path)
+{
+	fz_walk_path(ctx, path, &path_writer, wr->out);
+	fz_write_byte(ctx, wr->out, LF_PATH_END);
+}
+
+/* Start a call: the opcode, then whichever of the state that the call
+ * uses has changed since the last one. */
+static void
+write_call(fz_context *ctx, list_file_device *dev, int op,
+	const fz_matrix *ctm,
+	int has_color, fz_colorspace *colorspace, const float *color,
+	const float *alpha,
+	const fz_color_params *color_params,
+	int has_stroke, const fz_stroke_state *stroke)
+{
+	list_file_writer *wr = dev->wr;
+	fz_output *out = wr->out;
+	int n = has_color ? fz_colorspace_n(ctx, colorspace) : 0;
+	int params = color_params ? color_params_to_int(*color_params) : 0;
+	int state = 0;
+
+	if (ctm && memcmp(ctm, &dev->ctm, sizeof *ctm))
+		state |= LF_STATE_CTM;
+	if (has_color && (colorspace != dev->colorspace || (color && memcmp(color, dev->color, n * sizeof(float)))))
+		state |= LF_STATE_COLOR;
+	if (alpha && *alpha != dev->alpha)
+		state |= LF_STATE_ALPHA;
+	if (color_params && params != dev->color_params)
+		state |= LF_STATE_PARAMS;
+	if (has_stroke && stroke != dev->stroke)
+		state |= LF_STATE_STROKE;
+
+	fz_write_byte(ctx, out, op);
+	if (!ctm && !has_color && !alpha && !color_params && !has_stroke)
+		return;
+
+	fz_write_byte(ctx, out, state);
+	if (state & LF_STATE_CTM)
+	{
+		write_matrix(ctx, out, *ctm);
+		dev->ctm = *ctm;
+	}
+	if (state & LF_STATE_COLOR)
+	{
+		write_colorspace(ctx, wr, colorspace);
+		dev->colorspace = colorspace;
+		if (color)
+			memcpy(dev->color, color, n * sizeof(float));
+		else
+			memset(dev->color, 0, n * sizeof(float));
+		write_floats(ctx, out, dev->color, n);
+	}
+	if (state & LF_STATE_ALPHA)
+	{
+		fz_write_float_le(ctx, out, *alpha);
+		dev->alpha = *alpha;
+	}
+	if (state & LF_STATE_PARAMS)
+	{
+		fz_write_byte(ctx, out, params);
+		dev->color_params = params;
+	}
+	if (state & LF_STATE_STROKE)
+	{
+		write_stroke_state(ctx, wr, stroke);
+		dev->stroke = stroke;
+	}
+}
+
+static void
+lf_fill_path(fz_context *ctx, fz_device *dev_, const fz_path *path, int even_odd, fz_matrix ctm,
+	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_FILL_PATH, &ctm, 1, colorspace, color, &alpha, &color_params, 0, NULL);
+	fz_write_byte(ctx, dev->wr->out, even_odd);
+	write_path(ctx, dev->wr, path);
+}
+
+static void
+lf_stroke_path(fz_context *ctx, fz_device *dev_, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm,
+	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_STROKE_PATH, &ctm, 1, colorspace, color, &alpha, &color_params, 1, stroke);
+	write_path(ctx, dev->wr, path);
+}
+
+static void
+lf_clip_path(fz_context *ctx, fz_device *dev_, const fz_path *path, int even_odd, fz_matrix ctm, fz_rect scissor)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_CLIP_PATH, &ctm, 0, NULL, NULL, NULL, NULL, 0, NULL);
+	fz_write_byte(ctx, dev->wr->out, even_odd);
+	write_rect(ctx, dev->wr->out, scissor);
+	write_path(ctx, dev->wr, path);
+}
+
+static void
+lf_clip_stroke_path(fz_context *ctx, fz_device *dev_, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, fz_rect scissor)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_CLIP_STROKE_PATH, &ctm, 0, NULL, NULL, NULL, NULL, 1, stroke);
+	write_rect(ctx, dev->wr->out, scissor);
+	write_path(ctx, dev->wr, path);
+}
+
+static void
+lf_fill_text(fz_context *ctx, fz_device *dev_, const fz_text *text, fz_matrix ctm,
+	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_FILL_TEXT, &ctm, 1, colorspace, color, &alpha, &color_params, 0, NULL);
+	write_text(ctx, dev->wr, text);
+}
+
+static void
+lf_stroke_text(fz_context *ctx, fz_device *dev_, const fz_text *text, const fz_stroke_state *stroke, fz_matrix ctm,
+	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_STROKE_TEXT, &ctm, 1, colorspace, color, &alpha, &color_params, 1, stroke);
+	write_text(ctx, dev->wr, text);
+}
+
+static void
+lf_clip_text(fz_context *ctx, fz_device *dev_, const fz_text *text, fz_matrix ctm, fz_rect scissor)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_CLIP_TEXT, &ctm, 0, NULL, NULL, NULL, NULL, 0, NULL);
+	write_rect(ctx, dev->wr->out, scissor);
+	write_text(ctx, dev->wr, text);
+}
+
+static void
+lf_clip_stroke_text(fz_context *ctx, fz_device *dev_, const fz_text *text, const fz_stroke_state *stroke, fz_matrix ctm, fz_rect scissor)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_CLIP_STROKE_TEXT, &ctm, 0, NULL, NULL, NULL, NULL, 1, stroke);
+	write_rect(ctx, dev->wr->out, scissor);
+	write_text(ctx, dev->wr, text);
+}
+
+static void
+lf_ignore_text(fz_context *ctx, fz_device *dev_, const fz_text *text, fz_matrix ctm)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_IGNORE_TEXT, &ctm, 0, NULL, NULL, NULL, NULL, 0, NULL);
+	write_text(ctx, dev->wr, text);
+}
+
+static void
+lf_fill_shade(fz_context *ctx, fz_device *dev_, fz_shade *shade, fz_matrix ctm, float alpha, fz_color_params color_params)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_FILL_SHADE, &ctm, 0, NULL, NULL, &alpha, &color_params, 0, NULL);
+	write_shade(ctx, dev->wr, shade);
+}
+
+static void
+lf_fill_image(fz_context *ctx, fz_device *dev_, fz_image *image, fz_matrix ctm, float alpha, fz_color_params color_params)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_FILL_IMAGE, &ctm, 0, NULL, NULL, &alpha, &color_params, 0, NULL);
+	write_image(ctx, dev->wr, image);
+}
+
+static void
+lf_fill_image_mask(fz_context *ctx, fz_device *dev_, fz_image *image, fz_matrix ctm,
+	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_FILL_IMAGE_MASK, &ctm, 1, colorspace, color, &alpha, &color_params, 0, NULL);
+	write_image(ctx, dev->wr, image);
+}
+
+static void
+lf_clip_image_mask(fz_context *ctx, fz_device *dev_, fz_image *image, fz_matrix ctm, fz_rect scissor)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_CLIP_IMAGE_MASK, &ctm, 0, NULL, NULL, NULL, NULL, 0, NULL);
+	write_rect(ctx, dev->wr->out, scissor);
+	write_image(ctx, dev->wr, image);
+}
+
+static void
+lf_pop_clip(fz_context *ctx, fz_device *dev_)
+{
+	write_call(ctx, (list_file_device *)dev_, LF_POP_CLIP, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+}
+
+static void
+lf_begin_mask(fz_context *ctx, fz_device *dev_, fz_rect area, int luminosity, fz_colorspace *colorspace, const float *bc, fz_color_params color_params)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_BEGIN_MASK, NULL, 1, colorspace, bc, NULL, &color_params, 0, NULL);
+	write_rect(ctx, dev->wr->out, area);
+	fz_write_byte(ctx, dev->wr->out, luminosity);
+	fz_write_byte(ctx, dev->wr->out, bc != NULL);
+}
+
+static void
+lf_end_mask(fz_context *ctx, fz_device *dev_)
+{
+	write_call(ctx, (list_file_device *)dev_, LF_END_MASK, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+}
+
+static void
+lf_begin_group(fz_context *ctx, fz_device *dev_, fz_rect area, fz_colorspace *cs, int isolated, int knockout, int blendmode, float alpha)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	fz_output *out = dev->wr->out;
+	write_call(ctx, dev, LF_BEGIN_GROUP, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+	write_rect(ctx, out, area);
+	write_colorspace(ctx, dev->wr, cs);
+	fz_write_byte(ctx, out, (isolated != 0) | ((knockout != 0) << 1));
+	write_uint(ctx, out, blendmode);
+	fz_write_float_le(ctx, out, alpha);
+}
+
+static void
+lf_end_group(fz_context *ctx, fz_device *dev_)
+{
+	write_call(ctx, (list_file_device *)dev_, LF_END_GROUP, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+}
+
+static int
+lf_begin_tile(fz_context *ctx, fz_device *dev_, fz_rect area, fz_rect view, float xstep, float ystep, fz_matrix ctm, int id)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	fz_output *out = dev->wr->out;
+	write_call(ctx, dev, LF_BEGIN_TILE, &ctm, 0, NULL, NULL, NULL, NULL, 0, NULL);
+	write_rect(ctx, out, area);
+	write_rect(ctx, out, view);
+	fz_write_float_le(ctx, out, xstep);
+	fz_write_float_le(ctx, out, ystep);
+	write_int(ctx, out, id);
+	return 0;
+}
+
+static void
+lf_end_tile(fz_context *ctx, fz_device *dev_)
+{
+	write_call(ctx, (list_file_device *)dev_, LF_END_TILE, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+}
+
+static void
+lf_render_flags(fz_context *ctx, fz_device *dev_, int set, int clear)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_RENDER_FLAGS, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+	write_int(ctx, dev->wr->out, set);
+	write_int(ctx, dev->wr->out, clear);
+}
+
+static void
+lf_set_default_colorspaces(fz_context *ctx, fz_device *dev_, fz_default_colorspaces *default_cs)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_DEFAULT_COLORSPACES, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+	write_default_colorspaces(ctx, dev->wr, default_cs);
+}
+
+static void
+lf_begin_layer(fz_context *ctx, fz_device *dev_, const char *layer_name)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_BEGIN_LAYER, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+	write_string(ctx, dev->wr->out, layer_name);
+}
+
+static void
+lf_end_layer(fz_context *ctx, fz_device *dev_)
+{
+	write_call(ctx, (list_file_device *)dev_, LF_END_LAYER, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+}
+
+static void
+lf_begin_structure(fz_context *ctx, fz_device *dev_, fz_structure standard, const char *raw, int uid)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_BEGIN_STRUCTURE, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+	write_int(ctx, dev->wr->out, standard);
+	write_string(ctx, dev->wr->out, raw);
+	write_int(ctx, dev->wr->out, uid);
+}
+
+static void
+lf_end_structure(fz_context *ctx, fz_device *dev_)
+{
+	write_call(ctx, (list_file_device *)dev_, LF_END_STRUCTURE, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+}
+
+static void
+lf_begin_metatext(fz_context *ctx, fz_device *dev_, fz_metatext meta, const char *text)
+{
+	list_file_device *dev = (list_file_device *)dev_;
+	write_call(ctx, dev, LF_BEGIN_METATEXT, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+	write_int(ctx, dev->wr->out, meta);
+	write_string(ctx, dev->wr->out, text);
+}
+
+static void
+lf_end_metatext(fz_context *ctx, fz_device *dev_)
+{
+	write_call(ctx, (list_file_device *)dev_, LF_END_METATEXT, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL);
+}
+
+static fz_device *
+new_list_file_device(fz_context *ctx, list_file_writer *wr)
+{
+	list_file_device *dev = fz_new_derived_device(ctx, list_file_device);
+
+	dev->super.fill_path = lf_fill_path;
+	dev->super.stroke_path = lf_stroke_path;
+	dev->super.clip_path = lf_clip_path;
+	dev->super.clip_stroke_path = lf_clip_stroke_path;
+
+	dev->super.fill_text = lf_fill_text;
+	dev->super.stroke_text = lf_stroke_text;
+	dev->super.clip_text = lf_clip_text;
+	dev->super.clip_stroke_text = lf_clip_stroke_text;
+	dev->super.ignore_text = lf_ignore_text;
+
+	dev->super.fill_shade = lf_fill_shade;
+	dev->super.fill_image = lf_fill_image;
+	dev->super.fill_image_mask = lf_fill_image_mask;
+	dev->super.clip_image_mask = lf_clip_image_mask;
+
+	dev->super.pop_clip = lf_pop_clip;
+
+	dev->super.begin_mask = lf_begin_mask;
+	dev->super.end_mask = lf_end_mask;
+	dev->super.begin_group = lf_begin_group;
+	dev->super.end_group = lf_end_group;
+
+	dev->super.begin_tile = lf_begin_tile;
+	dev->super.end_tile = lf_end_tile;
+
+	dev->super.render_flags = lf_render_flags;
+	dev->super.set_default_colorspaces = lf_set_default_colorspaces;
+
+	dev->super.begin_layer = lf_begin_layer;
+	dev->super.end_layer = lf_end_layer;
+
+	dev->super.begin_structure = lf_begin_structure;
+	dev->super.end_structure = lf_end_structure;
+
+	dev->super.begin_metatext = lf_begin_metatext;
+	dev->super.end_metatext = lf_end_metatext;
+
+	dev->wr = wr;
+	dev->ctm = fz_identity;
+	dev->colorspace = NULL;
+	dev->alpha = 1;
+	dev->color_params = color_params_to_int(fz_default_color_params);
+	dev->stroke = NULL;
+
+	return &dev->super;
+}
+
+static void
+write_list(fz_context *ctx, list_file_writer *wr, fz_display_list *list)
+{
+	fz_cookie cookie = { 0 };
+	fz_device *dev;
+
+	write_rect(ctx, wr->out, fz_bound_display_list(ctx, list));
+
+	dev = new_list_file_device(ctx, wr);
+	fz_try(ctx)
+	{
+		/* The list swallows errors from the device, counting them
+		 * in the cookie. */
+		fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, &cookie);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	if (cookie.errors)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write display list: %s", wr->error[0] ? wr->error : "device error");
+
+	fz_write_byte(ctx, wr->out, LF_END);
+}
+
+void
+fz_write_display_list(fz_context *ctx, fz_output *out, fz_display_list *list)
+{
+	list_file_writer wr = { 0 };
+
+	wr.out = out;
+	wr.refs = fz_new_hash_table(ctx, 1024, sizeof(void *), -1, NULL);
+	fz_try(ctx)
+	{
+		fz_write_data(ctx, out, "MuDL", 4);
+		fz_write_uint16_le(ctx, out, LF_VERSION);
+		write_list(ctx, &wr, list);
+	}
+	fz_always(ctx)
+		fz_drop_hash_table(ctx, wr.refs);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+void
+fz_save_display_list(fz_context *ctx, fz_display_list *list, const char *filename)
+{
+	fz_output *out = fz_new_output_with_path(ctx, filename, 0);
+	fz_try(ctx)
+	{
+		fz_write_display_list(ctx, out, list);
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Reading */
+
+typedef struct
+{
+	const unsigned char *p, *end;
+	void **objs[LF_KINDS];
+	int len[LF_KINDS];
+	int max[LF_KINDS];
+	char *scratch;
+	size_t scratch_len;
+	int depth;
+} list_file_reader;
+
+/* Type 3 glyphs are lists inside the list; a hostile file could nest
+ * them without end. */
+#define MAX_LIST_DEPTH 16
+
+static fz_display_list *read_list(fz_context *ctx, list_file_reader *rd);
+
+static void
+corrupt(fz_context *ctx)
+{
+	fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt display list file");
+}
+
+static const unsigned char *
+read_data(fz_context *ctx, list_file_reader *rd, size_t len)
+{
+	const unsigned char *p = rd->p;
+	if (len > (size_t)(rd->end - rd->p))
+		corrupt(ctx);
+	rd->p += len;
+	return p;
+}
+
+static int
+read_byte(fz_context *ctx, list_file_reader *rd)
+{
+	if (rd->p == rd->end)
+		corrupt(ctx);
+	return *rd->p++;
+}
+
+static unsigned int
+read_uint(fz_context *ctx, list_file_reader *rd)
+{
+	unsigned int x = 0;
+	int shift, c;
+	for (shift = 0; shift < 35; shift += 7)
+	{
+		c = read_byte(ctx, rd);
+		x |= (unsigned int)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return x;
+	}
+	corrupt(ctx);
+	return 0;
+}
+
+/* For counts and sizes that index arrays. */
+static int
+read_count(fz_context *ctx, list_file_reader *rd, int max)
+{
+	unsigned int x = read_uint(ctx, rd);
+	if (x > (unsigned int)max)
+		corrupt(ctx);
+	return (int)x;
+}
+
+static int
+read_int(fz_context *ctx, list_file_reader *rd)
+{
+	unsigned int x = read_uint(ctx, rd);
+	return (x & 1) ? (int)~(x >> 1) : (int)(x >> 1);
+}
+
+static float
+read_float(fz_context *ctx, list_file_reader *rd)
+{
+	const unsigned char *p = read_data(ctx, rd, 4);
+	uint32_t u = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	float f;
+	memcpy(&f, &u, sizeof f);
+	return f;
+}
+
+/* Check that enough input is left for n values of size bytes each,
+ * before allocating room for them. */
+static void
+check_left(fz_context *ctx, list_file_reader *rd, size_t n, size_t size)
+{
+	if (n > (size_t)(rd->end - rd->p) / size)
+		corrupt(ctx);
+}
+
+static void
+read_floats(fz_context *ctx, list_file_reader *rd, float *f, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		f[i] = read_float(ctx, rd);
+}
+
+static fz_rect
+read_rect(fz_context *ctx, list_file_reader *rd)
+{
+	fz_rect r;
+	r.x0 = read_float(ctx, rd);
+	r.y0 = read_float(ctx, rd);
+	r.x1 = read_float(ctx, rd);
+	r.y1 = read_float(ctx, rd);
+	return r;
+}
+
+static fz_matrix
+read_matrix(fz_context *ctx, list_file_reader *rd)
+{
+	fz_matrix m;
+	m.a = read_float(ctx, rd);
+	m.b = read_float(ctx, rd);
+	m.c = read_float(ctx, rd);
+	m.d = read_float(ctx, rd);
+	m.e = read_float(ctx, rd);
+	m.f = read_float(ctx, rd);
+	return m;
+}
+
+/* Returns a string that lasts until the next call, or NULL. */
+static const char *
+read_string(fz_context *ctx, list_file_reader *rd)
+{
+	unsigned int len = read_uint(ctx, rd);
+	const unsigned char *s;
+
+	if (len == 0)
+		return NULL;
+	s = read_data(ctx, rd, len - 1);
+	if (rd->scratch_len < len)
+	{
+		rd->scratch = fz_realloc(ctx, rd->scratch, len);
+		rd->scratch_len = len;
+	}
+	memcpy(rd->scratch, s, len - 1);
+	rd->scratch[len - 1] = 0;
+	return rd->scratch;
+}
+
+static fz_buffer *
+read_buffer(fz_context *ctx, list_file_reader *rd)
+{
+	unsigned int len = read_uint(ctx, rd);
+	return fz_new_buffer_from_copied_data(ctx, read_data(ctx, rd, len), len);
+}
+
+static void *read_object(fz_context *ctx, list_file_reader *rd, int kind);
+
+static fz_colorspace *
+read_colorspace(fz_context *ctx, list_file_reader *rd)
+{
+	return read_object(ctx, rd, LF_COLORSPACE);
+}
+
+typedef struct
+{
+	int n, m, steps;
+	float *samples;
+} sampled_tint;
+
+static void
+eval_sampled_tint(fz_context *ctx, void *tint_, const float *s, int sn, float *d, int dn)
+{
+	sampled_tint *tint = tint_;
+	int lo[MAX_SAMPLED_TINT_INPUTS];
+	float f[MAX_SAMPLED_TINT_INPUTS];
+	int n = tint->n, m = tint->m, steps = tint->steps;
+	int i, k, c;
+
+	for (i = 0; i < n; i++)
+	{
+		float v = fz_clamp(i < sn ? s[i] : 0, 0, 1) * (steps - 1);
+		lo[i] = fz_mini((int)v, steps - 2);
+		f[i] = v - lo[i];
+	}
+	for (k = 0; k < dn; k++)
+		d[k] = 0;
+
+	/* Blend the 2^n corners of the cell around s. */
+	for (c = 0; c < (1 << n); c++)
+	{
+		float w = 1;
+		int idx = 0, stride = 1;
+		for (i = 0; i < n; i++)
+		{
+			int bit = (c >> i) & 1;
+			w *= bit ? f[i] : 1 - f[i];
+			idx += (lo[i] + bit) * stride;
+			stride *= steps;
+		}
+		if (w == 0)
+			continue;
+		for (k = 0; k < dn && k < m; k++)
+			d[k] += w * tint->samples[idx * m + k];
+	}
+}
+
+static void
+drop_sampled_tint(fz_context *ctx, void *tint_)
+{
+	sampled_tint *tint = tint_;
+	if (tint)
+		fz_free(ctx, tint->samples);
+	fz_free(ctx, tint);
+}
+
+static fz_colorspace *
+read_separation(fz_context *ctx, list_file_reader *rd)
+{
+	fz_colorspace *base = read_colorspace(ctx, rd);
+	fz_colorspace *cs;
+	sampled_tint *tint;
+	int n, i, total;
+
+	if (!base)
+		corrupt(ctx);
+	n = read_count(ctx, rd, MAX_SAMPLED_TINT_INPUTS);
+	if (n == 0)
+		corrupt(ctx);
+
+	cs = fz_new_colorspace(ctx, FZ_COLORSPACE_SEPARATION, 0, n, read_string(ctx, rd));
+	fz_try(ctx)
+	{
+		cs->u.separation.base = fz_keep_colorspace(ctx, base);
+		cs->u.separation.drop = drop_sampled_tint;
+		cs->u.separation.eval = eval_sampled_tint;
+		for (i = 0; i < n; i++)
+		{
+			const char *name = read_string(ctx, rd);
+			if (name)
+				fz_colorspace_name_colorant(ctx, cs, i, name);
+		}
+		tint = cs->u.separation.tint = fz_malloc_struct(ctx, sampled_tint);
+		tint->n = n;
+		tint->m = base->n;
+		tint->steps = read_count(ctx, rd, 256);
+		if (tint->steps < 2)
+			corrupt(ctx);
+		for (total = 1, i = 0; i < n; i++)
+		{
+			total *= tint->steps;
+			if (total > 256 * MAX_TINT_SAMPLES)
+				corrupt(ctx);
+		}
+		check_left(ctx, rd, (size_t)total * tint->m, 4);
+		tint->samples = fz_malloc_array(ctx, total * tint->m, float);
+		read_floats(ctx, rd, tint->samples, total * tint->m);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_colorspace(ctx, cs);
+		fz_rethrow(ctx);
+	}
+
+	return cs;
+}
+
+static fz_colorspace *
+device_colorspace_of_type(fz_context *ctx, int type)
+{
+	switch (type)
+	{
+	case FZ_COLORSPACE_GRAY: return fz_keep_colorspace(ctx, fz_device_gray(ctx));
+	case FZ_COLORSPACE_RGB: return fz_keep_colorspace(ctx, fz_device_rgb(ctx));
+	case FZ_COLORSPACE_BGR: return fz_keep_colorspace(ctx, fz_device_bgr(ctx));
+	case FZ_COLORSPACE_CMYK: return fz_keep_colorspace(ctx, fz_device_cmyk(ctx));
+	case FZ_COLORSPACE_LAB: return fz_keep_colorspace(ctx, fz_device_lab(ctx));
+	}
+	corrupt(ctx);
+	return NULL;
+}
+
+static fz_colorspace *
+define_colorspace(fz_context *ctx, list_file_reader *rd)
+{
+	switch (read_byte(ctx, rd))
+	{
+	case LF_CS_GRAY: return fz_keep_colorspace(ctx, fz_device_gray(ctx));
+	case LF_CS_RGB: return fz_keep_colorspace(ctx, fz_device_rgb(ctx));
+	case LF_CS_BGR: return fz_keep_colorspace(ctx, fz_device_bgr(ctx));
+	case LF_CS_CMYK: return fz_keep_colorspace(ctx, fz_device_cmyk(ctx));
+	case LF_CS_LAB: return fz_keep_colorspace(ctx, fz_device_lab(ctx));
+	case LF_CS_OTHER: return device_colorspace_of_type(ctx, read_uint(ctx, rd));
+	case LF_CS_INDEXED:
+	{
+		fz_colorspace *base = read_colorspace(ctx, rd);
+		fz_colorspace *cs = NULL;
+		int high;
+		size_t len;
+		const unsigned char *data;
+		unsigned char *lookup;
+
+		if (!base)
+			corrupt(ctx);
+		high = read_count(ctx, rd, 255);
+		len = (size_t)(high + 1) * base->n;
+		data = read_data(ctx, rd, len);
+		lookup = fz_malloc(ctx, len);
+		memcpy(lookup, data, len);
+		fz_try(ctx)
+			cs = fz_new_indexed_colorspace(ctx, base, high, lookup);
+		fz_catch(ctx)
+		{
+			fz_free(ctx, lookup);
+			fz_rethrow(ctx);
+		}
+		return cs;
+	}
+	case LF_CS_SEPARATION:
+		return read_separation(ctx, rd);
+	case LF_CS_ICC:
+	{
+		int type = read_uint(ctx, rd);
+		int flags = read_uint(ctx, rd);
+		char name[100];
+		const char *s = read_string(ctx, rd);
+		fz_buffer *buf;
+		fz_colorspace *cs = NULL;
+
+		fz_var(cs);
+
+		fz_strlcpy(name, s ? s : "", sizeof name);
+		buf = read_buffer(ctx, rd);
+		fz_try(ctx)
+			cs = fz_new_icc_colorspace(ctx, type, flags, name, buf);
+		fz_always(ctx)
+			fz_drop_buffer(ctx, buf);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		return cs;
+	}
+	}
+	corrupt(ctx);
+	return NULL;
+}
+
+static fz_stroke_state *
+define_stroke_state(fz_context *ctx, list_file_reader *rd)
+{
+	fz_stroke_state *stroke;
+	int start_cap = read_byte(ctx, rd);
+	int dash_cap = read_byte(ctx, rd);
+	int end_cap = read_byte(ctx, rd);
+	int linejoin = read_byte(ctx, rd);
+	float linewidth = read_float(ctx, rd);
+	float miterlimit = read_float(ctx, rd);
+	float dash_phase = read_float(ctx, rd);
+	int dash_len = read_count(ctx, rd, 1 << 16);
+
+	stroke = fz_new_stroke_state_with_dash_len(ctx, dash_len);
+	stroke->start_cap = start_cap;
+	stroke->dash_cap = dash_cap;
+	stroke->end_cap = end_cap;
+	stroke->linejoin = linejoin;
+	stroke->linewidth = linewidth;
+	stroke->miterlimit = miterlimit;
+	stroke->dash_phase = dash_phase;
+	stroke->dash_len = dash_len;
+	fz_try(ctx)
+		read_floats(ctx, rd, stroke->dash_list, dash_len);
+	fz_catch(ctx)
+	{
+		fz_drop_stroke_state(ctx, stroke);
+		fz_rethrow(ctx);
+	}
+	return stroke;
+}
+
+static fz_font *
+define_font(fz_context *ctx, list_file_reader *rd)
+{
+	int type = read_byte(ctx, rd);
+	char name[32];
+	const char *s = read_string(ctx, rd);
+	unsigned int flags;
+	fz_rect bbox;
+	fz_font *font = NULL;
+	int i;
+
+	fz_var(font);
+
+	fz_strlcpy(name, s ? s : "", sizeof name);
+	flags = read_uint(ctx, rd);
+	bbox = read_rect(ctx, rd);
+
+	if (type == LF_FONT_TYPE3)
+	{
+		font = fz_new_type3_font(ctx, name, read_matrix(ctx, rd));
+		fz_try(ctx)
+		{
+			for (i = 0; i < 256; i++)
+			{
+				font->t3widths[i] = read_float(ctx, rd);
+				font->t3flags[i] = read_uint(ctx, rd);
+				if (read_byte(ctx, rd))
+					font->t3lists[i] = read_list(ctx, rd);
+			}
+		}
+		fz_catch(ctx)
+		{
+			fz_drop_font(ctx, font);
+			fz_rethrow(ctx);
+		}
+	}
+	else if (type == LF_FONT_FREETYPE)
+	{
+		int subfont = read_uint(ctx, rd);
+		int use_glyph_bbox = read_uint(ctx, rd);
+		int width_default = read_int(ctx, rd);
+		int width_count = read_count(ctx, rd, 1 << 20);
+		short *width_table = NULL;
+		fz_buffer *buf = NULL;
+
+		fz_var(width_table);
+		fz_var(buf);
+
+		fz_try(ctx)
+		{
+			if (width_count > 0)
+			{
+				check_left(ctx, rd, width_count, 1);
+				width_table = fz_malloc_array(ctx, width_count, short);
+				for (i = 0; i < width_count; i++)
+					width_table[i] = read_int(ctx, rd);
+			}
+			buf = read_buffer(ctx, rd);
+			font = fz_new_font_from_buffer(ctx, name, buf, subfont, use_glyph_bbox);
+			font->width_default = width_default;
+			font->width_count = width_count;
+			font->width_table = width_table;
+			width_table = NULL;
+		}
+		fz_always(ctx)
+		{
+			fz_drop_buffer(ctx, buf);
+			fz_free(ctx, width_table);
+		}
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+	else
+		corrupt(ctx);
+
+	font_flags_from_int(&font->flags, flags);
+	font->bbox = bbox;
+	return font;
+}
+
+static fz_text *
+define_text(fz_context *ctx, list_file_reader *rd)
+{
+	fz_text *text = fz_new_text(ctx);
+	int nspans, i, k;
+
+	fz_try(ctx)
+	{
+		nspans = read_count(ctx, rd, INT_MAX);
+		for (i = 0; i < nspans; i++)
+		{
+			fz_font *font = read_object(ctx, rd, LF_FONT);
+			fz_matrix trm = read_matrix(ctx, rd);
+			int wmode = read_uint(ctx, rd);
+			int bidi_level = read_uint(ctx, rd);
+			int markup_dir = read_uint(ctx, rd);
+			int language = read_uint(ctx, rd);
+			int len = read_count(ctx, rd, INT_MAX);
+
+			if (!font)
+				corrupt(ctx);
+			for (k = 0; k < len; k++)
+			{
+				int gid, ucs;
+				trm.e = read_float(ctx, rd);
+				trm.f = read_float(ctx, rd);
+				gid = read_int(ctx, rd);
+				ucs = read_int(ctx, rd);
+				fz_show_glyph(ctx, text, font, trm, gid, ucs, wmode, bidi_level, markup_dir, language);
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_text(ctx, text);
+		fz_rethrow(ctx);
+	}
+	return text;
+}
+
+static fz_compressed_buffer *
+read_compressed_buffer(fz_context *ctx, list_file_reader *rd)
+{
+	fz_compressed_buffer *cbuf = fz_malloc_struct(ctx, fz_compressed_buffer);
+	fz_compression_params *p = &cbuf->params;
+
+	fz_try(ctx)
+	{
+		p->type = read_uint(ctx, rd);
+		switch (p->type)
+		{
+		case FZ_IMAGE_JPEG:
+			p->u.jpeg.color_transform = read_int(ctx, rd);
+			break;
+		case FZ_IMAGE_JPX:
+			p->u.jpx.smask_in_data = read_int(ctx, rd);
+			break;
+		case FZ_IMAGE_FAX:
+			p->u.fax.columns = read_int(ctx, rd);
+			p->u.fax.rows = read_int(ctx, rd);
+			p->u.fax.k = read_int(ctx, rd);
+			p->u.fax.end_of_line = read_int(ctx, rd);
+			p->u.fax.encoded_byte_align = read_int(ctx, rd);
+			p->u.fax.end_of_block = read_int(ctx, rd);
+			p->u.fax.black_is_1 = read_int(ctx, rd);
+			p->u.fax.damaged_rows_before_error = read_int(ctx, rd);
+			break;
+		case FZ_IMAGE_FLATE:
+			p->u.flate.columns = read_int(ctx, rd);
+			p->u.flate.colors = read_int(ctx, rd);
+			p->u.flate.predictor = read_int(ctx, rd);
+			p->u.flate.bpc = read_int(ctx, rd);
+			break;
+		case FZ_IMAGE_LZW:
+			p->u.lzw.columns = read_int(ctx, rd);
+			p->u.lzw.colors = read_int(ctx, rd);
+			p->u.lzw.predictor = read_int(ctx, rd);
+			p->u.lzw.bpc = read_int(ctx, rd);
+			p->u.lzw.early_change = read_int(ctx, rd);
+			break;
+		case FZ_IMAGE_UNKNOWN:
+		case FZ_IMAGE_JBIG2:
+			corrupt(ctx);
+			break;
+		}
+		cbuf->buffer = read_buffer(ctx, rd);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_compressed_buffer(ctx, cbuf);
+		fz_rethrow(ctx);
+	}
+	return cbuf;
+}
+
+static fz_pixmap *
+read_pixmap(fz_context *ctx, list_file_reader *rd)
+{
+	fz_colorspace *cs = read_colorspace(ctx, rd);
+	int w = read_count(ctx, rd, INT_MAX);
+	int h = read_count(ctx, rd, INT_MAX);
+	int alpha = read_uint(ctx, rd);
+	int xres = read_uint(ctx, rd);
+	int yres = read_uint(ctx, rd);
+	unsigned int len = read_uint(ctx, rd);
+	const unsigned char *data = read_data(ctx, rd, len);
+	fz_pixmap *pix;
+	fz_stream *mem = NULL;
+	fz_stream *stm = NULL;
+	size_t size;
+
+	/* Deflate cannot expand data more than about 1032 times, so do
+	 * not allocate more than the compressed samples could fill. */
+	if ((uint64_t)w * h * (fz_colorspace_n(ctx, cs) + (alpha != 0)) > (uint64_t)len * 1032 + 1032)
+		corrupt(ctx);
+
+	pix = fz_new_pixmap(ctx, cs, w, h, NULL, alpha != 0);
+	pix->xres = xres;
+	pix->yres = yres;
+
+	fz_var(mem);
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		size = (size_t)pix->h * pix->stride;
+		mem = fz_open_memory(ctx, data, len);
+		stm = fz_open_flated(ctx, mem, 15);
+		if (fz_read(ctx, stm, pix->samples, size) != size)
+			corrupt(ctx);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		fz_drop_stream(ctx, mem);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_rethrow(ctx);
+	}
+	return pix;
+}
+
+static fz_image *
+define_image(fz_context *ctx, list_file_reader *rd)
+{
+	int w = read_count(ctx, rd, INT_MAX);
+	int h = read_count(ctx, rd, INT_MAX);
+	int bpc = read_count(ctx, rd, 32);
+	int xres = read_uint(ctx, rd);
+	int yres = read_uint(ctx, rd);
+	int flags = read_uint(ctx, rd);
+	int orientation = read_uint(ctx, rd);
+	fz_image *mask = read_object(ctx, rd, LF_IMAGE);
+	fz_image *image = NULL;
+	int i;
+
+	if (read_byte(ctx, rd) == LF_IMAGE_COMPRESSED)
+	{
+		fz_colorspace *cs = read_colorspace(ctx, rd);
+		int n = cs ? fz_colorspace_n(ctx, cs) : 1;
+		int use_decode, use_colorkey;
+		float decode[FZ_MAX_COLORS * 2];
+		int colorkey[FZ_MAX_COLORS * 2];
+
+		if (n > FZ_MAX_COLORS)
+			corrupt(ctx);
+		use_decode = read_uint(ctx, rd);
+		if (use_decode)
+			read_floats(ctx, rd, decode, 2 * n);
+		use_colorkey = read_uint(ctx, rd);
+		if (use_colorkey)
+			for (i = 0; i < 2 * n; i++)
+				colorkey[i] = read_int(ctx, rd);
+
+		image = fz_new_image_from_compressed_buffer(ctx, w, h, bpc, cs, xres, yres,
+			(flags >> 1) & 1, flags & 1, NULL, use_colorkey ? colorkey : NULL,
+			read_compressed_buffer(ctx, rd), mask);
+
+		/* Set the decode array as written, rather than have it
+		 * adjusted again for Lab. */
+		if (use_decode)
+		{
+			memcpy(image->decode, decode, 2 * n * sizeof(float));
+			image->use_decode = 1;
+		}
+	}
+	else
+	{
+		fz_pixmap *pix = read_pixmap(ctx, rd);
+		fz_try(ctx)
+			image = fz_new_image_from_pixmap(ctx, pix, mask);
+		fz_always(ctx)
+			fz_drop_pixmap(ctx, pix);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		image->imagemask = flags & 1;
+		image->interpolate = (flags >> 1) & 1;
+		image->xres = xres;
+		image->yres = yres;
+	}
+
+	image->orientation = orientation;
+	return image;
+}
+
+static fz_shade *
+define_shade(fz_context *ctx, list_file_reader *rd)
+{
+	fz_shade *shade = fz_malloc_struct(ctx, fz_shade);
+	int n, i;
+
+	FZ_INIT_STORABLE(shade, 1, fz_drop_shade_imp);
+
+	fz_try(ctx)
+	{
+		shade->colorspace = fz_keep_colorspace(ctx, read_colorspace(ctx, rd));
+		if (!shade->colorspace)
+			corrupt(ctx);
+		n = fz_colorspace_n(ctx, shade->colorspace);
+		if (n > FZ_MAX_COLORS)
+			corrupt(ctx);
+		shade->bbox = read_rect(ctx, rd);
+		shade->matrix = read_matrix(ctx, rd);
+		shade->use_background = read_uint(ctx, rd);
+		if (shade->use_background)
+			read_floats(ctx, rd, shade->background, n);
+		shade->use_function = read_uint(ctx, rd);
+		if (shade->use_function)
+			for (i = 0; i < 256; i++)
+				read_floats(ctx, rd, shade->function[i], n + 1);
+
+		shade->type = read_uint(ctx, rd);
+		switch (shade->type)
+		{
+		case FZ_FUNCTION_BASED:
+			shade->u.f.matrix = read_matrix(ctx, rd);
+			shade->u.f.xdivs = read_count(ctx, rd, 1 << 12);
+			shade->u.f.ydivs = read_count(ctx, rd, 1 << 12);
+			read_floats(ctx, rd, &shade->u.f.domain[0][0], 4);
+			check_left(ctx, rd, (size_t)(shade->u.f.xdivs + 1) * (shade->u.f.ydivs + 1) * n, 4);
+			shade->u.f.fn_vals = fz_malloc_array(ctx, (shade->u.f.xdivs + 1) * (shade->u.f.ydivs + 1) * n, float);
+			read_floats(ctx, rd, shade->u.f.fn_vals, (shade->u.f.xdivs + 1) * (shade->u.f.ydivs + 1) * n);
+			break;
+		case FZ_LINEAR:
+		case FZ_RADIAL:
+			shade->u.l_or_r.extend[0] = read_uint(ctx, rd);
+			shade->u.l_or_r.extend[1] = read_uint(ctx, rd);
+			read_floats(ctx, rd, &shade->u.l_or_r.coords[0][0], 6);
+			break;
+		case FZ_MESH_TYPE4:
+		case FZ_MESH_TYPE5:
+		case FZ_MESH_TYPE6:
+		case FZ_MESH_TYPE7:
+			shade->u.m.vprow = read_int(ctx, rd);
+			shade->u.m.bpflag = read_int(ctx, rd);
+			shade->u.m.bpcoord = read_int(ctx, rd);
+			shade->u.m.bpcomp = read_int(ctx, rd);
+			shade->u.m.x0 = read_float(ctx, rd);
+			shade->u.m.x1 = read_float(ctx, rd);
+			shade->u.m.y0 = read_float(ctx, rd);
+			shade->u.m.y1 = read_float(ctx, rd);
+			read_floats(ctx, rd, shade->u.m.c0, n);
+			read_floats(ctx, rd, shade->u.m.c1, n);
+			break;
+		default:
+			corrupt(ctx);
+		}
+
+		if (read_byte(ctx, rd))
+			shade->buffer = read_compressed_buffer(ctx, rd);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_shade(ctx, shade);
+		fz_rethrow(ctx);
+	}
+	return shade;
+}
+
+static fz_default_colorspaces *
+define_default_colorspaces(fz_context *ctx, list_file_reader *rd)
+{
+	fz_default_colorspaces *default_cs = fz_new_default_colorspaces(ctx);
+
+	fz_try(ctx)
+	{
+		fz_set_default_gray(ctx, default_cs, read_colorspace(ctx, rd));
+		fz_set_default_rgb(ctx, default_cs, read_colorspace(ctx, rd));
+		fz_set_default_cmyk(ctx, default_cs, read_colorspace(ctx, rd));
+		fz_set_default_output_intent(ctx, default_cs, read_colorspace(ctx, rd));
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_default_colorspaces(ctx, default_cs);
+		fz_rethrow(ctx);
+	}
+	return default_cs;
+}
+
+static void
+drop_object(fz_context *ctx, int kind, void *obj)
+{
+	switch (kind)
+	{
+	case LF_COLORSPACE: fz_drop_colorspace(ctx, obj); break;
+	case LF_STROKE: fz_drop_stroke_state(ctx, obj); break;
+	case LF_FONT: fz_drop_font(ctx, obj); break;
+	case LF_TEXT: fz_drop_text(ctx, obj); break;
+	case LF_IMAGE: fz_drop_image(ctx, obj); break;
+	case LF_SHADE: fz_drop_shade(ctx, obj); break;
+	case LF_DEFAULT_CS: fz_drop_default_colorspaces(ctx, obj); break;
+	}
+}
+
+/* Read a reference to an object, and its definition if this is the
+ * first. The reader holds the reference; the object is borrowed. */
+static void *
+read_object(fz_context *ctx, list_file_reader *rd, int kind)
+{
+	unsigned int idx = read_uint(ctx, rd);
+	void *obj = NULL;
+	int slot;
+
+	if (idx == 0)
+		return NULL;
+	if (idx <= (unsigned int)rd->len[kind])
+	{
+		/* Still being defined if NULL; objects can't contain themselves. */
+		if (!rd->objs[kind][idx - 1])
+			corrupt(ctx);
+		return rd->objs[kind][idx - 1];
+	}
+	if (idx != (unsigned int)rd->len[kind] + 1)
+		corrupt(ctx);
+
+	/* Claim the slot before reading the definition, which may define
+	 * other objects of the same kind. */
+	if (rd->len[kind] == rd->max[kind])
+	{
+		int max = rd->max[kind] ? rd->max[kind] * 2 : 64;
+		rd->objs[kind] = fz_realloc_array(ctx, rd->objs[kind], max, void *);
+		rd->max[kind] = max;
+	}
+	slot = rd->len[kind]++;
+	rd->objs[kind][slot] = NULL;
+
+	switch (kind)
+	{
+	case LF_COLORSPACE: obj = define_colorspace(ctx, rd); break;
+	case LF_STROKE: obj = define_stroke_state(ctx, rd); break;
+	case LF_FONT: obj = define_font(ctx, rd); break;
+	case LF_TEXT: obj = define_text(ctx, rd); break;
+	case LF_IMAGE: obj = define_image(ctx, rd); break;
+	case LF_SHADE: obj = define_shade(ctx, rd); break;
+	case LF_DEFAULT_CS: obj = define_default_colorspaces(ctx, rd); break;
+	}
+	rd->objs[kind][slot] = obj;
+	return obj;
+}
+
+static fz_path *
+read_path(fz_context *ctx, list_file_reader *rd)
+{
+	fz_path *path = fz_new_path(ctx);
+	float v[6];
+	int op;
+
+	fz_try(ctx)
+	{
+		while ((op = read_byte(ctx, rd)) != LF_PATH_END)
+		{
+			switch (op)
+			{
+			case LF_MOVETO:
+				read_floats(ctx, rd, v, 2);
+				fz_moveto(ctx, path, v[0], v[1]);
+				break;
+			case LF_LINETO:
+				read_floats(ctx, rd, v, 2);
+				fz_lineto(ctx, path, v[0], v[1]);
+				break;
+			case LF_CURVETO:
+				read_floats(ctx, rd, v, 6);
+				fz_curveto(ctx, path, v[0], v[1], v[2], v[3], v[4], v[5]);
+				break;
+			case LF_CLOSEPATH:
+				fz_closepath(ctx, path);
+				break;
+			case LF_QUADTO:
+				read_floats(ctx, rd, v, 4);
+				fz_quadto(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			case LF_CURVETOV:
+				read_floats(ctx, rd, v, 4);
+				fz_curvetov(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			case LF_CURVETOY:
+				read_floats(ctx, rd, v, 4);
+				fz_curvetoy(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			case LF_RECTTO:
+				read_floats(ctx, rd, v, 4);
+				fz_rectto(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			default:
+				corrupt(ctx);
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_path(ctx, path);
+		fz_rethrow(ctx);
+	}
+	return path;
+}
+
+/* Graphics state as read so far */
+typedef struct
+{
+	fz_matrix ctm;
+	fz_colorspace *colorspace;
+	float color[FZ_MAX_COLORS];
+	float alpha;
+	fz_color_params color_params;
+	fz_stroke_state *stroke;
+} list_file_state;
+
+static void
+read_state(fz_context *ctx, list_file_reader *rd, list_file_state *gs)
+{
+	int state = read_byte(ctx, rd);
+
+	if (state & LF_STATE_CTM)
+		gs->ctm = read_matrix(ctx, rd);
+	if (state & LF_STATE_COLOR)
+	{
+		gs->colorspace = read_colorspace(ctx, rd);
+		read_floats(ctx, rd, gs->color, fz_colorspace_n(ctx, gs->colorspace));
+	}
+	if (state & LF_STATE_ALPHA)
+		gs->alpha = read_float(ctx, rd);
+	if (state & LF_STATE_PARAMS)
+		gs->color_params = color_params_from_int(read_byte(ctx, rd));
+	if (state & LF_STATE_STROKE)
+		gs->stroke = read_object(ctx, rd, LF_STROKE);
+}
+
+static void
+require(fz_context *ctx, const void *obj)
+{
+	if (!obj)
+		corrupt(ctx);
+}
+
+static void
+read_call(fz_context *ctx, list_file_reader *rd, fz_device *dev, list_file_state *gs, int op)
+{
+	fz_path *path = NULL;
+	fz_text *text;
+	fz_image *image;
+	fz_shade *shade;
+	fz_rect rect;
+	int even_odd;
+
+	fz_var(path);
+
+	switch (op)
+	{
+	case LF_FILL_PATH:
+	case LF_STROKE_PATH:
+	case LF_CLIP_PATH:
+	case LF_CLIP_STROKE_PATH:
+		read_state(ctx, rd, gs);
+		even_odd = (op == LF_FILL_PATH || op == LF_CLIP_PATH) ? read_byte(ctx, rd) : 0;
+		rect = (op == LF_CLIP_PATH || op == LF_CLIP_STROKE_PATH) ? read_rect(ctx, rd) : fz_infinite_rect;
+		path = read_path(ctx, rd);
+		fz_try(ctx)
+		{
+			if (op == LF_FILL_PATH)
+				fz_fill_path(ctx, dev, path, even_odd, gs->ctm, gs->colorspace, gs->color, gs->alpha, gs->color_params);
+			else if (op == LF_STROKE_PATH)
+			{
+				require(ctx, gs->stroke);
+				fz_stroke_path(ctx, dev, path, gs->stroke, gs->ctm, gs->colorspace, gs->color, gs->alpha, gs->color_params);
+			}
+			else if (op == LF_CLIP_PATH)
+				fz_clip_path(ctx, dev, path, even_odd, gs->ctm, rect);
+			else
+			{
+				require(ctx, gs->stroke);
+				fz_clip_stroke_path(ctx, dev, path, gs->stroke, gs->ctm, rect);
+			}
+		}
+		fz_always(ctx)
+			fz_drop_path(ctx, path);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		break;
+	case LF_FILL_TEXT:
+		read_state(ctx, rd, gs);
+		text = read_object(ctx, rd, LF_TEXT);
+		require(ctx, text);
+		fz_fill_text(ctx, dev, text, gs->ctm, gs->colorspace, gs->color, gs->alpha, gs->color_params);
+		break;
+	case LF_STROKE_TEXT:
+		read_state(ctx, rd, gs);
+		text = read_object(ctx, rd, LF_TEXT);
+		require(ctx, text);
+		require(ctx, gs->stroke);
+		fz_stroke_text(ctx, dev, text, gs->stroke, gs->ctm, gs->colorspace, gs->color, gs->alpha, gs->color_params);
+		break;
+	case LF_CLIP_TEXT:
+		read_state(ctx, rd, gs);
+		rect = read_rect(ctx, rd);
+		text = read_object(ctx, rd, LF_TEXT);
+		require(ctx, text);
+		fz_clip_text(ctx, dev, text, gs->ctm, rect);
+		break;
+	case LF_CLIP_STROKE_TEXT:
+		read_state(ctx, rd, gs);
+		rect = read_rect(ctx, rd);
+		text = read_object(ctx, rd, LF_TEXT);
+		require(ctx, text);
+		require(ctx, gs->stroke);
+		fz_clip_stroke_text(ctx, dev, text, gs->stroke, gs->ctm, rect);
+		break;
+	case LF_IGNORE_TEXT:
+		read_state(ctx, rd, gs);
+		text = read_object(ctx, rd, LF_TEXT);
+		require(ctx, text);
+		fz_ignore_text(ctx, dev, text, gs->ctm);
+		break;
+	case LF_FILL_SHADE:
+		read_state(ctx, rd, gs);
+		shade = read_object(ctx, rd, LF_SHADE);
+		require(ctx, shade);
+		fz_fill_shade(ctx, dev, shade, gs->ctm, gs->alpha, gs->color_params);
+		break;
+	case LF_FILL_IMAGE:
+		read_state(ctx, rd, gs);
+		image = read_object(ctx, rd, LF_IMAGE);
+		require(ctx, image);
+		fz_fill_image(ctx, dev, image, gs->ctm, gs->alpha, gs->color_params);
+		break;
+	case LF_FILL_IMAGE_MASK:
+		read_state(ctx, rd, gs);
+		image = read_object(ctx, rd, LF_IMAGE);
+		require(ctx, image);
+		fz_fill_image_mask(ctx, dev, image, gs->ctm, gs->colorspace, gs->color, gs->alpha, gs->color_params);
+		break;
+	case LF_CLIP_IMAGE_MASK:
+		read_state(ctx, rd, gs);
+		rect = read_rect(ctx, rd);
+		image = read_object(ctx, rd, LF_IMAGE);
+		require(ctx, image);
+		fz_clip_image_mask(ctx, dev, image, gs->ctm, rect);
+		break;
+	case LF_POP_CLIP:
+		fz_pop_clip(ctx, dev);
+		break;
+	case LF_BEGIN_MASK:
+	{
+		int luminosity, has_color;
+		read_state(ctx, rd, gs);
+		rect = read_rect(ctx, rd);
+		luminosity = read_byte(ctx, rd);
+		has_color = read_byte(ctx, rd);
+		fz_begin_mask(ctx, dev, rect, luminosity, gs->colorspace, has_color ? gs->color : NULL, gs->color_params);
+		break;
+	}
+	case LF_END_MASK:
+		fz_end_mask(ctx, dev);
+		break;
+	case LF_BEGIN_GROUP:
+	{
+		fz_colorspace *cs;
+		int flags, blendmode;
+		float alpha;
+		rect = read_rect(ctx, rd);
+		cs = read_colorspace(ctx, rd);
+		flags = read_byte(ctx, rd);
+		blendmode = read_uint(ctx, rd);
+		alpha = read_float(ctx, rd);
+		fz_begin_group(ctx, dev, rect, cs, flags & 1, (flags >> 1) & 1, blendmode, alpha);
+		break;
+	}
+	case LF_END_GROUP:
+		fz_end_group(ctx, dev);
+		break;
+	case LF_BEGIN_TILE:
+	{
+		fz_rect view;
+		float xstep, ystep;
+		read_state(ctx, rd, gs);
+		rect = read_rect(ctx, rd);
+		view = read_rect(ctx, rd);
+		xstep = read_float(ctx, rd);
+		ystep = read_float(ctx, rd);
+		(void)fz_begin_tile_id(ctx, dev, rect, view, xstep, ystep, gs->ctm, read_int(ctx, rd));
+		break;
+	}
+	case LF_END_TILE:
+		fz_end_tile(ctx, dev);
+		break;
+	case LF_RENDER_FLAGS:
+	{
+		int set = read_int(ctx, rd);
+		int clear = read_int(ctx, rd);
+		/* The only combinations a display list can hold */
+		if (!(set == FZ_DEVFLAG_GRIDFIT_AS_TILED && clear == 0) && !(set == 0 && clear == FZ_DEVFLAG_GRIDFIT_AS_TILED))
+			corrupt(ctx);
+		fz_render_flags(ctx, dev, set, clear);
+		break;
+	}
+	case LF_DEFAULT_COLORSPACES:
+		fz_set_default_colorspaces(ctx, dev, read_object(ctx, rd, LF_DEFAULT_CS));
+		break;
+	case LF_BEGIN_LAYER:
+		fz_begin_layer(ctx, dev, read_string(ctx, rd));
+		break;
+	case LF_END_LAYER:
+		fz_end_layer(ctx, dev);
+		break;
+	case LF_BEGIN_STRUCTURE:
+	{
+		int standard = read_int(ctx, rd);
+		const char *raw = read_string(ctx, rd);
+		fz_begin_structure(ctx, dev, standard, raw, read_int(ctx, rd));
+		break;
+	}
+	case LF_END_STRUCTURE:
+		fz_end_structure(ctx, dev);
+		break;
+	case LF_BEGIN_METATEXT:
+	{
+		int meta = read_int(ctx, rd);
+		fz_begin_metatext(ctx, dev, meta, read_string(ctx, rd));
+		break;
+	}
+	case LF_END_METATEXT:
+		fz_end_metatext(ctx, dev);
+		break;
+	default:
+		corrupt(ctx);
+	}
+}
+
+static fz_display_list *
+read_list(fz_context *ctx, list_file_reader *rd)
+{
+	fz_display_list *list;
+	fz_device *dev = NULL;
+	list_file_state gs;
+	int op;
+
+	gs.ctm = fz_identity;
+	gs.colorspace = NULL;
+	memset(gs.color, 0, sizeof gs.color);
+	gs.alpha = 1;
+	gs.color_params = color_params_from_int(color_params_to_int(fz_default_color_params));
+	gs.stroke = NULL;
+
+	if (rd->depth >= MAX_LIST_DEPTH)
+		corrupt(ctx);
+
+	list = fz_new_display_list(ctx, read_rect(ctx, rd));
+
+	fz_var(dev);
+
+	rd->depth++;
+	fz_try(ctx)
+	{
+		dev = fz_new_list_device(ctx, list);
+		while ((op = read_byte(ctx, rd)) != LF_END)
+			read_call(ctx, rd, dev, &gs, op);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		rd->depth--;
+		fz_drop_device(ctx, dev);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+
+	return list;
+}
+
+fz_display_list *
+fz_new_display_list_from_data(fz_context *ctx, const unsigned char *data, size_t len)
+{
+	list_file_reader rd = { 0 };
+	fz_display_list *list = NULL;
+	int kind, i;
+
+	fz_var(list);
+
+	rd.p = data;
+	rd.end = data + len;
+
+	fz_try(ctx)
+	{
+		if (len < 6 || memcmp(data, "MuDL", 4))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "not a display list file");
+		if ((data[4] | (data[5] << 8)) != LF_VERSION)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "unsupported display list file version %d", data[4] | (data[5] << 8));
+		rd.p += 6;
+		list = read_list(ctx, &rd);
+	}
+	fz_always(ctx)
+	{
+		for (kind = 0; kind < LF_KINDS; kind++)
+		{
+			for (i = 0; i < rd.len[kind]; i++)
+				drop_object(ctx, kind, rd.objs[kind][i]);
+			fz_free(ctx, rd.objs[kind]);
+		}
+		fz_free(ctx, rd.scratch);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return list;
+}
+
+fz_display_list *
+fz_load_display_list(fz_context *ctx, const char *filename)
+{
+	fz_buffer *buf = fz_read_file(ctx, filename);
+	fz_display_list *list = NULL;
+	unsigned char *data;
+	size_t len;
+
+	fz_try(ctx)
+	{
+		len = fz_buffer_storage(ctx, buf, &data);
+		list = fz_new_display_list_from_data(ctx, data, len);
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return list;
+}
@@ -272,6 +272,59 @@ fz_pack_path(fz_context *ctx, uint8_t *pack_, size_t max, const fz_path *path)
 	}
 }
 
+static void
+path_data(const fz_path *path, int *cmd_len, const uint8_t **cmds, int *coord_len, const float **coords)
+{
+	if (path->packed == FZ_PATH_PACKED_FLAT)
+	{
+		const fz_packed_path *pack = (const fz_packed_path *)path;
+		*cmd_len = pack->cmd_len;
+		*coord_len = pack->coord_len;
+		*coords = (const float *)&pack[1];
+		*cmds = (const uint8_t *)&(*coords)[pack->coord_len];
+	}
+	else
+	{
+		*cmd_len = path->cmd_len;
+		*coord_len = path->coord_len;
+		*coords = path->coords;
+		*cmds = path->cmds;
+	}
+}
+
+int
+fz_path_equal(fz_context *ctx, const fz_path *a, const fz_path *b)
+{
+	int a_cmd_len, a_coord_len, b_cmd_len, b_coord_len;
+	const uint8_t *a_cmds, *b_cmds;
+	const float *a_coords, *b_coords;
+
+	if (a == b)
+		return 1;
+	if (!a || !b)
+		return 0;
+
+	path_data(a, &a_cmd_len, &a_cmds, &a_coord_len, &a_coords);
+	path_data(b, &b_cmd_len, &b_cmds, &b_coord_len, &b_coords);
+	if (a_cmd_len != b_cmd_len || a_coord_len != b_coord_len)
+		return 0;
+	return !memcmp(a_cmds, b_cmds, a_cmd_len) && !memcmp(a_coords, b_coords, a_coord_len * sizeof(float));
+}
+
+size_t
+fz_path_heap_size(fz_context *ctx, const fz_path *path)
+{
+	switch (path->packed)
+	{
+	case FZ_PATH_UNPACKED:
+		return sizeof(fz_path) + path->cmd_cap + path->coord_cap * sizeof(float);
+	case FZ_PATH_PACKED_OPEN:
+		return path->cmd_cap + path->coord_cap * sizeof(float);
+	default:
+		return 0;
+	}
+}
+
 static void
 push_cmd(fz_context *ctx, fz_path *path, int cmd)
 {
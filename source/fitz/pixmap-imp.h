@@ -55,6 +55,18 @@ int fz_valgrind_pixmap(const fz_pixmap *pix);
 #define fz_valgrind_pixmap(pix) do {} while (0)
 #endif
 
+/*
+	Halftone a row at a time. n and alpha give the format of the
+	rows, which must be gray or CMYK, without alpha. ht may be NULL
+	for the default halftone. x and y give the position of the row
+	in device space, for the phase of the halftone.
+*/
+typedef struct fz_halftoner fz_halftoner;
+
+fz_halftoner *fz_new_halftoner(fz_context *ctx, fz_halftone *ht, int n, int alpha);
+void fz_drop_halftoner(fz_context *ctx, fz_halftoner *h);
+void fz_halftone_row(fz_halftoner *h, const unsigned char *src, unsigned char *dst, int x, int y, int w);
+
 /*
 	Convert a region of the src pixmap into the dst pixmap
 	via an optional proofing colorspace, prf.
@@ -0,0 +1,394 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+#include "mupdf/fitz.h"
+
+#include "color-imp.h"
+#include "pixmap-imp.h"
+
+#include <math.h>
+#include <string.h>
+
+enum
+{
+	PIPE_INVERT,
+	PIPE_GAMMA,
+	PIPE_TINT,
+	PIPE_SWAP_RB,
+	PIPE_PREMULTIPLY,
+	PIPE_UNPREMULTIPLY,
+	PIPE_CONVERT,
+	PIPE_HALFTONE
+};
+
+typedef struct
+{
+	int kind;
+
+	/* PIPE_GAMMA */
+	unsigned char map[256];
+
+	/* PIPE_TINT */
+	int black, white;
+
+	/* PIPE_CONVERT */
+	fz_colorspace *ds;
+	fz_colorspace *prf;
+	fz_default_colorspaces *default_cs;
+	fz_color_params color_params;
+	int keep_alpha;
+
+	/* PIPE_HALFTONE */
+	fz_halftone *ht;
+} fz_pipeline_stage;
+
+struct fz_pixmap_pipeline
+{
+	int len, cap;
+	int halftones;
+	fz_pipeline_stage *stage;
+};
+
+fz_pixmap_pipeline *
+fz_new_pixmap_pipeline(fz_context *ctx)
+{
+	return fz_malloc_struct(ctx, fz_pixmap_pipeline);
+}
+
+void
+fz_drop_pixmap_pipeline(fz_context *ctx, fz_pixmap_pipeline *pipe)
+{
+	int i;
+
+	if (!pipe)
+		return;
+	for (i = 0; i < pipe->len; i++)
+	{
+		fz_drop_colorspace(ctx, pipe->stage[i].ds);
+		fz_drop_colorspace(ctx, pipe->stage[i].prf);
+		fz_drop_default_colorspaces(ctx, pipe->stage[i].default_cs);
+		fz_drop_halftone(ctx, pipe->stage[i].ht);
+	}
+	fz_free(ctx, pipe->stage);
+	fz_free(ctx, pipe);
+}
+
+static fz_pipeline_stage *
+add_stage(fz_context *ctx, fz_pixmap_pipeline *pipe, int kind)
+{
+	fz_pipeline_stage *stage;
+
+	if (pipe->len == pipe->cap)
+	{
+		int cap = pipe->cap ? pipe->cap * 2 : 4;
+		pipe->stage = fz_realloc_array(ctx, pipe->stage, cap, fz_pipeline_stage);
+		pipe->cap = cap;
+	}
+	stage = &pipe->stage[pipe->len++];
+	memset(stage, 0, sizeof(*stage));
+	stage->kind = kind;
+	return stage;
+}
+
+void
+fz_pipeline_invert(fz_context *ctx, fz_pixmap_pipeline *pipe)
+{
+	add_stage(ctx, pipe, PIPE_INVERT);
+}
+
+void
+fz_pipeline_gamma(fz_context *ctx, fz_pixmap_pipeline *pipe, float gamma)
+{
+	fz_pipeline_stage *stage = add_stage(ctx, pipe, PIPE_GAMMA);
+	int k;
+
+	/* As fz_gamma_pixmap. */
+	for (k = 0; k < 256; k++)
+		stage->map[k] = pow(k / 255.0f, gamma) * 255;
+}
+
+void
+fz_pipeline_tint(fz_context *ctx, fz_pixmap_pipeline *pipe, int black, int white)
+{
+	fz_pipeline_stage *stage = add_stage(ctx, pipe, PIPE_TINT);
+	stage->black = black;
+	stage->white = white;
+}
+
+void
+fz_pipeline_swap_rb(fz_context *ctx, fz_pixmap_pipeline *pipe)
+{
+	add_stage(ctx, pipe, PIPE_SWAP_RB);
+}
+
+void
+fz_pipeline_premultiply(fz_context *ctx, fz_pixmap_pipeline *pipe)
+{
+	add_stage(ctx, pipe, PIPE_PREMULTIPLY);
+}
+
+void
+fz_pipeline_unpremultiply(fz_context *ctx, fz_pixmap_pipeline *pipe)
+{
+	add_stage(ctx, pipe, PIPE_UNPREMULTIPLY);
+}
+
+void
+fz_pipeline_convert(fz_context *ctx, fz_pixmap_pipeline *pipe, fz_colorspace *ds, fz_colorspace *prf, fz_default_colorspaces *default_cs, fz_color_params color_params, int keep_alpha)
+{
+	fz_pipeline_stage *stage;
+
+	if (!ds && !keep_alpha)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot both throw away and keep alpha");
+
+	stage = add_stage(ctx, pipe, PIPE_CONVERT);
+	stage->ds = fz_keep_colorspace(ctx, ds);
+	stage->prf = fz_keep_colorspace(ctx, prf);
+	stage->default_cs = fz_keep_default_colorspaces(ctx, default_cs);
+	stage->color_params = color_params;
+	stage->keep_alpha = keep_alpha;
+}
+
+void
+fz_pipeline_halftone(fz_context *ctx, fz_pixmap_pipeline *pipe, fz_halftone *ht)
+{
+	fz_pipeline_stage *stage;
+
+	if (pipe->halftones)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "pixmap pipeline can only halftone once");
+
+	stage = add_stage(ctx, pipe, PIPE_HALFTONE);
+	stage->ht = ht ? fz_keep_halftone(ctx, ht) : NULL;
+	pipe->halftones = 1;
+}
+
+static void
+swap_rb_row(fz_context *ctx, fz_pixmap *row)
+{
+	unsigned char *s = row->samples;
+	int n = row->n;
+	int x;
+
+	if (n - row->alpha - row->s < 3)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "can only swap red and blue of RGB and BGR pixmaps");
+
+	for (x = 0; x < row->w; x++)
+	{
+		unsigned char t = s[0];
+		s[0] = s[2];
+		s[2] = t;
+		s += n;
+	}
+}
+
+static void
+unpremultiply_row(fz_pixmap *row)
+{
+	unsigned char *s = row->samples;
+	int n1 = row->n - 1;
+	int n = row->n;
+	int k, x;
+
+	if (!row->alpha)
+		return;
+
+	for (x = 0; x < row->w; x++)
+	{
+		int a = s[n1];
+		if (a == 0)
+		{
+			for (k = 0; k < n1; k++)
+				s[k] = 0;
+		}
+		else if (a != 255)
+		{
+			for (k = 0; k < n1; k++)
+			{
+				int v = (s[k] * 255 + (a >> 1)) / a;
+				s[k] = v > 255 ? 255 : v;
+			}
+		}
+		s += n;
+	}
+}
+
+static void
+gamma_row(fz_pixmap *row, const unsigned char *map)
+{
+	unsigned char *s = row->samples;
+	int n1 = row->n - row->alpha;
+	int n = row->n;
+	int k, x;
+
+	for (x = 0; x < row->w; x++)
+	{
+		for (k = 0; k < n1; k++)
+			s[k] = map[s[k]];
+		s += n;
+	}
+}
+
+/* A one row pixmap whose samples point at (but do not own) a row of
+ * another. */
+static fz_pixmap *
+new_row_view(fz_context *ctx, fz_pixmap *pix)
+{
+	fz_pixmap *row = fz_new_pixmap_with_data(ctx, pix->colorspace, pix->w, 1, pix->seps, pix->alpha, pix->stride, pix->samples);
+	row->x = pix->x;
+	row->xres = pix->xres;
+	row->yres = pix->yres;
+	return row;
+}
+
+fz_pixmap *
+fz_run_pixmap_pipeline(fz_context *ctx, fz_pixmap_pipeline *pipe, fz_pixmap *pix, int band_start, fz_bitmap **bitp)
+{
+	fz_pixmap **rows = NULL;
+	fz_pixmap *out = NULL;
+	fz_bitmap *bit = NULL;
+	fz_halftoner *halftoner = NULL;
+	int last_convert = -1;
+	int i, y;
+
+	if (bitp)
+		*bitp = NULL;
+
+	for (i = 0; i < pipe->len; i++)
+		if (pipe->stage[i].kind == PIPE_CONVERT)
+			last_convert = i;
+
+	fz_var(rows);
+	fz_var(out);
+	fz_var(bit);
+	fz_var(halftoner);
+
+	fz_try(ctx)
+	{
+		fz_pixmap *cur;
+
+		/* rows[0] walks down pix. The output of each conversion goes
+		 * into a row of its own, except the last, which goes straight
+		 * into a row of out. */
+		rows = fz_calloc(ctx, pipe->len + 1, sizeof(*rows));
+		rows[0] = cur = new_row_view(ctx, pix);
+		for (i = 0; i < pipe->len; i++)
+		{
+			fz_pipeline_stage *stage = &pipe->stage[i];
+			if (stage->kind == PIPE_CONVERT)
+			{
+				int alpha = stage->keep_alpha && cur->alpha;
+				if (i == last_convert)
+				{
+					out = fz_new_pixmap(ctx, stage->ds, pix->w, pix->h, pix->seps, alpha);
+					out->xres = pix->xres;
+					out->yres = pix->yres;
+					out->x = pix->x;
+					out->y = pix->y;
+					if (pix->flags & FZ_PIXMAP_FLAG_INTERPOLATE)
+						out->flags |= FZ_PIXMAP_FLAG_INTERPOLATE;
+					else
+						out->flags &= ~FZ_PIXMAP_FLAG_INTERPOLATE;
+					rows[i+1] = cur = new_row_view(ctx, out);
+				}
+				else
+				{
+					rows[i+1] = cur = fz_new_pixmap(ctx, stage->ds, pix->w, 1, pix->seps, alpha);
+					cur->x = pix->x;
+				}
+			}
+			else if (stage->kind == PIPE_HALFTONE)
+			{
+				halftoner = fz_new_halftoner(ctx, stage->ht, cur->n, cur->alpha);
+				bit = fz_new_bitmap(ctx, pix->w, pix->h, cur->n, pix->xres, pix->yres);
+			}
+		}
+
+		for (y = 0; y < pix->h; y++)
+		{
+			cur = rows[0];
+			cur->samples = pix->samples + y * (size_t)pix->stride;
+			cur->y = pix->y + y;
+			if (out)
+			{
+				rows[last_convert+1]->samples = out->samples + y * (size_t)out->stride;
+				rows[last_convert+1]->y = out->y + y;
+			}
+
+			for (i = 0; i < pipe->len; i++)
+			{
+				fz_pipeline_stage *stage = &pipe->stage[i];
+				switch (stage->kind)
+				{
+				case PIPE_INVERT:
+					fz_invert_pixmap(ctx, cur);
+					break;
+				case PIPE_GAMMA:
+					gamma_row(cur, stage->map);
+					break;
+				case PIPE_TINT:
+					fz_tint_pixmap(ctx, cur, stage->black, stage->white);
+					break;
+				case PIPE_SWAP_RB:
+					swap_rb_row(ctx, cur);
+					break;
+				case PIPE_PREMULTIPLY:
+					fz_premultiply_pixmap(ctx, cur);
+					break;
+				case PIPE_UNPREMULTIPLY:
+					unpremultiply_row(cur);
+					break;
+				case PIPE_CONVERT:
+					rows[i+1]->y = cur->y;
+					fz_convert_pixmap_samples(ctx, cur, rows[i+1], stage->prf, stage->default_cs, stage->color_params, 1);
+					cur = rows[i+1];
+					break;
+				case PIPE_HALFTONE:
+					fz_halftone_row(halftoner, cur->samples, bit->samples + y * (size_t)bit->stride, cur->x, pix->y + band_start + y, cur->w);
+					break;
+				}
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		if (rows)
+		{
+			for (i = 0; i <= pipe->len; i++)
+				fz_drop_pixmap(ctx, rows[i]);
+			fz_free(ctx, rows);
+		}
+		fz_drop_halftoner(ctx, halftoner);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_bitmap(ctx, bit);
+		fz_drop_pixmap(ctx, out);
+		fz_rethrow(ctx);
+	}
+
+	if (bitp)
+		*bitp = bit;
+	else
+		fz_drop_bitmap(ctx, bit);
+
+	return out ? out : fz_keep_pixmap(ctx, pix);
+}
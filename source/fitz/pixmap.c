@@ -186,7 +186,7 @@ fz_pixmap *fz_new_pixmap_from_pixmap(fz_context *ctx, fz_pixmap *pixmap, const f
 	subpix->y = rect->y0;
 	subpix->w = fz_irect_width(*rect);
 	subpix->h = fz_irect_height(*rect);
-	subpix->samples += (rect->x0 - pixmap->x) + (rect->y0 - pixmap->y) * pixmap->stride;
+	subpix->samples += (rect->x0 - pixmap->x) * (size_t)pixmap->n + (rect->y0 - pixmap->y) * (size_t)pixmap->stride;
 	subpix->underlying = fz_keep_pixmap(ctx, pixmap);
 	subpix->colorspace = fz_keep_colorspace(ctx, pixmap->colorspace);
 	subpix->seps = fz_keep_separations(ctx, pixmap->seps);
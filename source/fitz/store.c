@@ -1004,6 +1004,28 @@ fz_shrink_store(fz_context *ctx, unsigned int percent)
 	return success;
 }
 
+void
+fz_store_usage(fz_context *ctx, size_t *size, size_t *max)
+{
+	fz_store *store = ctx->store;
+
+	if (store == NULL)
+	{
+		if (size)
+			*size = 0;
+		if (max)
+			*max = 0;
+		return;
+	}
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (size)
+		*size = store->size;
+	if (max)
+		*max = store->max;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const fz_store_type *type)
 {
 	fz_store *store;
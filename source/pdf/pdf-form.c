@@ -627,6 +627,10 @@ pdf_update_page(fz_context *ctx, pdf_page *page)
 		fz_rethrow(ctx);
 	}
 
+	/* Form calculations can change other pages too. */
+	if (changed)
+		fz_purge_stored_display_lists(ctx, &page->doc->super);
+
 	return changed;
 }
 
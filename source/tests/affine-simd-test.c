@@ -0,0 +1,164 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+/*
+ * affine-simd-test - Check the vector image painters against the scalar ones.
+ *
+ * The painters are static, so we build draw-affine.c into this file.
+ * The bilinear RGB and gray to RGB painters are run over random images
+ * with random (scaled, rotated, flipped) steps that wander on and off
+ * the edges of the image, for every combination of source and
+ * destination alpha. They must write exactly the same bytes as the
+ * scalar painters, and nothing past the end of the span. Exits with 1
+ * if any byte differs.
+ */
+
+#include "../fitz/draw-affine.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXW 37
+#define IMGW 19
+#define IMGH 13
+#define GUARD 8
+#define ROUNDS 4000
+
+static unsigned int seed = 1;
+
+static int
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+/* Random pixels of n colorants, premultiplied if there is alpha. */
+static void
+random_pixels(byte *p, int count, int n, int alpha)
+{
+	int i, k, a;
+	for (i = 0; i < count; i++)
+	{
+		if (!alpha)
+			a = 255;
+		else switch (rnd() & 3)
+		{
+		case 0: a = 0; break;
+		case 1: a = 255; break;
+		default: a = rnd() & 255; break;
+		}
+		for (k = 0; k < n; k++)
+			*p++ = rnd() % (a + 1);
+		if (alpha)
+			*p++ = a;
+	}
+}
+
+/* A step of up to two source pixels either way, in fixed point. */
+static affint
+random_step(void)
+{
+	switch (rnd() & 3)
+	{
+	case 0: return 0;
+	case 1: return ONE;
+	default: return (rnd() % (4 * ONE)) - 2 * ONE;
+	}
+}
+
+#if defined(FZ_AFFINE_SSE2) || defined(FZ_AFFINE_NEON)
+static paintfn_t *
+scalar_lerp_3(int da, int sa)
+{
+	if (da)
+		return sa ? paint_affine_lerp_da_sa_3 : paint_affine_lerp_da_3;
+	return sa ? paint_affine_lerp_sa_3 : paint_affine_lerp_3;
+}
+
+static paintfn_t *
+scalar_lerp_g2rgb(int da, int sa)
+{
+	if (da)
+		return sa ? paint_affine_lerp_da_sa_g2rgb : paint_affine_lerp_da_g2rgb;
+	return sa ? paint_affine_lerp_sa_g2rgb : paint_affine_lerp_g2rgb;
+}
+
+static int
+test_lerp(const char *name, paintfn_t *simd, paintfn_t *(*scalar)(int da, int sa), int sn)
+{
+	byte src[IMGW * IMGH * 4];
+	byte want[MAXW * 4 + GUARD], got[MAXW * 4 + GUARD];
+	int r, w, da, sa, i, len, errors = 0;
+	affint sw, sh, u, v, fa, fb;
+
+	for (r = 0; r < ROUNDS; r++)
+	{
+		da = r & 1;
+		sa = (r >> 1) & 1;
+		w = 1 + rnd() % MAXW;
+		len = w * (3 + da);
+
+		random_pixels(src, IMGW * IMGH, sn, sa);
+		random_pixels(want, w, 3, da);
+		for (i = len; i < len + GUARD; i++)
+			want[i] = rnd() & 255;
+		memcpy(got, want, len + GUARD);
+
+		/* As set up by fz_paint_image_imp for a bilinear painter. */
+		sw = ((affint)IMGW << PREC) + HALF;
+		sh = ((affint)IMGH << PREC) + HALF;
+		u = (rnd() % ((IMGW + 4) * ONE)) - 2 * ONE - HALF;
+		v = (rnd() % ((IMGH + 4) * ONE)) - 2 * ONE - HALF;
+		fa = random_step();
+		fb = random_step();
+
+		scalar(da, sa)(want, da, src, sw, sh, IMGW * (sn + sa), sa, u, v, fa, fb, w, 3, sn, 255, NULL, NULL, NULL, NULL);
+		simd(got, da, src, sw, sh, IMGW * (sn + sa), sa, u, v, fa, fb, w, 3, sn, 255, NULL, NULL, NULL, NULL);
+
+		for (i = 0; i < len + GUARD; i++)
+			if (want[i] != got[i])
+			{
+				fprintf(stderr, "%s: da=%d sa=%d width %d: byte %d is %d, expected %d\n", name, da, sa, w, i, got[i], want[i]);
+				errors++;
+				break;
+			}
+	}
+	printf("%s: %s\n", name, errors ? "FAIL" : "ok");
+	return errors;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	int errors = 0;
+
+#if defined(FZ_AFFINE_SSE2) || defined(FZ_AFFINE_NEON)
+	errors += test_lerp("affine_lerp_3", simd_affine_lerp_3, scalar_lerp_3, 3);
+	errors += test_lerp("affine_lerp_g2rgb", simd_affine_lerp_g2rgb, scalar_lerp_g2rgb, 1);
+#else
+	printf("no vector painters in this build\n");
+#endif
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+/*
+ * paint-simd-test - Check the vector span painters against the scalar ones.
+ *
+ * The painters are static, so we build draw-paint.c into this file.
+ * Every vector painter is run on random spans of every width from 1 up to a
+ * few registers' worth, and must write exactly the same bytes as the
+ * scalar painter it replaces. Exits with 1 if any byte differs.
+ */
+
+#include "../fitz/draw-paint.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXW 67
+#define ROUNDS 2000
+
+static unsigned int seed = 1;
+
+static int
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+/* Random premultiplied RGBA, with plenty of fully opaque and fully
+ * transparent pixels so that every branch gets a look in. */
+static void
+random_rgba(byte *p, int w)
+{
+	int i, k, a;
+	for (i = 0; i < w; i++, p += 4)
+	{
+		switch (rnd() & 3)
+		{
+		case 0: a = 0; break;
+		case 1: a = 255; break;
+		default: a = rnd() & 255; break;
+		}
+		for (k = 0; k < 3; k++)
+			p[k] = a ? rnd() % (a + 1) : 0;
+		p[3] = a;
+	}
+}
+
+static void
+random_bytes(byte *p, int w)
+{
+	int i;
+	for (i = 0; i < w; i++)
+	{
+		switch (rnd() & 3)
+		{
+		case 0: p[i] = 0; break;
+		case 1: p[i] = 255; break;
+		default: p[i] = rnd() & 255; break;
+		}
+	}
+}
+
+static int
+report(const char *name, int w, const byte *want, const byte *got, int len)
+{
+	int i;
+	for (i = 0; i < len; i++)
+		if (want[i] != got[i])
+		{
+			fprintf(stderr, "%s: width %d: byte %d is %d, expected %d\n", name, w, i, got[i], want[i]);
+			return 1;
+		}
+	return 0;
+}
+
+static int
+test_span(const char *name, fz_span_painter_t *simd, fz_span_painter_t *scalar, int fixed_alpha)
+{
+	byte src[MAXW * 4], want[MAXW * 4], got[MAXW * 4];
+	int r, w, alpha, errors = 0;
+
+	if (!simd)
+		return 0;
+	for (r = 0; r < ROUNDS; r++)
+	{
+		w = 1 + r % MAXW;
+		alpha = fixed_alpha ? 255 : 1 + rnd() % 254;
+		random_rgba(src, w);
+		random_rgba(want, w);
+		memcpy(got, want, w * 4);
+		scalar(want, 1, src, 1, 3, w, alpha, NULL);
+		simd(got, 1, src, 1, 3, w, alpha, NULL);
+		errors += report(name, w, want, got, w * 4);
+	}
+	printf("%s: %s\n", name, errors ? "FAIL" : "ok");
+	return errors;
+}
+
+static int
+test_span_color(const char *name, fz_span_color_painter_t *simd, fz_span_color_painter_t *scalar, int solid)
+{
+	byte mask[MAXW], want[MAXW * 4], got[MAXW * 4], color[4];
+	int r, w, errors = 0;
+
+	if (!simd)
+		return 0;
+	for (r = 0; r < ROUNDS; r++)
+	{
+		w = 1 + r % MAXW;
+		color[0] = rnd() & 255;
+		color[1] = rnd() & 255;
+		color[2] = rnd() & 255;
+		color[3] = solid ? 255 : rnd() % 255;
+		random_bytes(mask, w);
+		random_rgba(want, w);
+		memcpy(got, want, w * 4);
+		scalar(want, mask, 4, w, color, 1, NULL);
+		simd(got, mask, 4, w, color, 1, NULL);
+		errors += report(name, w, want, got, w * 4);
+	}
+	printf("%s: %s\n", name, errors ? "FAIL" : "ok");
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	int errors = 0;
+
+#if FZ_PLOTTERS_RGB
+	if (!simd_span_3_da_sa())
+		printf("no vector painters on this CPU\n");
+	errors += test_span("span_3_da_sa", simd_span_3_da_sa(), paint_span_3_da_sa, 1);
+	errors += test_span("span_3_da_sa_alpha", simd_span_3_da_sa_alpha(), paint_span_3_da_sa_alpha, 0);
+	errors += test_span_color("span_with_color_3_da_solid", simd_span_with_color_3_da_solid(), paint_span_with_color_3_da_solid, 1);
+	errors += test_span_color("span_with_color_3_da_alpha", simd_span_with_color_3_da_alpha(), paint_span_with_color_3_da_alpha, 0);
+#endif
+
+	return errors ? 1 : 0;
+}
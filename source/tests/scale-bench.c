@@ -0,0 +1,219 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+/*
+ * scale-bench - Time the scaler kernels, C against SSE2/NEON.
+ *
+ * The kernels are static, so we build draw-scale-simple.c into this
+ * file, asking it to keep the C versions of the vector kernels too.
+ * Each kernel downscales a photo sized RGBA image by the given factor
+ * and reports megapixels (of source image) per second. The C and the
+ * vector output are compared first; exits with 1 if they differ.
+ *
+ * usage: scale-bench [factor [width height]]
+ */
+
+#define FZ_SCALE_KEEP_C
+#include "../fitz/draw-scale-simple.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef void (to_temp_fn)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights);
+typedef void (from_temp_fn)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row);
+
+static int src_w = 4000;
+static int src_h = 3000;
+
+static double
+now(void)
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+/* The horizontal pass: every source row into a row of the temp buffer. */
+static void
+run_to_temp(to_temp_fn *fn, unsigned char *dst, const unsigned char *src, const fz_weights *cols)
+{
+	int y;
+	for (y = 0; y < src_h; y++)
+		fn(dst + (size_t)y * cols->count * 4, src + (size_t)y * src_w * 4, cols);
+}
+
+/* The vertical pass: every output row from the temp buffer. */
+static void
+run_from_temp(from_temp_fn *fn, unsigned char *dst, const unsigned char *temp, const fz_weights *rows, int w)
+{
+	int y;
+	for (y = 0; y < rows->count; y++)
+		fn(dst + (size_t)y * w * 4, temp, rows, w, 4, y);
+}
+
+static double
+time_to_temp(to_temp_fn *fn, unsigned char *dst, const unsigned char *src, const fz_weights *cols)
+{
+	double start = now(), t;
+	int runs = 0;
+	do
+	{
+		run_to_temp(fn, dst, src, cols);
+		runs++;
+		t = now() - start;
+	}
+	while (t < 1);
+	return (double)src_w * src_h * runs / t / 1e6;
+}
+
+static double
+time_from_temp(from_temp_fn *fn, unsigned char *dst, const unsigned char *temp, const fz_weights *rows, int w)
+{
+	double start = now(), t;
+	int runs = 0;
+	do
+	{
+		run_from_temp(fn, dst, temp, rows, w);
+		runs++;
+		t = now() - start;
+	}
+	while (t < 1);
+	return (double)w * src_h * runs / t / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	fz_weights *cols = NULL, *rows = NULL;
+	unsigned char *src = NULL, *want = NULL, *got = NULL;
+	float factor = 3;
+	int dst_w, dst_h, errors = 0;
+	size_t i, size;
+
+	if (argc > 1)
+		factor = fz_atof(argv[1]);
+	if (argc > 3)
+	{
+		src_w = fz_atoi(argv[2]);
+		src_h = fz_atoi(argv[3]);
+	}
+	if (factor < 1 || src_w < 1 || src_h < 1)
+	{
+		fprintf(stderr, "usage: scale-bench [factor [width height]]\n");
+		return 1;
+	}
+	dst_w = src_w / factor;
+	dst_h = src_h / factor;
+	if (dst_w < 1 || dst_h < 1)
+	{
+		fprintf(stderr, "scale-bench: factor too large for the image\n");
+		return 1;
+	}
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return 1;
+	}
+
+	fz_var(cols);
+	fz_var(rows);
+	fz_var(src);
+	fz_var(want);
+	fz_var(got);
+
+	fz_try(ctx)
+	{
+		cols = build_weights(ctx, src_w, 0, dst_w, &fz_scale_filter_simple, 0, dst_w, 0, dst_w, 4, 0);
+		rows = build_weights(ctx, src_h, 0, dst_h, &fz_scale_filter_simple, 1, dst_h, 0, dst_h, 4, 0);
+		size = (size_t)src_w * src_h * 4;
+		src = fz_malloc(ctx, size);
+		want = fz_malloc(ctx, size);
+		got = fz_malloc(ctx, size);
+		srand(1);
+		for (i = 0; i < size; i++)
+			src[i] = rand();
+
+		printf("%d x %d RGBA down to %d x %d, megapixels/s of source:\n", src_w, src_h, dst_w, dst_h);
+
+		/* The horizontal pass reads src_w x src_h and writes dst_w x src_h. */
+		run_to_temp(scale_row_to_temp4, want, src, cols);
+#if defined(FZ_SCALE_SSE2) || defined(FZ_SCALE_NEON)
+#if defined(FZ_SCALE_SSE2)
+		run_to_temp(scale_row_to_temp4_sse2, got, src, cols);
+#else
+		run_to_temp(scale_row_to_temp4_neon, got, src, cols);
+#endif
+		if (memcmp(want, got, (size_t)dst_w * src_h * 4))
+		{
+			fprintf(stderr, "scale_row_to_temp4: vector output differs\n");
+			errors++;
+		}
+#endif
+		printf("scale_row_to_temp4     C: %8.1f\n", time_to_temp(scale_row_to_temp4, got, src, cols));
+#if defined(FZ_SCALE_SSE2)
+		printf("scale_row_to_temp4  SSE2: %8.1f\n", time_to_temp(scale_row_to_temp4_sse2, got, src, cols));
+#elif defined(FZ_SCALE_NEON)
+		printf("scale_row_to_temp4  NEON: %8.1f\n", time_to_temp(scale_row_to_temp4_neon, got, src, cols));
+#endif
+
+		/* The vertical pass reads dst_w x src_h (the temp rows of every
+		 * output row, each from the same buffer here) and writes
+		 * dst_w x dst_h. */
+		run_from_temp(scale_row_from_temp, want, src, rows, dst_w);
+#if defined(FZ_SCALE_SSE2) || defined(FZ_SCALE_NEON)
+#if defined(FZ_SCALE_SSE2)
+		run_from_temp(scale_row_from_temp_sse2, got, src, rows, dst_w);
+#else
+		run_from_temp(scale_row_from_temp_neon, got, src, rows, dst_w);
+#endif
+		if (memcmp(want, got, (size_t)dst_w * dst_h * 4))
+		{
+			fprintf(stderr, "scale_row_from_temp: vector output differs\n");
+			errors++;
+		}
+#endif
+		printf("scale_row_from_temp    C: %8.1f\n", time_from_temp(scale_row_from_temp, got, src, rows, dst_w));
+#if defined(FZ_SCALE_SSE2)
+		printf("scale_row_from_temp SSE2: %8.1f\n", time_from_temp(scale_row_from_temp_sse2, got, src, rows, dst_w));
+#elif defined(FZ_SCALE_NEON)
+		printf("scale_row_from_temp NEON: %8.1f\n", time_from_temp(scale_row_from_temp_neon, got, src, rows, dst_w));
+#endif
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, cols);
+		fz_free(ctx, rows);
+		fz_free(ctx, src);
+		fz_free(ctx, want);
+		fz_free(ctx, got);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "scale-bench: %s\n", fz_caught_message(ctx));
+		errors++;
+	}
+
+	fz_drop_context(ctx);
+	return errors ? 1 : 0;
+}
@@ -1,12 +1,19 @@
 #include <mupdf/fitz.h>
 #include <mupdf/fitz/display-list.h>
 #include <mupdf/fitz/store.h>
+#include <mupdf/pdf.h>
 #include <mupdf/ucdn.h>
 #include <mupdf/MuPDFWrapper.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <chrono>
+#include <new>
 
 #include <iostream>
 #include <fcntl.h>
@@ -43,7 +50,7 @@ new_pixmap_with_bbox_and_data(fz_context* ctx, fz_colorspace* colorspace, fz_ire
 }
 
 fz_pixmap*
-new_pixmap_from_display_list_with_separations_bbox_and_data(fz_context* ctx, fz_display_list* list, fz_rect rect, fz_matrix ctm, fz_colorspace* cs, fz_separations* seps, int alpha, unsigned char* pixel_storage, fz_cookie* cookie)
+new_pixmap_from_display_list_with_separations_bbox_and_data(fz_context* ctx, fz_display_list* list, fz_rect rect, fz_matrix ctm, fz_colorspace* cs, fz_separations* seps, int alpha, unsigned char* pixel_storage, int hints, fz_cookie* cookie)
 {
 	fz_irect bbox;
 	fz_pixmap* pix;
@@ -62,8 +69,12 @@ new_pixmap_from_display_list_with_separations_bbox_and_data(fz_context* ctx, fz_
 
 	fz_try(ctx)
 	{
-		dev = fz_new_draw_device(ctx, ctm, pix);
-		fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, cookie);
+		//Use the pixmap bounds as the scissor, so that display list nodes that do not touch this tile are skipped.
+		//Nodes that are painted over by a later opaque rectangle are skipped as well.
+		dev = fz_new_draw_device(ctx, fz_identity, pix);
+		if (hints)
+			fz_enable_device_hints(ctx, dev, hints);
+		fz_run_display_list_culled(ctx, list, dev, ctm, fz_rect_from_irect(bbox), cookie);
 		fz_close_device(ctx, dev);
 	}
 	fz_always(ctx)
@@ -99,8 +110,8 @@ new_pixmap_from_display_list_with_separations_bbox(fz_context* ctx, fz_display_l
 
 	fz_try(ctx)
 	{
-		dev = fz_new_draw_device(ctx, ctm, pix);
-		fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, NULL);
+		dev = fz_new_draw_device(ctx, fz_identity, pix);
+		fz_run_display_list_culled(ctx, list, dev, ctm, fz_rect_from_irect(bbox), NULL);
 		fz_close_device(ctx, dev);
 	}
 	fz_always(ctx)
@@ -116,46 +127,104 @@ new_pixmap_from_display_list_with_separations_bbox(fz_context* ctx, fz_display_l
 	return pix;
 }
 
+int get_color_format(fz_context* ctx, int colorFormat, fz_colorspace** out_cs, int* out_alpha)
+{
+	switch (colorFormat)
+	{
+	case COLOR_RGB:
+		*out_cs = fz_device_rgb(ctx);
+		*out_alpha = 0;
+		return 1;
+	case COLOR_RGBA:
+		*out_cs = fz_device_rgb(ctx);
+		*out_alpha = 1;
+		return 1;
+	case COLOR_BGR:
+		*out_cs = fz_device_bgr(ctx);
+		*out_alpha = 0;
+		return 1;
+	case COLOR_BGRA:
+		*out_cs = fz_device_bgr(ctx);
+		*out_alpha = 1;
+		return 1;
+	}
+	return 0;
+}
+
+int render_tile(fz_context* ctx, fz_display_list* list, fz_matrix ctm, fz_colorspace* cs, int alpha, const float* tile_rect, unsigned char* pixel_storage, fz_cookie* cookie)
+{
+	fz_pixmap* pix;
+	fz_rect rect;
+
+	rect.x0 = tile_rect[0];
+	rect.y0 = tile_rect[1];
+	rect.x1 = tile_rect[2];
+	rect.y1 = tile_rect[3];
+
+	fz_try(ctx)
+	{
+		pix = new_pixmap_from_display_list_with_separations_bbox_and_data(ctx, list, rect, ctm, cs, NULL, alpha, pixel_storage, 0, cookie);
+	}
+	fz_catch(ctx)
+	{
+		return ERR_CANNOT_RENDER;
+	}
+
+	fz_drop_pixmap(ctx, pix);
+
+	return EXIT_SUCCESS;
+}
+
+//Thread pool for fz_draw_display_list_banded: user points to the number of threads to use, including the calling thread.
+void run_band_pool(void* user, int count, void (*fn)(void* arg, int i), void* arg)
+{
+	int thread_count = *(int*)user;
+	std::atomic<int> next_band(0);
+
+	auto worker = [&]()
+	{
+		int i;
+
+		while ((i = next_band++) < count)
+		{
+			fn(arg, i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	// If no more threads can be started, the ones that did and this one share the bands.
+	try
+	{
+		for (int i = 1; i < thread_count && i < count; i++)
+		{
+			threads.emplace_back(worker);
+		}
+	}
+	catch (...)
+	{
+	}
+
+	worker();
+
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+}
+
 void lock_mutex(void* user, int lock)
 {
 	mutex_holder* mutex = (mutex_holder*)user;
 
-	switch (lock)
-	{
-	case 0:
-		mutex->mutex0.lock();
-		break;
-	case 1:
-		mutex->mutex1.lock();
-		break;
-	case 2:
-		mutex->mutex2.lock();
-		break;
-	default:
-		mutex->mutex3.lock();
-		break;
-	}
+	mutex->mutex[lock].lock();
 }
 
 void unlock_mutex(void* user, int lock)
 {
 	mutex_holder* mutex = (mutex_holder*)user;
 
-	switch (lock)
-	{
-	case 0:
-		mutex->mutex0.unlock();
-		break;
-	case 1:
-		mutex->mutex1.unlock();
-		break;
-	case 2:
-		mutex->mutex2.unlock();
-		break;
-	default:
-		mutex->mutex3.unlock();
-		break;
-	}
+	mutex->mutex[lock].unlock();
 }
 
 // Font for Android
@@ -408,6 +477,212 @@ fz_font *load_droid_font(fz_context *ctx, const char *name, int bold, int italic
 	return NULL;
 }
 
+// Stream filter that reports how far the document has been read and throws when the open is aborted.
+// Data is handed out straight from the chained stream's buffer, which only this filter reads, so nothing is copied.
+struct progress_filter
+{
+	fz_stream* chain;
+	document_open_progress* progress;
+};
+
+static int next_progress(fz_context* ctx, fz_stream* stm, size_t max)
+{
+	progress_filter* state = (progress_filter*)stm->state;
+	size_t n;
+
+	if (state->progress != NULL && state->progress->abort)
+		fz_throw(ctx, FZ_ERROR_ABORT, "document open aborted");
+
+	n = fz_available(ctx, state->chain, max);
+	if (n == 0)
+		return EOF;
+
+	stm->rp = state->chain->rp;
+	stm->wp = stm->rp + n;
+	state->chain->rp += n;
+	stm->pos += n;
+
+	if (state->progress != NULL && stm->pos > state->progress->bytes_read)
+		state->progress->bytes_read = stm->pos;
+
+	return *stm->rp++;
+}
+
+static void seek_progress(fz_context* ctx, fz_stream* stm, int64_t offset, int whence)
+{
+	progress_filter* state = (progress_filter*)stm->state;
+
+	fz_seek(ctx, state->chain, offset, whence);
+	stm->pos = fz_tell(ctx, state->chain);
+	stm->rp = state->chain->rp;
+	stm->wp = state->chain->rp;
+}
+
+static void drop_progress(fz_context* ctx, void* state_)
+{
+	progress_filter* state = (progress_filter*)state_;
+	fz_drop_stream(ctx, state->chain);
+	fz_free(ctx, state);
+}
+
+static fz_stream* open_progress_filter(fz_context* ctx, fz_stream* chain, document_open_progress* progress, progress_filter** out_state)
+{
+	progress_filter* state = fz_malloc_struct(ctx, progress_filter);
+	fz_stream* stm;
+
+	state->chain = fz_keep_stream(ctx, chain);
+	state->progress = progress;
+
+	fz_try(ctx)
+	{
+		stm = fz_new_stream(ctx, state, next_progress, drop_progress);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_stream(ctx, state->chain);
+		fz_free(ctx, state);
+		fz_rethrow(ctx);
+	}
+
+	stm->seek = seek_progress;
+	*out_state = state;
+
+	return stm;
+}
+
+struct open_document_task
+{
+	std::thread thread;
+	fz_context* ctx;
+	char* file_name;
+	const unsigned char* data;
+	uint64_t data_length;
+	char* file_type;
+	document_open_progress* progress;
+	fz_document* doc;
+	int page_count;
+	int result;
+};
+
+static void open_document_worker(open_document_task* task)
+{
+	fz_context* ctx = task->ctx;
+	fz_stream* chain = NULL;
+	fz_stream* stm = NULL;
+	progress_filter* filter = NULL;
+	fz_document* doc = NULL;
+
+	fz_var(chain);
+	fz_var(stm);
+	fz_var(filter);
+	fz_var(doc);
+
+	task->result = EXIT_SUCCESS;
+
+	fz_try(ctx)
+	{
+		if (task->data != NULL)
+			chain = fz_open_memory(ctx, task->data, task->data_length);
+		else
+			chain = fz_open_file(ctx, task->file_name);
+
+		fz_seek(ctx, chain, 0, SEEK_END);
+		task->progress->total_bytes = fz_tell(ctx, chain);
+		fz_seek(ctx, chain, 0, SEEK_SET);
+
+		stm = open_progress_filter(ctx, chain, task->progress, &filter);
+	}
+	fz_catch(ctx)
+	{
+		task->result = task->data != NULL ? ERR_CANNOT_OPEN_STREAM : ERR_CANNOT_OPEN_FILE;
+	}
+
+	if (task->result == EXIT_SUCCESS)
+	{
+		fz_try(ctx)
+		{
+			doc = fz_open_document_with_stream(ctx, task->file_type != NULL ? task->file_type : task->file_name, stm);
+
+			pdf_document* pdf = pdf_specifics(ctx, doc);
+			if (pdf != NULL)
+				task->progress->object_count = pdf_xref_len(ctx, pdf);
+		}
+		fz_catch(ctx)
+		{
+			task->result = ERR_CANNOT_OPEN_FILE;
+		}
+	}
+
+	if (task->result == EXIT_SUCCESS)
+	{
+		fz_try(ctx)
+		{
+			task->page_count = fz_count_pages(ctx, doc);
+		}
+		fz_catch(ctx)
+		{
+			task->result = ERR_CANNOT_COUNT_PAGES;
+		}
+	}
+
+	if (task->result != EXIT_SUCCESS && task->progress->abort)
+	{
+		task->result = ERR_OPEN_ABORTED;
+	}
+
+	if (task->result != EXIT_SUCCESS)
+	{
+		fz_drop_document(ctx, doc);
+		doc = NULL;
+	}
+
+	//The document keeps reading through the filter after this, so it must stop referring to the caller's progress object, which may be freed once done is set.
+	if (filter != NULL)
+	{
+		filter->progress = NULL;
+	}
+
+	fz_drop_stream(ctx, stm);
+	fz_drop_stream(ctx, chain);
+
+	task->doc = doc;
+	task->progress->done = 1;
+}
+
+/* Hand a loaded display list back along with its bounds, or drop it. */
+static int return_loaded_display_list(fz_context* ctx, fz_display_list* list, fz_display_list** out_display_list, float* out_x0, float* out_y0, float* out_x1, float* out_y1)
+{
+	fz_rect bounds;
+	fz_device* bbox = NULL;
+
+	fz_var(bbox);
+
+	fz_try(ctx)
+	{
+		bbox = fz_new_bbox_device(ctx, &bounds);
+		fz_run_display_list(ctx, list, bbox, fz_identity, fz_infinite_rect, NULL);
+		fz_close_device(ctx, bbox);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, bbox);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		return ERR_CANNOT_COMPUTE_BOUNDS;
+	}
+
+	*out_display_list = list;
+
+	*out_x0 = bounds.x0;
+	*out_y0 = bounds.y0;
+	*out_x1 = bounds.x1;
+	*out_y1 = bounds.y1;
+
+	return EXIT_SUCCESS;
+}
+
 extern "C"
 {
 	DLL_PUBLIC int GetPermissions(fz_context* ctx, fz_document* doc)
@@ -666,6 +941,154 @@ extern "C"
 		return EXIT_SUCCESS;
 	}
 
+	DLL_PUBLIC int GetStructuredTextPageBuffer(fz_context* ctx, fz_stext_page* page, const fz_buffer** out_buffer, const unsigned char** out_data, uint64_t* out_length)
+	{
+		stext_buffer_header header = { 0 };
+
+		//First pass: count everything so that the buffer can be allocated in one go.
+		for (fz_stext_block* block = page->first_block; block != nullptr; block = block->next)
+		{
+			header.block_count++;
+
+			if (block->type == FZ_STEXT_BLOCK_TEXT)
+			{
+				for (fz_stext_line* line = block->u.t.first_line; line != nullptr; line = line->next)
+				{
+					header.line_count++;
+
+					for (fz_stext_char* ch = line->first_char; ch != nullptr; ch = ch->next)
+					{
+						header.char_count++;
+					}
+				}
+			}
+		}
+
+		size_t offset = sizeof(stext_buffer_header);
+
+		auto place = [&offset](int32_t* field, size_t count, size_t item_size)
+		{
+			*field = (int32_t)offset;
+			offset += count * item_size;
+		};
+
+		place(&header.block_types, header.block_count, sizeof(int32_t));
+		place(&header.block_bboxes, header.block_count, 4 * sizeof(float));
+		place(&header.block_lines, header.block_count + 1, sizeof(int32_t));
+		place(&header.line_wmodes, header.line_count, sizeof(int32_t));
+		place(&header.line_bboxes, header.line_count, 4 * sizeof(float));
+		place(&header.line_dirs, header.line_count, 2 * sizeof(float));
+		place(&header.line_chars, header.line_count + 1, sizeof(int32_t));
+		place(&header.char_codepoints, header.char_count, sizeof(int32_t));
+		place(&header.char_colors, header.char_count, sizeof(int32_t));
+		place(&header.char_origins, header.char_count, 2 * sizeof(float));
+		place(&header.char_sizes, header.char_count, sizeof(float));
+		place(&header.char_quads, header.char_count, 8 * sizeof(float));
+
+		if (offset > INT32_MAX)
+		{
+			return ERR_CANNOT_CREATE_BUFFER;
+		}
+
+		header.version = STEXT_BUFFER_VERSION;
+		header.header_size = sizeof(stext_buffer_header);
+
+		unsigned char* data;
+		fz_buffer* buf;
+
+		fz_try(ctx)
+		{
+			data = (unsigned char*)fz_calloc(ctx, offset, 1);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_CREATE_BUFFER;
+		}
+
+		// The buffer takes ownership of data, and frees it if it cannot be created.
+		fz_try(ctx)
+		{
+			buf = fz_new_buffer_from_data(ctx, data, offset);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_CREATE_BUFFER;
+		}
+
+		memcpy(data, &header, sizeof(stext_buffer_header));
+
+		int32_t* block_types = (int32_t*)(data + header.block_types);
+		float* block_bboxes = (float*)(data + header.block_bboxes);
+		int32_t* block_lines = (int32_t*)(data + header.block_lines);
+		int32_t* line_wmodes = (int32_t*)(data + header.line_wmodes);
+		float* line_bboxes = (float*)(data + header.line_bboxes);
+		float* line_dirs = (float*)(data + header.line_dirs);
+		int32_t* line_chars = (int32_t*)(data + header.line_chars);
+		int32_t* char_codepoints = (int32_t*)(data + header.char_codepoints);
+		int32_t* char_colors = (int32_t*)(data + header.char_colors);
+		float* char_origins = (float*)(data + header.char_origins);
+		float* char_sizes = (float*)(data + header.char_sizes);
+		float* char_quads = (float*)(data + header.char_quads);
+
+		//Second pass: fill the arrays.
+		int b = 0;
+		int l = 0;
+		int c = 0;
+
+		for (fz_stext_block* block = page->first_block; block != nullptr; block = block->next, b++)
+		{
+			block_types[b] = block->type;
+			block_bboxes[b * 4 + 0] = block->bbox.x0;
+			block_bboxes[b * 4 + 1] = block->bbox.y0;
+			block_bboxes[b * 4 + 2] = block->bbox.x1;
+			block_bboxes[b * 4 + 3] = block->bbox.y1;
+			block_lines[b] = l;
+
+			if (block->type != FZ_STEXT_BLOCK_TEXT)
+			{
+				continue;
+			}
+
+			for (fz_stext_line* line = block->u.t.first_line; line != nullptr; line = line->next, l++)
+			{
+				line_wmodes[l] = line->wmode;
+				line_bboxes[l * 4 + 0] = line->bbox.x0;
+				line_bboxes[l * 4 + 1] = line->bbox.y0;
+				line_bboxes[l * 4 + 2] = line->bbox.x1;
+				line_bboxes[l * 4 + 3] = line->bbox.y1;
+				line_dirs[l * 2 + 0] = line->dir.x;
+				line_dirs[l * 2 + 1] = line->dir.y;
+				line_chars[l] = c;
+
+				for (fz_stext_char* ch = line->first_char; ch != nullptr; ch = ch->next, c++)
+				{
+					char_codepoints[c] = ch->c;
+					char_colors[c] = ch->color;
+					char_origins[c * 2 + 0] = ch->origin.x;
+					char_origins[c * 2 + 1] = ch->origin.y;
+					char_sizes[c] = ch->size;
+					char_quads[c * 8 + 0] = ch->quad.ul.x;
+					char_quads[c * 8 + 1] = ch->quad.ul.y;
+					char_quads[c * 8 + 2] = ch->quad.ur.x;
+					char_quads[c * 8 + 3] = ch->quad.ur.y;
+					char_quads[c * 8 + 4] = ch->quad.ll.x;
+					char_quads[c * 8 + 5] = ch->quad.ll.y;
+					char_quads[c * 8 + 6] = ch->quad.lr.x;
+					char_quads[c * 8 + 7] = ch->quad.lr.y;
+				}
+			}
+		}
+
+		block_lines[b] = l;
+		line_chars[l] = c;
+
+		*out_buffer = buf;
+		*out_data = data;
+		*out_length = offset;
+
+		return EXIT_SUCCESS;
+	}
+
 	typedef int (*progressCallback)(int progress);
 
 	int progressFunction(fz_context* ctx, void* progress_arg, int progress)
@@ -1124,24 +1547,10 @@ extern "C"
 		fz_rect rect;
 		int alpha;
 		fz_colorspace* cs;
-		switch (colorFormat)
+
+		if (!get_color_format(ctx, colorFormat, &cs, &alpha))
 		{
-		case COLOR_RGB:
-			cs = fz_device_rgb(ctx);
-			alpha = 0;
-			break;
-		case COLOR_RGBA:
-			cs = fz_device_rgb(ctx);
-			alpha = 1;
-			break;
-		case COLOR_BGR:
-			cs = fz_device_bgr(ctx);
-			alpha = 0;
-			break;
-		case COLOR_BGRA:
-			cs = fz_device_bgr(ctx);
-			alpha = 1;
-			break;
+			return ERR_CANNOT_RENDER;
 		}
 
 		ctm = fz_scale(zoom, zoom);
@@ -1154,7 +1563,7 @@ extern "C"
 		//Render page to an RGB/RGBA pixmap.
 		fz_try(ctx)
 		{
-			pix = new_pixmap_from_display_list_with_separations_bbox_and_data(ctx, list, rect, ctm, cs, NULL, alpha, pixel_storage, cookie);
+			pix = new_pixmap_from_display_list_with_separations_bbox_and_data(ctx, list, rect, ctm, cs, NULL, alpha, pixel_storage, 0, cookie);
 		}
 		fz_catch(ctx)
 		{
@@ -1167,60 +1576,645 @@ extern "C"
 		return EXIT_SUCCESS;
 	}
 
-	DLL_PUBLIC int GetDisplayList(fz_context* ctx, fz_page* page, int annotations, fz_display_list** out_display_list, float* out_x0, float* out_y0, float* out_x1, float* out_y1)
+	DLL_PUBLIC int RenderSubDisplayListProgressive(fz_context* ctx, fz_display_list* list, float x0, float y0, float x1, float y1, float zoom, int colorFormat, float preview_scale, int preview_aa_level, unsigned char* preview_storage, unsigned char* pixel_storage, previewCallback callback, fz_cookie* cookie)
 	{
-		fz_display_list* list;
-		fz_rect bounds;
-		fz_device* bbox;
-
-		fz_try(ctx)
+		if (cookie != NULL && cookie->abort)
 		{
-			if (annotations == 1)
-			{
-				list = fz_new_display_list_from_page(ctx, page);
-			} else
-			{
-				list = fz_new_display_list_from_page_contents(ctx, page);
-			}
+			return EXIT_SUCCESS;
 		}
-		fz_catch(ctx)
+
+		fz_pixmap* pix;
+		fz_rect rect;
+		int alpha;
+		fz_colorspace* cs;
+		int graphics_aa;
+		int text_aa;
+
+		if (!get_color_format(ctx, colorFormat, &cs, &alpha))
 		{
 			return ERR_CANNOT_RENDER;
 		}
 
-		fz_var(bbox);
+		rect.x0 = x0;
+		rect.y0 = y0;
+		rect.x1 = x1;
+		rect.y1 = y1;
+
+		//Preview pass: lower resolution (so images are decoded with a larger subsampling factor and glyphs are rasterised at a smaller size), lower antialiasing and no image interpolation.
+		graphics_aa = fz_graphics_aa_level(ctx);
+		text_aa = fz_text_aa_level(ctx);
+
+		fz_var(pix);
+
+		pix = NULL;
 
 		fz_try(ctx)
 		{
-			bbox = fz_new_bbox_device(ctx, &bounds);
-			fz_run_display_list(ctx, list, bbox, fz_identity, fz_infinite_rect, NULL);
-			fz_close_device(ctx, bbox);
+			fz_set_aa_level(ctx, preview_aa_level);
+			pix = new_pixmap_from_display_list_with_separations_bbox_and_data(ctx, list, rect, fz_scale(zoom * preview_scale, zoom * preview_scale), cs, NULL, alpha, preview_storage, FZ_DONT_INTERPOLATE_IMAGES, cookie);
 		}
 		fz_always(ctx)
 		{
-			fz_drop_device(ctx, bbox);
+			fz_set_graphics_aa_level(ctx, graphics_aa);
+			fz_set_text_aa_level(ctx, text_aa);
 		}
 		fz_catch(ctx)
 		{
-			return ERR_CANNOT_COMPUTE_BOUNDS;
+			return ERR_CANNOT_RENDER;
 		}
 
-		*out_display_list = list;
-
-		*out_x0 = bounds.x0;
-		*out_y0 = bounds.y0;
-		*out_x1 = bounds.x1;
-		*out_y1 = bounds.y1;
+		int preview_width = pix->w;
+		int preview_height = pix->h;
 
-		return EXIT_SUCCESS;
-	}
+		fz_drop_pixmap(ctx, pix);
 
-	DLL_PUBLIC int DisposeDisplayList(fz_context* ctx, fz_display_list* list)
-	{
+		//Give the caller a chance to show the preview and to cancel the full quality pass.
+		if (cookie != NULL && cookie->abort)
+		{
+			return EXIT_SUCCESS;
+		}
+
+		if (callback != NULL && callback(preview_width, preview_height) != 0)
+		{
+			return EXIT_SUCCESS;
+		}
+
+		if (cookie != NULL && cookie->abort)
+		{
+			return EXIT_SUCCESS;
+		}
+
+		//Full quality pass.
+		fz_try(ctx)
+		{
+			pix = new_pixmap_from_display_list_with_separations_bbox_and_data(ctx, list, rect, fz_scale(zoom, zoom), cs, NULL, alpha, pixel_storage, 0, cookie);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		fz_drop_pixmap(ctx, pix);
+
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int RenderDisplayListTiles(fz_context* ctx, fz_display_list* list, float zoom, int colorFormat, int tile_count, const float* tile_rects, unsigned char** pixel_storage, fz_cookie* cookie)
+	{
+		fz_matrix ctm;
+		fz_colorspace* cs;
+		int alpha;
+
+		if (!get_color_format(ctx, colorFormat, &cs, &alpha))
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		ctm = fz_scale(zoom, zoom);
+
+		for (int i = 0; i < tile_count; i++)
+		{
+			if (cookie != NULL && cookie->abort)
+			{
+				return EXIT_SUCCESS;
+			}
+
+			int result = render_tile(ctx, list, ctm, cs, alpha, &tile_rects[i * 4], pixel_storage[i], cookie);
+
+			if (result != EXIT_SUCCESS)
+			{
+				return result;
+			}
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int RenderDisplayListTilesParallel(fz_context* ctx, fz_display_list* list, float zoom, int colorFormat, int tile_count, const float* tile_rects, unsigned char** pixel_storage, int thread_count, tileCallback callback, fz_cookie* cookie)
+	{
+		fz_matrix ctm;
+		fz_colorspace* cs;
+		int alpha;
+
+		if (!get_color_format(ctx, colorFormat, &cs, &alpha))
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		ctm = fz_scale(zoom, zoom);
+
+		if (thread_count <= 0)
+		{
+			thread_count = (int)std::thread::hardware_concurrency();
+		}
+
+		if (thread_count > tile_count)
+		{
+			thread_count = tile_count;
+		}
+
+		if (thread_count <= 1)
+		{
+			thread_count = 1;
+		}
+
+		//Each worker gets its own context; the display list itself can be shared between threads.
+		std::vector<fz_context*> contexts(thread_count, nullptr);
+
+		for (int i = 0; i < thread_count; i++)
+		{
+			contexts[i] = fz_clone_context(ctx);
+
+			if (contexts[i] == nullptr)
+			{
+				for (int j = 0; j < i; j++)
+				{
+					fz_drop_context(contexts[j]);
+				}
+				return ERR_CANNOT_CLONE_CONTEXT;
+			}
+		}
+
+		std::atomic<int> next_tile(0);
+		std::atomic<int> error(EXIT_SUCCESS);
+		std::mutex callback_mutex;
+
+		//Progress counters are not shared between threads, so each worker has its own cookie; the caller's abort flag is forwarded to them.
+		std::vector<fz_cookie> worker_cookies(thread_count);
+		std::mutex done_mutex;
+		std::condition_variable done_changed;
+		int done_count = 0;
+
+		for (int i = 0; i < thread_count; i++)
+		{
+			memset(&worker_cookies[i], 0, sizeof(fz_cookie));
+		}
+
+		auto worker = [&](fz_context* worker_ctx, fz_cookie* worker_cookie)
+		{
+			for (;;)
+			{
+				int i = next_tile++;
+
+				if (i >= tile_count || (cookie != NULL && cookie->abort))
+				{
+					break;
+				}
+
+				int result = render_tile(worker_ctx, list, ctm, cs, alpha, &tile_rects[i * 4], pixel_storage[i], worker_cookie);
+
+				if (result != EXIT_SUCCESS)
+				{
+					error = result;
+				}
+
+				if (callback != NULL)
+				{
+					std::lock_guard<std::mutex> guard(callback_mutex);
+					callback(i, result);
+				}
+			}
+		};
+
+		auto thread_worker = [&](int w)
+		{
+			worker(contexts[w], &worker_cookies[w]);
+
+			std::lock_guard<std::mutex> guard(done_mutex);
+			done_count++;
+			done_changed.notify_one();
+		};
+
+		std::vector<std::thread> threads;
+
+		//If threads cannot be started, the ones that did share out the tiles.
+		try
+		{
+			for (int i = 0; i < thread_count; i++)
+			{
+				threads.emplace_back(thread_worker, i);
+			}
+		}
+		catch (...)
+		{
+		}
+
+		if (threads.empty())
+		{
+			//No threads at all, so the calling thread draws every tile.
+			worker(contexts[0], cookie);
+		}
+		else
+		{
+			//The calling thread watches for the caller aborting while the workers draw.
+			std::unique_lock<std::mutex> lock(done_mutex);
+
+			while (done_count < (int)threads.size())
+			{
+				if (cookie != NULL && cookie->abort)
+				{
+					for (int i = 0; i < thread_count; i++)
+					{
+						worker_cookies[i].abort = 1;
+					}
+				}
+
+				done_changed.wait_for(lock, std::chrono::milliseconds(10));
+			}
+		}
+
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			threads[i].join();
+		}
+
+		for (int i = 0; i < thread_count; i++)
+		{
+			fz_drop_context(contexts[i]);
+		}
+
+		return error;
+	}
+
+	DLL_PUBLIC int RenderSubDisplayListBanded(fz_context* ctx, fz_display_list* list, float x0, float y0, float x1, float y1, float zoom, int colorFormat, unsigned char* pixel_storage, int thread_count, fz_cookie* cookie)
+	{
+		if (cookie != NULL && cookie->abort)
+		{
+			return EXIT_SUCCESS;
+		}
+
+		fz_matrix ctm;
+		fz_pixmap* pix;
+		fz_rect rect;
+		fz_irect bbox;
+		int alpha;
+		fz_colorspace* cs;
+		fz_band_pool pool;
+
+		if (!get_color_format(ctx, colorFormat, &cs, &alpha))
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		if (thread_count <= 0)
+		{
+			thread_count = (int)std::thread::hardware_concurrency();
+		}
+
+		pool.user = &thread_count;
+		pool.run = run_band_pool;
+
+		ctm = fz_scale(zoom, zoom);
+
+		rect.x0 = x0;
+		rect.y0 = y0;
+		rect.x1 = x1;
+		rect.y1 = y1;
+		bbox = fz_round_rect(fz_transform_rect(rect, ctm));
+
+		fz_try(ctx)
+		{
+			pix = new_pixmap_with_bbox_and_data(ctx, cs, bbox, NULL, alpha, pixel_storage);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		fz_try(ctx)
+		{
+			if (alpha)
+				fz_clear_pixmap(ctx, pix);
+			else
+				fz_clear_pixmap_with_value(ctx, pix, 0xFF);
+
+			fz_draw_display_list_banded(ctx, list, ctm, pix, 0, thread_count > 1 ? &pool : NULL, cookie);
+		}
+		fz_always(ctx)
+		{
+			fz_drop_pixmap(ctx, pix);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int RenderSubDisplayListTiled(fz_context* ctx, fz_display_list* list, float x0, float y0, float x1, float y1, float zoom, int colorFormat, unsigned char* pixel_storage, int tile_size, fz_cookie* cookie)
+	{
+		if (cookie != NULL && cookie->abort)
+		{
+			return EXIT_SUCCESS;
+		}
+
+		fz_matrix ctm;
+		fz_pixmap* pix;
+		fz_rect rect;
+		fz_irect bbox;
+		int alpha;
+		fz_colorspace* cs;
+
+		if (!get_color_format(ctx, colorFormat, &cs, &alpha))
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		ctm = fz_scale(zoom, zoom);
+
+		rect.x0 = x0;
+		rect.y0 = y0;
+		rect.x1 = x1;
+		rect.y1 = y1;
+		bbox = fz_round_rect(fz_transform_rect(rect, ctm));
+
+		fz_try(ctx)
+		{
+			pix = new_pixmap_with_bbox_and_data(ctx, cs, bbox, NULL, alpha, pixel_storage);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		fz_try(ctx)
+		{
+			if (alpha)
+				fz_clear_pixmap(ctx, pix);
+			else
+				fz_clear_pixmap_with_value(ctx, pix, 0xFF);
+
+			fz_draw_display_list_tiled(ctx, list, ctm, pix, tile_size, tile_size, cookie);
+		}
+		fz_always(ctx)
+		{
+			fz_drop_pixmap(ctx, pix);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int CreateGlyphAtlas(fz_context* ctx, int page_size, int aa_level, const fz_glyph_atlas** out_atlas)
+	{
+		fz_try(ctx)
+		{
+			*out_atlas = fz_new_glyph_atlas(ctx, page_size, aa_level);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_CREATE_ATLAS;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int DisposeGlyphAtlas(fz_context* ctx, fz_glyph_atlas* atlas)
+	{
+		fz_drop_glyph_atlas(ctx, atlas);
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int RenderSubDisplayListWithGlyphAtlas(fz_context* ctx, fz_display_list* list, float x0, float y0, float x1, float y1, float zoom, int colorFormat, fz_glyph_atlas* atlas, unsigned char* pixel_storage, const fz_glyph_instance** out_instances, int* out_instance_count, fz_cookie* cookie)
+	{
+		fz_matrix ctm;
+		fz_rect rect;
+		fz_irect bbox;
+		fz_pixmap* pix = NULL;
+		fz_device* draw = NULL;
+		fz_device* dev = NULL;
+		fz_glyph_instance_list instances = { 0 };
+		int alpha;
+		fz_colorspace* cs;
+
+		*out_instances = NULL;
+		*out_instance_count = 0;
+
+		if (cookie != NULL && cookie->abort)
+		{
+			return EXIT_SUCCESS;
+		}
+
+		if (!get_color_format(ctx, colorFormat, &cs, &alpha))
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		ctm = fz_scale(zoom, zoom);
+
+		rect.x0 = x0;
+		rect.y0 = y0;
+		rect.x1 = x1;
+		rect.y1 = y1;
+		bbox = fz_round_rect(fz_transform_rect(rect, ctm));
+
+		fz_var(pix);
+		fz_var(draw);
+		fz_var(dev);
+
+		fz_try(ctx)
+		{
+			//Everything that does not become a glyph instance is drawn into the pixels, if we have any.
+			if (pixel_storage != NULL)
+			{
+				pix = new_pixmap_with_bbox_and_data(ctx, cs, bbox, NULL, alpha, pixel_storage);
+				if (alpha)
+					fz_clear_pixmap(ctx, pix);
+				else
+					fz_clear_pixmap_with_value(ctx, pix, 0xFF);
+				draw = fz_new_draw_device(ctx, fz_identity, pix);
+			}
+
+			//Translating by whole pixels keeps the glyphs' subpixel positions, and makes the instances relative to the region.
+			dev = fz_new_glyph_atlas_device(ctx, atlas, fz_translate(-bbox.x0, -bbox.y0), &instances, draw);
+			fz_run_display_list(ctx, list, dev, ctm, fz_rect_from_irect(bbox), cookie);
+			fz_close_device(ctx, dev);
+			if (draw != NULL)
+				fz_close_device(ctx, draw);
+		}
+		fz_always(ctx)
+		{
+			fz_drop_device(ctx, dev);
+			fz_drop_device(ctx, draw);
+			fz_drop_pixmap(ctx, pix);
+		}
+		fz_catch(ctx)
+		{
+			fz_clear_glyph_instance_list(ctx, &instances);
+			return ERR_CANNOT_RENDER;
+		}
+
+		*out_instances = instances.instance;
+		*out_instance_count = instances.len;
+
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int DisposeGlyphInstances(fz_context* ctx, fz_glyph_instance* instances)
+	{
+		fz_free(ctx, instances);
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int GetGlyphAtlasPage(fz_context* ctx, fz_glyph_atlas* atlas, int page, const unsigned char** out_data, int* out_size, int* out_dirty_x0, int* out_dirty_y0, int* out_dirty_x1, int* out_dirty_y1)
+	{
+		fz_pixmap* pix;
+		fz_irect dirty;
+
+		fz_try(ctx)
+		{
+			pix = fz_glyph_atlas_page(ctx, atlas, page);
+			dirty = fz_glyph_atlas_take_dirty(ctx, atlas, page);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		*out_data = pix->samples;
+		*out_size = pix->w;
+		*out_dirty_x0 = dirty.x0;
+		*out_dirty_y0 = dirty.y0;
+		*out_dirty_x1 = dirty.x1;
+		*out_dirty_y1 = dirty.y1;
+
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int GetGlyphAtlasSlots(fz_context* ctx, fz_glyph_atlas* atlas, const fz_glyph_atlas_slot** out_slots, int* out_slot_count, int* out_page_count)
+	{
+		*out_slots = fz_glyph_atlas_slots(ctx, atlas, out_slot_count);
+		*out_page_count = fz_glyph_atlas_page_count(ctx, atlas);
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int GetDisplayList(fz_context* ctx, fz_page* page, int annotations, fz_display_list** out_display_list, float* out_x0, float* out_y0, float* out_x1, float* out_y1)
+	{
+		fz_display_list* list;
+		fz_rect bounds;
+		fz_device* bbox;
+
+		fz_try(ctx)
+		{
+			list = fz_get_display_list(ctx, page, annotations == 1, 0);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_RENDER;
+		}
+
+		fz_var(bbox);
+
+		fz_try(ctx)
+		{
+			bbox = fz_new_bbox_device(ctx, &bounds);
+			fz_run_display_list(ctx, list, bbox, fz_identity, fz_infinite_rect, NULL);
+			fz_close_device(ctx, bbox);
+		}
+		fz_always(ctx)
+		{
+			fz_drop_device(ctx, bbox);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_COMPUTE_BOUNDS;
+		}
+
+		*out_display_list = list;
+
+		*out_x0 = bounds.x0;
+		*out_y0 = bounds.y0;
+		*out_x1 = bounds.x1;
+		*out_y1 = bounds.y1;
+
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int DisposeDisplayList(fz_context* ctx, fz_display_list* list)
+	{
 		fz_drop_display_list(ctx, list);
 		return EXIT_SUCCESS;
 	}
 
+	DLL_PUBLIC int SaveDisplayList(fz_context* ctx, fz_display_list* list, const char* file_name)
+	{
+		fz_try(ctx)
+		{
+			fz_save_display_list(ctx, list, file_name);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_SAVE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int LoadDisplayList(fz_context* ctx, const char* file_name, fz_display_list** out_display_list, float* out_x0, float* out_y0, float* out_x1, float* out_y1)
+	{
+		fz_display_list* list;
+
+		fz_try(ctx)
+		{
+			list = fz_load_display_list(ctx, file_name);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_OPEN_FILE;
+		}
+
+		return return_loaded_display_list(ctx, list, out_display_list, out_x0, out_y0, out_x1, out_y1);
+	}
+
+	DLL_PUBLIC int LoadDisplayListFromMemory(fz_context* ctx, const unsigned char* data, size_t length, fz_display_list** out_display_list, float* out_x0, float* out_y0, float* out_x1, float* out_y1)
+	{
+		fz_display_list* list;
+
+		fz_try(ctx)
+		{
+			list = fz_new_display_list_from_data(ctx, data, length);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_OPEN_STREAM;
+		}
+
+		return return_loaded_display_list(ctx, list, out_display_list, out_x0, out_y0, out_x1, out_y1);
+	}
+
+	DLL_PUBLIC int CompactDisplayList(fz_context* ctx, fz_display_list* list, size_t* out_size)
+	{
+		fz_try(ctx)
+		{
+			fz_compact_display_list(ctx, list);
+			*out_size = fz_display_list_size(ctx, list);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_COMPACT_DISPLAY_LIST;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int GetDisplayListSize(fz_context* ctx, fz_display_list* list, size_t* out_size)
+	{
+		fz_try(ctx)
+		{
+			*out_size = fz_display_list_size(ctx, list);
+		}
+		fz_catch(ctx)
+		{
+			return ERR_CANNOT_MEASURE_DISPLAY_LIST;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
 	DLL_PUBLIC int LoadPage(fz_context* ctx, fz_document* doc, int page_number, const fz_page** out_page, float* out_x, float* out_y, float* out_w, float* out_h)
 	{
 		fz_page* page;
@@ -1421,6 +2415,88 @@ extern "C"
 		return EXIT_SUCCESS;
 	}
 
+	DLL_PUBLIC int OpenDocumentAsync(fz_context* ctx, const char* file_name, const unsigned char* data, const uint64_t data_length, const char* file_type, document_open_progress* progress, open_document_task** out_task)
+	{
+		open_document_task* task;
+
+		progress->done = 0;
+		progress->bytes_read = 0;
+		progress->total_bytes = -1;
+		progress->object_count = 0;
+
+		task = new (std::nothrow) open_document_task();
+
+		if (task == nullptr)
+		{
+			return ERR_CANNOT_OPEN_FILE;
+		}
+
+		task->ctx = fz_clone_context(ctx);
+
+		if (task->ctx == nullptr)
+		{
+			delete task;
+			return ERR_CANNOT_CLONE_CONTEXT;
+		}
+
+		fz_try(ctx)
+		{
+			task->file_name = file_name != NULL ? fz_strdup(ctx, file_name) : NULL;
+			task->file_type = file_type != NULL ? fz_strdup(ctx, file_type) : NULL;
+		}
+		fz_catch(ctx)
+		{
+			fz_free(ctx, task->file_name);
+			fz_drop_context(task->ctx);
+			delete task;
+			return ERR_CANNOT_OPEN_FILE;
+		}
+
+		task->data = data;
+		task->data_length = data_length;
+		task->progress = progress;
+		task->doc = NULL;
+		task->page_count = 0;
+		task->result = EXIT_SUCCESS;
+
+		try
+		{
+			task->thread = std::thread(open_document_worker, task);
+		}
+		catch (...)
+		{
+			fz_free(ctx, task->file_name);
+			fz_free(ctx, task->file_type);
+			fz_drop_context(task->ctx);
+			delete task;
+			return ERR_CANNOT_OPEN_FILE;
+		}
+
+		*out_task = task;
+
+		return EXIT_SUCCESS;
+	}
+
+	DLL_PUBLIC int FinishOpenDocumentAsync(fz_context* ctx, open_document_task* task, const fz_document** out_doc, int* out_page_count)
+	{
+		task->thread.join();
+
+		int result = task->result;
+
+		if (result == EXIT_SUCCESS)
+		{
+			*out_doc = task->doc;
+			*out_page_count = task->page_count;
+		}
+
+		fz_free(ctx, task->file_name);
+		fz_free(ctx, task->file_type);
+		fz_drop_context(task->ctx);
+		delete task;
+
+		return result;
+	}
+
 	DLL_PUBLIC int DisposeStream(fz_context* ctx, fz_stream* str)
 	{
 		fz_drop_stream(ctx, str);
@@ -363,6 +363,14 @@ static int invert = 0;
 static int fz_kill = 0;
 static int band_height = 0;
 static int lowmemory = 0;
+static int page_format = PAGE_FORMAT_PNG;
+static StorePressureFn *store_pressure = NULL;
+static void *store_pressure_opaque = NULL;
+static int page_workers = 0;
+static PageReadyFn *page_ready = NULL;
+static void *page_ready_opaque = NULL;
+static const int *page_order = NULL;
+static int page_order_count = 0;
 
 static int quiet = 0;
 static int errored = 0;
@@ -640,8 +648,11 @@ static void apply_kill_switch(fz_device *dev)
 static void drawband(fz_context *ctx, fz_page *page, fz_display_list *list, fz_matrix ctm, fz_rect tbounds, fz_cookie *cookie, int band_start, fz_pixmap *pix, fz_bitmap **bit)
 {
     fz_device *dev = NULL;
+    fz_pixmap_pipeline *pipe = NULL;
+    int halftone;
 
     fz_var(dev);
+    fz_var(pipe);
 
     *bit = NULL;
 
@@ -666,13 +677,23 @@ static void drawband(fz_context *ctx, fz_page *page, fz_display_list *list, fz_m
         fz_drop_device(ctx, dev);
         dev = NULL;
 
-        if (invert)
-            fz_invert_pixmap(ctx, pix);
-        if (gamma_value != 1)
-            fz_gamma_pixmap(ctx, pix, gamma_value);
-
-        if (((output_format == OUT_PCL || output_format == OUT_PWG) && out_cs == CS_MONO) || (output_format == OUT_PBM) || (output_format == OUT_PKM))
-            *bit = fz_new_bitmap_from_pixmap_band(ctx, pix, NULL, band_start);
+        /* Invert, gamma correct and halftone in a single pass over the band. */
+        halftone = ((output_format == OUT_PCL || output_format == OUT_PWG) && out_cs == CS_MONO) || (output_format == OUT_PBM) || (output_format == OUT_PKM);
+        if (invert || gamma_value != 1 || halftone)
+        {
+            pipe = fz_new_pixmap_pipeline(ctx);
+            if (invert)
+                fz_pipeline_invert(ctx, pipe);
+            if (gamma_value != 1)
+                fz_pipeline_gamma(ctx, pipe, gamma_value);
+            if (halftone)
+                fz_pipeline_halftone(ctx, pipe, NULL);
+            fz_drop_pixmap(ctx, fz_run_pixmap_pipeline(ctx, pipe, pix, band_start, bit));
+        }
+    }
+    fz_always(ctx)
+    {
+        fz_drop_pixmap_pipeline(ctx, pipe);
     }
     fz_catch(ctx)
     {
@@ -1336,6 +1357,106 @@ static void bgprint_flush(void)
     bgprint.started = 0;
 }
 
+/* The pixel bounds of a page at the given resolution and rotation. */
+static fz_irect page_pixel_bounds(fz_context *ctx, fz_rect mediabox, float res, float rot, fz_matrix *ctm)
+{
+    float zoom = res / 72;
+
+    *ctm = fz_pre_scale(fz_rotate(rot), zoom, zoom);
+    return fz_round_rect(fz_transform_rect(mediabox, *ctm));
+}
+
+static size_t page_pixel_size(fz_context *ctx, fz_irect ibounds, int *stride)
+{
+    int w = ibounds.x1 - ibounds.x0;
+    int h = ibounds.y1 - ibounds.y0;
+
+    if (w <= 0 || h <= 0)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "page has empty bounds");
+    if (w > INT_MAX / 4)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "page too wide");
+    *stride = w * 4;
+    if ((size_t)h > SIZE_MAX / (size_t)*stride)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "page too large");
+    return (size_t)*stride * h;
+}
+
+/*
+    Render a page straight into 4 byte per pixel (RGBA or BGRA) samples,
+    with no intermediate pixmap and no image encoding. The samples are
+    premultiplied; with bg_alpha unset the background is opaque white.
+*/
+static void render_page_pixels(fz_context *ctx, fz_page *page, fz_display_list *list, fz_matrix ctm, fz_irect ibounds, int format, int bg_alpha, fz_colorspace *proof, int hints, unsigned char *samples, fz_cookie *cookie)
+{
+    fz_colorspace *cs = (format == PAGE_FORMAT_BGRA) ? fz_device_bgr(ctx) : fz_device_rgb(ctx);
+    fz_pixmap *pix;
+    fz_device *dev = NULL;
+
+    fz_var(dev);
+
+    pix = fz_new_pixmap_with_bbox_and_data(ctx, cs, ibounds, NULL, 1, samples);
+    fz_try(ctx)
+    {
+        if (bg_alpha)
+            fz_clear_pixmap(ctx, pix);
+        else
+            fz_clear_pixmap_with_value(ctx, pix, 255);
+
+        dev = fz_new_draw_device_with_proof(ctx, fz_identity, pix, proof);
+        if (hints)
+            fz_enable_device_hints(ctx, dev, hints);
+        if (list)
+            fz_run_display_list(ctx, list, dev, ctm, fz_rect_from_irect(ibounds), cookie);
+        else
+            fz_run_page(ctx, page, dev, ctm, cookie);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx)
+    {
+        fz_rethrow(ctx);
+    }
+}
+
+static void drawpage_pixels(fz_context *ctx, fz_page *page, fz_display_list *list, fz_cookie *cookie, Page *result)
+{
+    fz_matrix ctm;
+    fz_irect ibounds;
+    fz_rect mediabox;
+    unsigned char *samples;
+    size_t len;
+    int stride;
+
+    mediabox = list ? fz_bound_display_list(ctx, list) : fz_bound_page(ctx, page);
+    ibounds = page_pixel_bounds(ctx, mediabox, resolution, rotation, &ctm);
+    len = page_pixel_size(ctx, ibounds, &stride);
+    if (len > INT_MAX)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "page too large");
+
+    samples = (unsigned char *)malloc(len);
+    if (!samples)
+        fz_throw(ctx, FZ_ERROR_MEMORY, "cannot allocate page pixels");
+
+    fz_try(ctx)
+        render_page_pixels(ctx, page, list, ctm, ibounds, page_format, 0, proof_cs, lowmemory ? FZ_NO_CACHE : 0, samples, cookie);
+    fz_catch(ctx)
+    {
+        free(samples);
+        fz_rethrow(ctx);
+    }
+
+    result->data = samples;
+    result->len = (int)len;
+    result->width = ibounds.x1 - ibounds.x0;
+    result->height = ibounds.y1 - ibounds.y0;
+    result->stride = stride;
+    result->format = page_format;
+}
+
 static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, PageList *pagelist)
 {
     fz_page *page;
@@ -1425,6 +1546,25 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, PageList *p
         }
     }
 
+    if (page_format != PAGE_FORMAT_PNG)
+    {
+        if (!quiet)
+            fprintf(stderr, "page %s %d\n", filename, pagenum);
+        fz_try(ctx)
+            drawpage_pixels(ctx, page, list, &cookie, &pagelist->pages[pagenum - 1]);
+        fz_always(ctx)
+        {
+            fz_drop_display_list(ctx, list);
+            fz_drop_separations(ctx, seps);
+            fz_drop_page(ctx, page);
+        }
+        fz_catch(ctx)
+        {
+            fz_rethrow(ctx);
+        }
+        return;
+    }
+
     if (showfeatures)
     {
         int iscolor;
@@ -1513,12 +1653,16 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, PageList *p
             dodrawpage(ctx, page, list, pagenum, &cookie, start, 0, filename, 0, seps);
             // fz_close_output(ctx, out);
 
-            Page *page = &pagelist->pages[pagenum - 1];
-            page->height = 100;
-            page->width = 100;
-            page->len = (int)buf->len;
-            page->data = (unsigned char *)malloc(buf->len);
-            memcpy(page->data, buf->data, buf->len);
+            Page *result = &pagelist->pages[pagenum - 1];
+            fz_matrix ctm;
+            fz_irect ibounds = page_pixel_bounds(ctx, list ? fz_bound_display_list(ctx, list) : fz_bound_page(ctx, page), resolution, rotation, &ctm);
+            result->width = ibounds.x1 - ibounds.x0;
+            result->height = ibounds.y1 - ibounds.y0;
+            result->stride = 0;
+            result->format = PAGE_FORMAT_PNG;
+            result->len = (int)buf->len;
+            result->data = (unsigned char *)malloc(buf->len);
+            memcpy(result->data, buf->data, buf->len);
         }
         fz_always(ctx)
         {
@@ -1538,48 +1682,384 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, PageList *p
     }
 }
 
+/* Give the caller a chance to trim the store between pages. Resources
+ * are otherwise kept so that later pages can reuse them. */
+static void relieve_store_pressure(fz_context *ctx)
+{
+    size_t size, max;
+    int percent;
+
+    if (!store_pressure)
+        return;
+
+    fz_store_usage(ctx, &size, &max);
+    percent = store_pressure(store_pressure_opaque, size, max);
+    if (percent >= 0 && percent < 100)
+        fz_shrink_store(ctx, (unsigned int)percent);
+}
+
+/* In streaming mode, hand a finished page to the caller and release it
+ * straight away. Returns non-zero if the caller asked us to stop. */
+static int deliver_page(int pagenum, Page *result)
+{
+    int stop = 0;
+
+    if (!page_ready)
+        return 0;
+
+    if (result->data)
+        stop = page_ready(page_ready_opaque, pagenum - 1, result);
+    free(result->data);
+    memset(result, 0, sizeof(*result));
+
+    return stop;
+}
+
+/*
+    Page level parallelism: rather than splitting one page into bands,
+    each worker takes whole pages off a shared queue. Interpretation
+    still has to be serialised because the document is not thread
+    safe, but rasterisation and encoding of one page overlap with the
+    interpretation of the next.
+*/
+typedef struct page_worker_t
+{
+    fz_context *ctx;
+    int num;
+#ifndef DISABLE_MUTHREADS
+    mu_thread thread;
+#endif
+} page_worker_t;
+
+static struct
+{
+    fz_document *doc;
+    PageList *pagelist;
+    int *pages;
+    int count;
+    int next;
+    int error;
+#ifndef DISABLE_MUTHREADS
+    mu_mutex queue_mutex;   /* protects next and error */
+    mu_mutex doc_mutex;     /* protects doc */
+    mu_mutex deliver_mutex; /* serialises page_ready callbacks */
+    mu_mutex pressure_mutex; /* serialises store_pressure callbacks */
+#endif
+} page_pool;
+
+#ifndef DISABLE_MUTHREADS
+static fz_display_list *page_pool_load(fz_context *ctx, int pagenum)
+{
+    fz_page *page = NULL;
+    fz_display_list *list = NULL;
+    fz_device *dev = NULL;
+
+    fz_var(page);
+    fz_var(list);
+    fz_var(dev);
+
+    mu_lock_mutex(&page_pool.doc_mutex);
+    fz_try(ctx)
+    {
+        page = fz_load_page(ctx, page_pool.doc, pagenum - 1);
+        list = fz_new_display_list(ctx, fz_bound_page(ctx, page));
+        dev = fz_new_list_device(ctx, list);
+        if (lowmemory)
+            fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
+        fz_run_page(ctx, page, dev, fz_identity, NULL);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+        fz_drop_page(ctx, page);
+        mu_unlock_mutex(&page_pool.doc_mutex);
+    }
+    fz_catch(ctx)
+    {
+        fz_drop_display_list(ctx, list);
+        fz_rethrow(ctx);
+    }
+
+    return list;
+}
+
+static void page_pool_draw_png(fz_context *ctx, fz_display_list *list, fz_cookie *cookie, Page *result)
+{
+    fz_matrix ctm;
+    fz_irect ibounds;
+    fz_pixmap *pix = NULL;
+    fz_buffer *buf = NULL;
+    fz_bitmap *bit = NULL;
+
+    fz_var(pix);
+    fz_var(buf);
+
+    ibounds = page_pixel_bounds(ctx, fz_bound_display_list(ctx, list), resolution, rotation, &ctm);
+
+    fz_try(ctx)
+    {
+        pix = fz_new_pixmap_with_bbox(ctx, colorspace, ibounds, NULL, alpha);
+        fz_set_pixmap_resolution(ctx, pix, resolution, resolution);
+        drawband(ctx, NULL, list, ctm, fz_rect_from_irect(ibounds), cookie, 0, pix, &bit);
+        buf = fz_new_buffer_from_pixmap_as_png(ctx, pix, fz_default_color_params);
+
+        result->data = (unsigned char *)malloc(buf->len);
+        if (!result->data)
+            fz_throw(ctx, FZ_ERROR_MEMORY, "cannot allocate page data");
+        memcpy(result->data, buf->data, buf->len);
+        result->len = (int)buf->len;
+        result->width = pix->w;
+        result->height = pix->h;
+        result->stride = 0;
+        result->format = PAGE_FORMAT_PNG;
+    }
+    fz_always(ctx)
+    {
+        fz_drop_bitmap(ctx, bit);
+        fz_drop_buffer(ctx, buf);
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx)
+    {
+        fz_rethrow(ctx);
+    }
+}
+
+static void page_pool_drawpage(fz_context *ctx, int pagenum)
+{
+    fz_display_list *list;
+    fz_cookie cookie = {0};
+    Page *result = &page_pool.pagelist->pages[pagenum - 1];
+
+    list = page_pool_load(ctx, pagenum);
+    fz_try(ctx)
+    {
+        if (page_format != PAGE_FORMAT_PNG)
+            drawpage_pixels(ctx, NULL, list, &cookie, result);
+        else
+            page_pool_draw_png(ctx, list, &cookie, result);
+    }
+    fz_always(ctx)
+        fz_drop_display_list(ctx, list);
+    fz_catch(ctx)
+        fz_rethrow(ctx);
+}
+
+static void page_worker_thread(void *arg)
+{
+    page_worker_t *me = (page_worker_t *)arg;
+    int index, pagenum, stop;
+
+    for (;;)
+    {
+        mu_lock_mutex(&page_pool.queue_mutex);
+        index = page_pool.next;
+        if (index < page_pool.count)
+            page_pool.next++;
+        mu_unlock_mutex(&page_pool.queue_mutex);
+
+        if (index >= page_pool.count)
+            break;
+
+        pagenum = page_pool.pages[index];
+        DEBUG_THREADS(("Page worker %d rendering page %d\n", me->num, pagenum));
+        fz_try(me->ctx)
+        {
+            page_pool_drawpage(me->ctx, pagenum);
+            mu_lock_mutex(&page_pool.deliver_mutex);
+            stop = deliver_page(pagenum, &page_pool.pagelist->pages[pagenum - 1]);
+            mu_unlock_mutex(&page_pool.deliver_mutex);
+            if (stop)
+            {
+                mu_lock_mutex(&page_pool.queue_mutex);
+                page_pool.next = page_pool.count;
+                mu_unlock_mutex(&page_pool.queue_mutex);
+            }
+        }
+        fz_catch(me->ctx)
+        {
+            if (ignore_errors)
+                fz_warn(me->ctx, "ignoring error on page %d", pagenum);
+            else
+            {
+                /* Stop handing out pages; the main thread will report it. */
+                mu_lock_mutex(&page_pool.queue_mutex);
+                page_pool.error = 1;
+                page_pool.next = page_pool.count;
+                mu_unlock_mutex(&page_pool.queue_mutex);
+                break;
+            }
+        }
+        mu_lock_mutex(&page_pool.pressure_mutex);
+        relieve_store_pressure(me->ctx);
+        mu_unlock_mutex(&page_pool.pressure_mutex);
+        fz_flush_warnings(me->ctx);
+    }
+    DEBUG_THREADS(("Page worker %d shutting down\n", me->num));
+}
+
+static void drawpages_parallel(fz_context *ctx, fz_document *doc, int *pages, int count, PageList *pagelist)
+{
+    page_worker_t *pool = NULL;
+    int i, started = 0;
+    int fail = 0;
+
+    page_pool.doc = doc;
+    page_pool.pagelist = pagelist;
+    page_pool.pages = pages;
+    page_pool.count = count;
+    page_pool.next = 0;
+    page_pool.error = 0;
+
+    fail |= mu_create_mutex(&page_pool.queue_mutex);
+    fail |= mu_create_mutex(&page_pool.doc_mutex);
+    fail |= mu_create_mutex(&page_pool.deliver_mutex);
+    fail |= mu_create_mutex(&page_pool.pressure_mutex);
+    if (fail)
+    {
+        mu_destroy_mutex(&page_pool.queue_mutex);
+        mu_destroy_mutex(&page_pool.doc_mutex);
+        mu_destroy_mutex(&page_pool.deliver_mutex);
+        mu_destroy_mutex(&page_pool.pressure_mutex);
+        fz_throw(ctx, FZ_ERROR_GENERIC, "page pool mutex initialisation failed");
+    }
+
+    fz_var(pool);
+    fz_var(started);
+
+    fz_try(ctx)
+    {
+        pool = fz_calloc(ctx, page_workers, sizeof(*pool));
+        for (i = 0; i < page_workers; i++)
+        {
+            pool[i].num = i;
+            pool[i].ctx = fz_clone_context(ctx);
+            if (!pool[i].ctx)
+                fz_throw(ctx, FZ_ERROR_GENERIC, "cannot clone context for page worker %d", i);
+            if (mu_create_thread(&pool[i].thread, page_worker_thread, &pool[i]))
+            {
+                fz_drop_context(pool[i].ctx);
+                pool[i].ctx = NULL;
+                fz_throw(ctx, FZ_ERROR_GENERIC, "cannot start page worker %d", i);
+            }
+            started++;
+        }
+    }
+    fz_catch(ctx)
+    {
+        /* Any workers we did start will drain the queue on their own. */
+        if (started == 0)
+            fail = 1;
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        mu_destroy_thread(&pool[i].thread);
+        fz_drop_context(pool[i].ctx);
+    }
+    fz_free(ctx, pool);
+
+    mu_destroy_mutex(&page_pool.queue_mutex);
+    mu_destroy_mutex(&page_pool.doc_mutex);
+    mu_destroy_mutex(&page_pool.deliver_mutex);
+    mu_destroy_mutex(&page_pool.pressure_mutex);
+    page_pool.doc = NULL;
+    page_pool.pagelist = NULL;
+    page_pool.pages = NULL;
+
+    if (fail)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot start page workers");
+    if (page_pool.error)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "failed to render page");
+}
+#endif
+
+/* The page numbers (1 based) to draw, in the order they should be drawn. */
+static int *page_queue(fz_context *ctx, const char *range, int pagecount, int *count)
+{
+    const char *r;
+    int page, spage, epage;
+    int *pages;
+    int i, n = 0;
+
+    if (page_order)
+    {
+        pages = fz_malloc_array(ctx, page_order_count, int);
+        for (i = 0; i < page_order_count; i++)
+        {
+            if (page_order[i] < 0 || page_order[i] >= pagecount)
+                fz_warn(ctx, "ignoring out of range page %d", page_order[i]);
+            else
+                pages[n++] = page_order[i] + 1;
+        }
+        *count = n;
+        return pages;
+    }
+
+    /* Count the pages first, then flatten the range into the queue. */
+    r = range;
+    while ((r = fz_parse_page_range(ctx, r, &spage, &epage, pagecount)))
+        n += (spage < epage ? epage - spage : spage - epage) + 1;
+
+    pages = fz_malloc_array(ctx, n, int);
+    n = 0;
+    while ((range = fz_parse_page_range(ctx, range, &spage, &epage, pagecount)))
+    {
+        if (spage < epage)
+            for (page = spage; page <= epage; page++)
+                pages[n++] = page;
+        else
+            for (page = spage; page >= epage; page--)
+                pages[n++] = page;
+    }
+    *count = n;
+    return pages;
+}
+
 static void drawrange(
     fz_context *ctx,
     fz_document *doc,
     const char *range,
     PageList *pagelist)
 {
-    int page, spage, epage, pagecount;
+    int i, count, pagecount;
+    int *pages;
 
     pagecount = fz_count_pages(ctx, doc);
     pagelist->count = pagecount;
-    pagelist->pages = (Page *)malloc(pagecount * sizeof(Page));
+    pagelist->pages = (Page *)calloc(pagecount, sizeof(Page));
     fprintf(stdout, "pagecount: %d\n", pagecount);
 
-    while ((range = fz_parse_page_range(ctx, range, &spage, &epage, pagecount)))
+    pages = page_queue(ctx, range, pagecount, &count);
+
+    fz_try(ctx)
     {
-        if (spage < epage)
-            for (page = spage; page <= epage; page++)
-            {
-                fz_try(ctx)
-                    drawpage(ctx, doc, page, pagelist);
-                fz_catch(ctx)
-                {
-                    if (ignore_errors)
-                        fz_warn(ctx, "ignoring error on page %d in '%s'", page, filename);
-                    else
-                        fz_rethrow(ctx);
-                }
-            }
+#ifndef DISABLE_MUTHREADS
+        if (page_workers > 0)
+            drawpages_parallel(ctx, doc, pages, count, pagelist);
         else
-            for (page = spage; page >= epage; page--)
+#endif
+        for (i = 0; i < count; i++)
+        {
+            fz_try(ctx)
+                drawpage(ctx, doc, pages[i], pagelist);
+            fz_catch(ctx)
             {
-                fz_try(ctx)
-                    drawpage(ctx, doc, page, pagelist);
-                fz_catch(ctx)
-                {
-                    if (ignore_errors)
-                        fz_warn(ctx, "ignoring error on page %d in '%s'", page, filename);
-                    else
-                        fz_rethrow(ctx);
-                }
+                if (ignore_errors)
+                    fz_warn(ctx, "ignoring error on page %d in '%s'", pages[i], filename);
+                else
+                    fz_rethrow(ctx);
             }
+            if (deliver_page(pages[i], &pagelist->pages[pages[i] - 1]))
+                break;
+            relieve_store_pressure(ctx);
+        }
     }
+    fz_always(ctx)
+        fz_free(ctx, pages);
+    fz_catch(ctx)
+        fz_rethrow(ctx);
 }
 
 static int
@@ -2055,7 +2535,7 @@ static void save_accelerator(fz_context *ctx, fz_document *doc, const char *fnam
     fz_save_accelerator(ctx, doc, absname);
 }
 
-int DrawPdfPages(char *filename, int m_resolution, int m_num_workers, int m_band_height, PageList *pagelist)
+static int draw_pdf_pages(char *filename, const DrawOptions *opts, PageList *pagelist)
 {
     char *password = "";
     fz_document *doc = NULL;
@@ -2065,20 +2545,42 @@ int DrawPdfPages(char *filename, int m_resolution, int m_num_workers, int m_band
     fz_alloc_context trace_alloc_ctx = {&trace_info, trace_malloc, trace_realloc, trace_free};
     fz_alloc_context *alloc_ctx = NULL;
     fz_locks_context *locks = NULL;
-    size_t max_store = FZ_STORE_DEFAULT;
+    size_t max_store = opts->store_size ? opts->store_size : FZ_STORE_DEFAULT;
 
     fz_var(doc);
     res_specified = 1;
     output_file_per_page = 1;
-    lowmemory = 1;
+    lowmemory = 0;
     showtime = 1;
     format = "png";
     output = "page-%d.png";
 
     // set by parameters
-    resolution = m_resolution;
-    num_workers = m_num_workers;
-    band_height = m_band_height;
+    resolution = opts->resolution;
+    num_workers = opts->num_workers;
+    band_height = opts->band_height;
+    page_format = opts->page_format;
+    store_pressure = opts->store_pressure;
+    store_pressure_opaque = opts->store_pressure_opaque;
+    page_workers = opts->page_workers;
+
+    if (page_format != PAGE_FORMAT_PNG)
+    {
+        /* Raw pixels are rendered in one pass straight into the page
+         * buffer, so there are no bands for workers to share. */
+        num_workers = 0;
+        band_height = 0;
+    }
+
+#ifdef DISABLE_MUTHREADS
+    page_workers = 0;
+#endif
+    if (page_workers > 0)
+    {
+        /* Each page worker renders whole pages on its own. */
+        num_workers = 0;
+        band_height = 0;
+    }
 
     //     while ((c = fz_getopt(argc, argv, "qp:o:F:R:r:w:h:fB:c:e:G:Is:A:DiW:H:S:T:t:d:U:XLvPl:y:Yz:Z:NO:am:K")) != -1)
     //     {
@@ -2882,3 +3384,458 @@ int DrawPdfPages(char *filename, int m_resolution, int m_num_workers, int m_band
 
     return (errored != 0);
 }
+
+void DefaultDrawOptions(DrawOptions *opts)
+{
+    opts->resolution = 72;
+    opts->num_workers = 0;
+    opts->band_height = 0;
+    opts->page_format = PAGE_FORMAT_PNG;
+    opts->store_size = FZ_STORE_DEFAULT;
+    opts->store_pressure = NULL;
+    opts->store_pressure_opaque = NULL;
+    opts->page_workers = 0;
+}
+
+int DrawPdfPagesWithOptions(char *filename, const DrawOptions *opts, PageList *pagelist)
+{
+    if (opts->page_format != PAGE_FORMAT_PNG && opts->page_format != PAGE_FORMAT_RGBA && opts->page_format != PAGE_FORMAT_BGRA)
+        return -1;
+    return draw_pdf_pages(filename, opts, pagelist);
+}
+
+int DrawPdfPages(char *filename, int m_resolution, int m_num_workers, int m_band_height, PageList *pagelist)
+{
+    DrawOptions opts;
+
+    DefaultDrawOptions(&opts);
+    opts.resolution = m_resolution;
+    opts.num_workers = m_num_workers;
+    opts.band_height = m_band_height;
+    return draw_pdf_pages(filename, &opts, pagelist);
+}
+
+int DrawPdfPagesRaw(char *filename, int m_resolution, int m_page_format, PageList *pagelist)
+{
+    DrawOptions opts;
+
+    if (m_page_format != PAGE_FORMAT_RGBA && m_page_format != PAGE_FORMAT_BGRA)
+        return -1;
+    DefaultDrawOptions(&opts);
+    opts.resolution = m_resolution;
+    opts.page_format = m_page_format;
+    return draw_pdf_pages(filename, &opts, pagelist);
+}
+
+int StreamPdfPages(char *filename, const DrawOptions *opts, const int *order, int order_count, PageReadyFn *ready, void *opaque)
+{
+    PageList pagelist = {NULL, 0};
+    int code;
+
+    if (!ready || (order && order_count < 0))
+        return -1;
+    if (opts->page_format != PAGE_FORMAT_PNG && opts->page_format != PAGE_FORMAT_RGBA && opts->page_format != PAGE_FORMAT_BGRA)
+        return -1;
+
+    page_ready = ready;
+    page_ready_opaque = opaque;
+    page_order = order;
+    page_order_count = order_count;
+
+    code = draw_pdf_pages(filename, opts, &pagelist);
+
+    page_ready = NULL;
+    page_ready_opaque = NULL;
+    page_order = NULL;
+    page_order_count = 0;
+
+    /* Every page has been delivered and released already. */
+    free(pagelist.pages);
+
+    return code;
+}
+
+/*
+ * Session API -- a re-entrant alternative to DrawPdfPages.
+ *
+ * All state lives in the PdfSession handle and in the RenderOptions passed
+ * to each call, so several sessions can be open at once and a single session
+ * can render pages from many threads. The document itself is not thread safe,
+ * so page loading and display list construction are serialised on a per
+ * session lock; rasterisation runs unlocked on a cloned context.
+ */
+
+struct PdfSession
+{
+    fz_context *ctx;
+    fz_document *doc;
+    int page_count;
+#ifndef DISABLE_MUTHREADS
+    fz_locks_context locks;
+    mu_mutex mutexes[FZ_LOCK_MAX];
+    mu_mutex doc_mutex;
+#endif
+};
+
+#ifndef DISABLE_MUTHREADS
+static void session_lock(void *user, int lock)
+{
+    PdfSession *session = (PdfSession *)user;
+    mu_lock_mutex(&session->mutexes[lock]);
+}
+
+static void session_unlock(void *user, int lock)
+{
+    PdfSession *session = (PdfSession *)user;
+    mu_unlock_mutex(&session->mutexes[lock]);
+}
+
+static void fin_session_locks(PdfSession *session)
+{
+    int i;
+
+    for (i = 0; i < FZ_LOCK_MAX; i++)
+        mu_destroy_mutex(&session->mutexes[i]);
+    mu_destroy_mutex(&session->doc_mutex);
+}
+
+static fz_locks_context *init_session_locks(PdfSession *session)
+{
+    int i;
+    int failed = 0;
+
+    for (i = 0; i < FZ_LOCK_MAX; i++)
+        failed |= mu_create_mutex(&session->mutexes[i]);
+    failed |= mu_create_mutex(&session->doc_mutex);
+
+    if (failed)
+    {
+        fin_session_locks(session);
+        return NULL;
+    }
+
+    session->locks.user = session;
+    session->locks.lock = session_lock;
+    session->locks.unlock = session_unlock;
+    return &session->locks;
+}
+#endif
+
+static void session_lock_document(PdfSession *session)
+{
+#ifndef DISABLE_MUTHREADS
+    mu_lock_mutex(&session->doc_mutex);
+#endif
+}
+
+static void session_unlock_document(PdfSession *session)
+{
+#ifndef DISABLE_MUTHREADS
+    mu_unlock_mutex(&session->doc_mutex);
+#endif
+}
+
+/* Every call works on its own context so that exception stacks and
+ * per-call settings (such as antialiasing) never leak between threads.
+ * Without threading support there is only ever one caller. */
+static fz_context *session_enter(PdfSession *session)
+{
+#ifndef DISABLE_MUTHREADS
+    return fz_clone_context(session->ctx);
+#else
+    return session->ctx;
+#endif
+}
+
+static void session_leave(PdfSession *session, fz_context *ctx)
+{
+    if (ctx != session->ctx)
+        fz_drop_context(ctx);
+}
+
+void DefaultRenderOptions(RenderOptions *opts)
+{
+    opts->resolution = 72;
+    opts->rotation = 0;
+    opts->alpha = 0;
+    opts->annotations = 1;
+    opts->aa_level = 8;
+    opts->format = PAGE_FORMAT_PNG;
+}
+
+PdfSession *OpenPdfSession(const char *filename, const char *password)
+{
+    PdfSession *session;
+    fz_locks_context *locks = NULL;
+    int failed = 0;
+
+    session = calloc(1, sizeof(*session));
+    if (!session)
+        return NULL;
+
+#ifndef DISABLE_MUTHREADS
+    locks = init_session_locks(session);
+    if (locks == NULL)
+    {
+        free(session);
+        return NULL;
+    }
+#endif
+
+    session->ctx = fz_new_context(NULL, locks, FZ_STORE_DEFAULT);
+    if (!session->ctx)
+    {
+#ifndef DISABLE_MUTHREADS
+        fin_session_locks(session);
+#endif
+        free(session);
+        return NULL;
+    }
+
+    fz_try(session->ctx)
+    {
+        fz_register_document_handlers(session->ctx);
+        session->doc = fz_open_document(session->ctx, filename);
+        if (fz_needs_password(session->ctx, session->doc))
+        {
+            if (!fz_authenticate_password(session->ctx, session->doc, password ? password : ""))
+                fz_throw(session->ctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", filename);
+        }
+        session->page_count = fz_count_pages(session->ctx, session->doc);
+    }
+    fz_catch(session->ctx)
+    {
+        failed = 1;
+    }
+
+    if (failed)
+    {
+        ClosePdfSession(session);
+        return NULL;
+    }
+
+    return session;
+}
+
+int CountPdfSessionPages(PdfSession *session)
+{
+    return session ? session->page_count : 0;
+}
+
+static fz_display_list *session_load_display_list(fz_context *ctx, PdfSession *session, int pagenum, int annotations)
+{
+    fz_page *page = NULL;
+    fz_display_list *list = NULL;
+
+    fz_var(page);
+
+    /* Lists live in the store shared by all the session's contexts,
+     * so pages drawn again (at another resolution, say) are not
+     * interpreted again. */
+    session_lock_document(session);
+    fz_try(ctx)
+    {
+        page = fz_load_page(ctx, session->doc, pagenum);
+        list = fz_get_display_list(ctx, page, annotations, 0);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_page(ctx, page);
+        session_unlock_document(session);
+    }
+    fz_catch(ctx)
+    {
+        fz_rethrow(ctx);
+    }
+
+    return list;
+}
+
+static fz_pixmap *session_render_display_list(fz_context *ctx, fz_display_list *list, const RenderOptions *opts)
+{
+    fz_matrix ctm;
+    fz_rect tbounds;
+    fz_irect ibounds;
+    fz_pixmap *pix;
+    fz_device *dev = NULL;
+    float zoom;
+
+    fz_var(dev);
+
+    zoom = opts->resolution / 72;
+    ctm = fz_pre_scale(fz_rotate(opts->rotation), zoom, zoom);
+    tbounds = fz_transform_rect(fz_bound_display_list(ctx, list), ctm);
+    ibounds = fz_round_rect(tbounds);
+
+    pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), ibounds, NULL, opts->alpha);
+    fz_try(ctx)
+    {
+        fz_set_pixmap_resolution(ctx, pix, opts->resolution, opts->resolution);
+        if (pix->alpha)
+            fz_clear_pixmap(ctx, pix);
+        else
+            fz_clear_pixmap_with_value(ctx, pix, 255);
+
+        dev = fz_new_draw_device(ctx, fz_identity, pix);
+        fz_run_display_list(ctx, list, dev, ctm, fz_rect_from_irect(ibounds), NULL);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx)
+    {
+        fz_drop_pixmap(ctx, pix);
+        fz_rethrow(ctx);
+    }
+
+    return pix;
+}
+
+static void session_render_png(fz_context *ctx, fz_display_list *list, const RenderOptions *opts, Page *result)
+{
+    fz_pixmap *pix = NULL;
+    fz_buffer *buf = NULL;
+
+    fz_var(buf);
+
+    pix = session_render_display_list(ctx, list, opts);
+    fz_try(ctx)
+    {
+        buf = fz_new_buffer_from_pixmap_as_png(ctx, pix, fz_default_color_params);
+
+        result->data = (unsigned char *)malloc(buf->len);
+        if (!result->data)
+            fz_throw(ctx, FZ_ERROR_MEMORY, "cannot allocate page data");
+        memcpy(result->data, buf->data, buf->len);
+        result->len = (int)buf->len;
+        result->width = pix->w;
+        result->height = pix->h;
+        result->stride = 0;
+        result->format = PAGE_FORMAT_PNG;
+    }
+    fz_always(ctx)
+    {
+        fz_drop_buffer(ctx, buf);
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx)
+    {
+        fz_rethrow(ctx);
+    }
+}
+
+static void session_render_pixels(fz_context *ctx, fz_display_list *list, const RenderOptions *opts, Page *result)
+{
+    fz_matrix ctm;
+    fz_irect ibounds;
+    unsigned char *samples = result->data;
+    size_t len;
+    int stride;
+
+    ibounds = page_pixel_bounds(ctx, fz_bound_display_list(ctx, list), opts->resolution, opts->rotation, &ctm);
+    len = page_pixel_size(ctx, ibounds, &stride);
+    if (len > INT_MAX)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "page too large");
+
+    /* Render into the caller's buffer if it gave one, but never swap it
+     * for one of ours behind its back; tell it the size needed instead. */
+    if (samples && (size_t)result->len < len)
+    {
+        result->len = (int)len;
+        fz_throw(ctx, FZ_ERROR_GENERIC, "page buffer too small");
+    }
+    if (!samples)
+    {
+        samples = (unsigned char *)malloc(len);
+        if (!samples)
+            fz_throw(ctx, FZ_ERROR_MEMORY, "cannot allocate page pixels");
+    }
+
+    fz_try(ctx)
+        render_page_pixels(ctx, NULL, list, ctm, ibounds, opts->format, opts->alpha, NULL, 0, samples, NULL);
+    fz_catch(ctx)
+    {
+        if (samples != result->data)
+            free(samples);
+        fz_rethrow(ctx);
+    }
+
+    result->data = samples;
+    result->len = (int)len;
+    result->width = ibounds.x1 - ibounds.x0;
+    result->height = ibounds.y1 - ibounds.y0;
+    result->stride = stride;
+    result->format = opts->format;
+}
+
+int RenderPdfSessionPage(PdfSession *session, int pagenum, const RenderOptions *opts, Page *result)
+{
+    RenderOptions defaults;
+    fz_context *ctx;
+    fz_display_list *list = NULL;
+    int code = 0;
+
+    if (!session || !result || pagenum < 0 || pagenum >= session->page_count)
+        return -1;
+
+    if (!opts)
+    {
+        DefaultRenderOptions(&defaults);
+        opts = &defaults;
+    }
+
+    if (opts->format != PAGE_FORMAT_PNG && opts->format != PAGE_FORMAT_RGBA && opts->format != PAGE_FORMAT_BGRA)
+        return -1;
+
+    ctx = session_enter(session);
+    if (!ctx)
+        return -1;
+
+    fz_var(list);
+
+    fz_try(ctx)
+    {
+        fz_set_aa_level(ctx, opts->aa_level);
+        list = session_load_display_list(ctx, session, pagenum, opts->annotations);
+        if (opts->format == PAGE_FORMAT_PNG)
+            session_render_png(ctx, list, opts, result);
+        else
+            session_render_pixels(ctx, list, opts, result);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_display_list(ctx, list);
+    }
+    fz_catch(ctx)
+    {
+        code = -1;
+    }
+
+    session_leave(session, ctx);
+
+    return code;
+}
+
+void DropPageData(Page *page)
+{
+    if (!page)
+        return;
+    free(page->data);
+    page->data = NULL;
+    page->len = 0;
+}
+
+void ClosePdfSession(PdfSession *session)
+{
+    if (!session)
+        return;
+
+    fz_drop_document(session->ctx, session->doc);
+    fz_drop_context(session->ctx);
+#ifndef DISABLE_MUTHREADS
+    fin_session_locks(session);
+#endif
+    free(session);
+}